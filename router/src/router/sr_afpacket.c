@@ -0,0 +1,505 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_afpacket.c
+ *
+ * Description:
+ *
+ * AF_PACKET datapath, see sr_afpacket.h.
+ *
+ * Each device gets one socket with an rx ring of SR_AFPACKET_RX_BLOCKS
+ * blocks followed by a tx ring of fixed SR_AFPACKET_FRAME_SIZE slots, in
+ * one mapping. The kernel fills an rx block with as many frames as fit
+ * and hands it over when it is full or SR_AFPACKET_BLOCK_TMO has passed;
+ * the reader walks the frames in place and gives the block back.
+ *
+ * Frames sent while the reader is handling a block are only queued: the
+ * reader kicks each tx ring with one send(2) once it has been through
+ * every ready block, so a burst of forwarded frames costs one system call
+ * per device rather than one per frame. Other threads (workers, the ARP
+ * timer) kick the ring themselves.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_afpacket.h"
+
+#define SR_AFPACKET_TX_OFF  TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+#define SR_AFPACKET_TX_MAX  (SR_AFPACKET_FRAME_SIZE - SR_AFPACKET_TX_OFF)
+
+struct sr_afpacket_port
+{
+    char dev[IFNAMSIZ];
+    uint32_t ip;                /* nbo, 0 to take the device's */
+    unsigned int ifindex;       /* router interface */
+    int fd;
+    uint8_t* map;
+    size_t map_len;
+    uint8_t* tx_ring;           /* within map */
+    unsigned int rx_block;      /* next rx block to look at */
+    unsigned int tx_head;       /* next tx slot to fill */
+    unsigned int tx_slots;
+    int tx_pending;             /* queued by the reader, not kicked yet */
+    pthread_mutex_t tx_lock;
+    unsigned long rx_frames, rx_blocks;
+    unsigned long tx_frames, tx_drops;
+};
+
+struct sr_afpacket
+{
+    unsigned int nports;
+    int stop;
+    struct sr_afpacket_port ports[SR_AFPACKET_MAX_IFACES];
+};
+
+/* -- set on the reader while it handles a block -- */
+static __thread int sr_afpacket_batching = 0;
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_add(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_afpacket_add(struct sr_instance* sr, const char* spec)
+{
+    struct sr_afpacket* afp = sr->afpacket;
+    struct sr_afpacket_port* port;
+    const char* colon = strchr(spec, ':');
+    size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+    struct in_addr ip;
+
+    if (!afp && !(afp = sr->afpacket =
+                (struct sr_afpacket*)calloc(1, sizeof(struct sr_afpacket))))
+    { return -1; }
+
+    if (afp->nports == SR_AFPACKET_MAX_IFACES)
+    {
+        fprintf(stderr, "Error: more than %d interfaces\n",
+                SR_AFPACKET_MAX_IFACES);
+        return -1;
+    }
+    if (len == 0 || len >= IFNAMSIZ)
+    {
+        fprintf(stderr, "Error: bad device name in %s\n", spec);
+        return -1;
+    }
+    ip.s_addr = 0;
+    if (colon && inet_aton(colon + 1, &ip) == 0)
+    {
+        fprintf(stderr, "Error: bad IP address in %s\n", spec);
+        return -1;
+    }
+
+    port = &afp->ports[afp->nports++];
+    memcpy(port->dev, spec, len);
+    port->dev[len] = 0;
+    port->ip = ip.s_addr;
+    port->fd = -1;
+    pthread_mutex_init(&(port->tx_lock), NULL);
+
+    return 0;
+} /* -- sr_afpacket_add -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_open_port(..)
+ * Scope:  Local
+ *
+ * Set up the socket and rings for one device, and fill in mac (and ip
+ * if it was not given).
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_afpacket_open_port(struct sr_afpacket_port* port,
+                                 unsigned char* mac)
+{
+    struct tpacket_req3 req;
+    struct sockaddr_ll sll;
+    struct ifreq ifr;
+    size_t rx_len, tx_len;
+    int version = TPACKET_V3;
+    int one = 1;
+    int dev_index;
+
+    if ((port->fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0)
+    {
+        perror("socket(..):sr_afpacket_open");
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, port->dev, IFNAMSIZ - 1);
+    if (ioctl(port->fd, SIOCGIFINDEX, &ifr) < 0)
+    {
+        fprintf(stderr, "Error: no device %s\n", port->dev);
+        return -1;
+    }
+    dev_index = ifr.ifr_ifindex;
+
+    if (ioctl(port->fd, SIOCGIFHWADDR, &ifr) < 0 ||
+        ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER)
+    {
+        fprintf(stderr, "Error: %s is not an Ethernet device\n", port->dev);
+        return -1;
+    }
+    memcpy(mac, ifr.ifr_hwaddr.sa_data, ETHER_ADDR_LEN);
+
+    if (port->ip == 0)
+    {
+        if (ioctl(port->fd, SIOCGIFADDR, &ifr) < 0)
+        {
+            fprintf(stderr, "Error: %s has no IP address, give one as "
+                    "%s:a.b.c.d\n", port->dev, port->dev);
+            return -1;
+        }
+        port->ip = ((struct sockaddr_in*)&ifr.ifr_addr)->sin_addr.s_addr;
+    }
+
+    if (setsockopt(port->fd, SOL_PACKET, PACKET_VERSION,
+                   &version, sizeof(version)) < 0)
+    {
+        perror("setsockopt(PACKET_VERSION):sr_afpacket_open");
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = SR_AFPACKET_BLOCK_SIZE;
+    req.tp_frame_size = SR_AFPACKET_FRAME_SIZE;
+    req.tp_block_nr = SR_AFPACKET_RX_BLOCKS;
+    req.tp_frame_nr = (SR_AFPACKET_BLOCK_SIZE / SR_AFPACKET_FRAME_SIZE) *
+                      SR_AFPACKET_RX_BLOCKS;
+    req.tp_retire_blk_tov = SR_AFPACKET_BLOCK_TMO;
+    if (setsockopt(port->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+    {
+        perror("setsockopt(PACKET_RX_RING):sr_afpacket_open");
+        return -1;
+    }
+    rx_len = (size_t)req.tp_block_size * req.tp_block_nr;
+
+    req.tp_block_nr = SR_AFPACKET_TX_BLOCKS;
+    req.tp_frame_nr = (SR_AFPACKET_BLOCK_SIZE / SR_AFPACKET_FRAME_SIZE) *
+                      SR_AFPACKET_TX_BLOCKS;
+    req.tp_retire_blk_tov = 0;
+    if (setsockopt(port->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0)
+    {
+        perror("setsockopt(PACKET_TX_RING):sr_afpacket_open");
+        return -1;
+    }
+    tx_len = (size_t)req.tp_block_size * req.tp_block_nr;
+    port->tx_slots = req.tp_frame_nr;
+
+    /* -- both are optimisations, older kernels go without -- */
+    setsockopt(port->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+#ifdef PACKET_IGNORE_OUTGOING
+    setsockopt(port->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#endif
+
+    port->map_len = rx_len + tx_len;
+    port->map = mmap(0, port->map_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, port->fd, 0);
+    if (port->map == MAP_FAILED)
+    {
+        port->map = 0;
+        perror("mmap(..):sr_afpacket_open");
+        return -1;
+    }
+    port->tx_ring = port->map + rx_len;
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = dev_index;
+    if (bind(port->fd, (struct sockaddr*)&sll, sizeof(sll)) < 0)
+    {
+        perror("bind(..):sr_afpacket_open");
+        return -1;
+    }
+
+    return 0;
+} /* -- sr_afpacket_open_port -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_open(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_afpacket_open(struct sr_instance* sr)
+{
+    struct sr_afpacket* afp = sr->afpacket;
+    struct sr_afpacket_port* port;
+    unsigned char mac[ETHER_ADDR_LEN];
+    unsigned int i;
+
+    for (i = 0; i < afp->nports; i++)
+    {
+        port = &afp->ports[i];
+        if (sr_afpacket_open_port(port, mac) != 0)
+        { return -1; }
+
+        sr_add_interface(sr, port->dev);
+        sr_set_ether_addr(sr, mac);
+        sr_set_ether_ip(sr, port->ip);
+        port->ifindex = sr->if_count - 1;
+    }
+
+    /* -- routes loaded before the interfaces were known -- */
+    sr_rt_bind_interfaces(sr);
+
+    printf("Router interfaces:\n");
+    sr_print_if_list(sr);
+
+    return 0;
+} /* -- sr_afpacket_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_kick(..)
+ * Scope:  Local
+ *
+ * Have the kernel transmit what is queued on port's tx ring. With wait
+ * set, returns only once it has been through the ring.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_afpacket_kick(struct sr_afpacket_port* port, int wait)
+{
+    while (send(port->fd, 0, 0, wait ? 0 : MSG_DONTWAIT) < 0 &&
+           errno == EINTR)
+    { }
+} /* -- sr_afpacket_kick -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_send(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_afpacket_send(struct sr_afpacket* afp, unsigned int ifindex,
+                     const uint8_t* buf, unsigned int len)
+{
+    struct sr_afpacket_port* port;
+    struct tpacket3_hdr* hdr;
+
+    /* -- the router has no interfaces but ours, added in port order -- */
+    if (ifindex >= afp->nports || len > SR_AFPACKET_TX_MAX)
+    { return -1; }
+    port = &afp->ports[ifindex];
+
+    pthread_mutex_lock(&(port->tx_lock));
+
+    if (port->fd < 0)
+    {
+        pthread_mutex_unlock(&(port->tx_lock));
+        return -1;
+    }
+
+    hdr = (struct tpacket3_hdr*)(port->tx_ring +
+            (size_t)port->tx_head * SR_AFPACKET_FRAME_SIZE);
+
+    /* -- ring full: let the kernel catch up once, then give up -- */
+    if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) &
+        (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING))
+    {
+        sr_afpacket_kick(port, 1);
+        port->tx_pending = 0;
+        if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) &
+            (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING))
+        {
+            port->tx_drops++;
+            pthread_mutex_unlock(&(port->tx_lock));
+            return -1;
+        }
+    }
+
+    memcpy((uint8_t*)hdr + SR_AFPACKET_TX_OFF, buf, len);
+    hdr->tp_len = len;
+    hdr->tp_snaplen = len;
+    hdr->tp_next_offset = 0;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+    if (++port->tx_head == port->tx_slots)
+    { port->tx_head = 0; }
+    port->tx_frames++;
+
+    if (sr_afpacket_batching)
+    { port->tx_pending = 1; }
+    else
+    { sr_afpacket_kick(port, 0); }
+
+    pthread_mutex_unlock(&(port->tx_lock));
+
+    return 0;
+} /* -- sr_afpacket_send -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_drain(..)
+ * Scope:  Local
+ *
+ * Handle every block the kernel has handed over on port, at most one
+ * ring's worth. Frames the router sent itself and frames cut short by
+ * the ring are skipped.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_afpacket_drain(struct sr_instance* sr,
+                              struct sr_afpacket_port* port)
+{
+    struct tpacket_block_desc* bd;
+    struct tpacket3_hdr* pkt;
+    struct sockaddr_ll* sll;
+    char* name = sr_get_interface_by_index(sr, port->ifindex)->name;
+    unsigned int n, i;
+
+    for (n = 0; n < SR_AFPACKET_RX_BLOCKS; n++)
+    {
+        bd = (struct tpacket_block_desc*)(port->map +
+                (size_t)port->rx_block * SR_AFPACKET_BLOCK_SIZE);
+        if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+              TP_STATUS_USER))
+        { break; }
+
+        pkt = (struct tpacket3_hdr*)((uint8_t*)bd +
+                bd->hdr.bh1.offset_to_first_pkt);
+        for (i = 0; i < bd->hdr.bh1.num_pkts; i++)
+        {
+            sll = (struct sockaddr_ll*)((uint8_t*)pkt +
+                    TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+            if (sll->sll_pkttype != PACKET_OUTGOING &&
+                pkt->tp_snaplen == pkt->tp_len)
+            {
+                sr_receive_packet(sr, (uint8_t*)pkt + pkt->tp_mac,
+                                  pkt->tp_snaplen, name);
+            }
+            pkt = (struct tpacket3_hdr*)((uint8_t*)pkt + pkt->tp_next_offset);
+        }
+
+        port->rx_frames += bd->hdr.bh1.num_pkts;
+        port->rx_blocks++;
+        __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+                         __ATOMIC_RELEASE);
+        if (++port->rx_block == SR_AFPACKET_RX_BLOCKS)
+        { port->rx_block = 0; }
+    }
+} /* -- sr_afpacket_drain -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_run(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_afpacket_run(struct sr_instance* sr)
+{
+    struct sr_afpacket* afp = sr->afpacket;
+    struct pollfd pfd[SR_AFPACKET_MAX_IFACES];
+    struct sr_afpacket_port* port;
+    unsigned int i;
+    int pending;
+
+    for (i = 0; i < afp->nports; i++)
+    {
+        pfd[i].fd = afp->ports[i].fd;
+        pfd[i].events = POLLIN | POLLERR;
+    }
+
+    while (!__atomic_load_n(&afp->stop, __ATOMIC_RELAXED))
+    {
+        sr_afpacket_batching = 1;
+        for (i = 0; i < afp->nports; i++)
+        { sr_afpacket_drain(sr, &afp->ports[i]); }
+        sr_afpacket_batching = 0;
+
+        /* -- one kick per device for everything forwarded above -- */
+        for (i = 0; i < afp->nports; i++)
+        {
+            port = &afp->ports[i];
+            pthread_mutex_lock(&(port->tx_lock));
+            pending = port->tx_pending;
+            port->tx_pending = 0;
+            if (pending)
+            { sr_afpacket_kick(port, 0); }
+            pthread_mutex_unlock(&(port->tx_lock));
+        }
+
+        /* -- a timeout now and then to notice stop -- */
+        if (poll(pfd, afp->nports, 100) < 0 && errno != EINTR)
+        {
+            perror("poll(..):sr_afpacket_run");
+            return -1;
+        }
+    }
+
+    return 0;
+} /* -- sr_afpacket_run -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_stop(..)
+ * Scope:  Global
+ *
+ * Only stores a flag, so it may be called from a signal handler.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_afpacket_stop(struct sr_instance* sr)
+{
+    if (sr->afpacket)
+    { __atomic_store_n(&(sr->afpacket->stop), 1, __ATOMIC_RELAXED); }
+} /* -- sr_afpacket_stop -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_close(..)
+ * Scope:  Global
+ *
+ * Each port is torn down under its tx lock, so a thread still sending
+ * (the ARP timer) finds it closed rather than unmapped. The ports
+ * themselves are left allocated for the same reason.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_afpacket_close(struct sr_instance* sr)
+{
+    struct sr_afpacket* afp = sr->afpacket;
+    struct sr_afpacket_port* port;
+    unsigned int i;
+
+    if (!afp)
+    { return; }
+
+    for (i = 0; i < afp->nports; i++)
+    {
+        port = &afp->ports[i];
+        pthread_mutex_lock(&(port->tx_lock));
+        if (port->fd >= 0)
+        {
+            sr_afpacket_kick(port, 1);
+            fprintf(stderr, "%s: %lu frames received in %lu blocks, "
+                    "%lu sent, %lu dropped on a full tx ring\n", port->dev,
+                    port->rx_frames, port->rx_blocks,
+                    port->tx_frames, port->tx_drops);
+        }
+        if (port->map)
+        { munmap(port->map, port->map_len); }
+        if (port->fd >= 0)
+        { close(port->fd); }
+        port->map = 0;
+        port->fd = -1;
+        pthread_mutex_unlock(&(port->tx_lock));
+    }
+} /* -- sr_afpacket_close -- */
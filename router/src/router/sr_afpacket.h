@@ -0,0 +1,61 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_afpacket.h
+ * Description:
+ *
+ * Local datapath: instead of exchanging frames with the VNS server, each
+ * router interface is bound to a Linux network device (a veth end in a
+ * namespace, say) through an AF_PACKET socket with TPACKET_V3 rx and tx
+ * rings mapped into the process. Received frames are handed to the router
+ * straight out of the rx ring a block at a time; sr_send_packet copies
+ * outgoing frames into the tx ring of the egress device. There is no
+ * server, no framing and no copy on receive.
+ *
+ * The router takes its MAC address from the device and its IP address
+ * from the command line or, failing that, the device. A device that has
+ * an IP address configured will also be answered by the kernel's own
+ * stack, so normally the devices are left unnumbered and the addresses
+ * given on the command line.
+ *
+ * Needs CAP_NET_RAW. Linux 4.11 or later for tx rings with TPACKET_V3.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_AFPACKET_H
+#define sr_AFPACKET_H
+
+#include <stdint.h>
+
+#define SR_AFPACKET_MAX_IFACES  16
+#define SR_AFPACKET_BLOCK_SIZE  (1 << 20)  /* bytes per ring block */
+#define SR_AFPACKET_RX_BLOCKS   8
+#define SR_AFPACKET_TX_BLOCKS   2
+#define SR_AFPACKET_FRAME_SIZE  2048       /* tx slot, also largest frame */
+#define SR_AFPACKET_BLOCK_TMO   1          /* ms before a partial rx block
+                                              is handed over */
+
+struct sr_instance;
+struct sr_afpacket;
+
+/* Adds a router interface bound to device dev; spec is "dev" or
+   "dev:a.b.c.d". Call for every interface before sr_afpacket_open.
+   Returns 0 on success. */
+int sr_afpacket_add(struct sr_instance* sr, const char* spec);
+
+/* Opens and maps the rings of every interface added and creates the
+   router's interfaces from them. Returns 0 on success. */
+int sr_afpacket_open(struct sr_instance* sr);
+
+/* Receives and handles frames until sr_afpacket_stop is called (from a
+   signal handler, for instance). Returns 0, or -1 on a socket error. */
+int sr_afpacket_run(struct sr_instance* sr);
+void sr_afpacket_stop(struct sr_instance* sr);
+
+/* Queues a frame on the tx ring of interface ifindex. Called by
+   sr_send_packet; safe from any thread. Returns 0 on success. */
+int sr_afpacket_send(struct sr_afpacket* afp, unsigned int ifindex,
+                     const uint8_t* buf, unsigned int len);
+
+/* Unmaps and closes everything and prints the counters. */
+void sr_afpacket_close(struct sr_instance* sr);
+
+#endif  /* --  sr_AFPACKET_H -- */
@@ -10,71 +10,248 @@
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
+#include "sr_pktbuf.h"
+#include "sr_stats.h"
+
+/* Work decided under the cache lock and carried out after releasing it, so
+   that no packet is built or sent while the lock is held. */
+struct sr_arpreq_action {
+    uint32_t ip;
+    int ifindex;                    /* >= 0: send an ARP request for ip here */
+    struct sr_arpreq *expired;      /* set: unlinked request to give up on */
+};
+
+static int sr_arpreq_unlink(struct sr_arpcache *cache, struct sr_arpreq *entry);
+
+/* Decides what to do with a request that is due (never sent, or its
+   retransmit timer fired), updating its retransmit state. Caller must hold
+   the cache lock. Returns 1 if act holds work to do. */
+static int sr_arpreq_poll(struct sr_arpcache *cache, struct sr_arpreq *req,
+                          struct sr_arpreq_action *act) {
+    act->ifindex = -1;
+    act->expired = NULL;
+
+    if (req->times_sent >= 5) {
+        sr_arpreq_unlink(cache, req);
+        act->expired = req;
+    } else {
+        act->ip = req->ip;
+        if (req->packets)
+            act->ifindex = req->packets->ifindex;
+
+        // Update request state and retry in a second
+        req->sent = time(NULL);
+        req->times_sent++;
+        sr_timer_add(&(cache->req_timers), &(req->timer),
+                     sr_timer_now() + SR_TIMER_MS(1000));
+    }
+    return 1;
+}
+
+/* Carries out an action produced by sr_arpreq_poll. Must be called without
+   the cache lock held. */
+static void sr_arpreq_act(struct sr_instance *sr, struct sr_arpreq_action *act) {
+    if (act->expired) {
+        printf("ARP request timed out after 5 attempts\n");
+        sr_stats_count(SR_STATS_ARP_TIMEOUT);
+        // Send ICMP host unreachable to all waiting packets
+        struct sr_packet* pkt = act->expired->packets;
+        while (pkt) {
+            struct sr_if* iface = sr_get_interface_by_index(sr, pkt->ifindex);
+            if (iface)
+                sr_send_icmp_host_unreachable(sr, pkt->buf, iface->name);
+            pkt = pkt->next;
+        }
+
+        // Destroy the ARP request
+        sr_arpreq_destroy(&(sr->cache), act->expired);
+    } else if (act->ifindex >= 0) {
+        // Send (or resend) ARP request
+        struct sr_if* iface = sr_get_interface_by_index(sr, act->ifindex);
+        if (iface)
+            sr_send_arp_request(sr, act->ip, iface);
+    }
+}
 
 /*
-  This function gets called every second. For each request sent out, we keep
-  checking whether we should resend an request or destroy the arp request.
-  See the comments in the header file for an idea of what it should look like.
+  This function gets called every timer tick. For each request whose
+  retransmit timer fired, we decide whether we should resend the request or
+  destroy the arp request. See the comments in the header file for an idea
+  of what it should look like. The decisions are made under the cache lock;
+  the resulting ARP requests and ICMP errors are sent after it is released.
 */
-void sr_arpcache_sweepreqs(struct sr_instance *sr) {
-    struct sr_arpreq* req = sr->cache.requests;
-    while (req) {
-        struct sr_arpreq* next = req->next;
-        handle_arpreq(sr, req);
-        req = next;
+void sr_arpcache_sweepreqs(struct sr_instance *sr, uint64_t now) {
+    struct sr_arpcache *cache = &(sr->cache);
+    struct sr_arpreq_action *acts = NULL;
+    unsigned int n = 0, cap = 0, i;
+
+    pthread_mutex_lock(&(cache->lock));
+
+    struct sr_timer* fired = sr_timer_advance(&(cache->req_timers), now);
+    struct sr_timer* timer;
+
+    for (timer = fired; timer; timer = timer->next)
+        cap++;
+    if (cap)
+        acts = (struct sr_arpreq_action *) malloc(cap * sizeof(*acts));
+
+    for (timer = fired; timer; ) {
+        struct sr_timer* next = timer->next;
+        struct sr_arpreq* req = sr_timer_entry(timer, struct sr_arpreq, timer);
+        if (!acts)  /* out of memory: try again next tick */
+            sr_timer_add(&(cache->req_timers), timer, now + 1);
+        else if (sr_arpreq_poll(cache, req, &acts[n]))
+            n++;
+        timer = next;
     }
+
+    pthread_mutex_unlock(&(cache->lock));
+
+    for (i = 0; i < n; i++)
+        sr_arpreq_act(sr, &acts[i]);
+    free(acts);
 }
 
 void handle_arpreq(struct sr_instance* sr, struct sr_arpreq* req) {
-    time_t now = time(NULL);
-    
-    // Check if it's time to send a new request
-    if (difftime(now, req->sent) > 1.0) {
-        if (req->times_sent >= 5) {
-            printf("ARP request timed out after 5 attempts\n");
-            // Send ICMP host unreachable to all waiting packets
-            struct sr_packet* pkt = req->packets;
-            while (pkt) {
-                sr_send_icmp_host_unreachable(sr, pkt->buf, pkt->iface);
-                pkt = pkt->next;
-            }
-            
-            // Destroy the ARP request
-            sr_arpreq_destroy(&(sr->cache), req);
-            
-        } else {
-            // Send (or resend) ARP request
-            struct sr_if* iface = sr_get_interface(sr, req->packets->iface);
-            sr_send_arp_request(sr, req->ip, iface);
-            
-            // Update request state
-            req->sent = now;
-            req->times_sent++;
+    struct sr_arpcache *cache = &(sr->cache);
+    struct sr_arpreq_action act;
+    struct sr_arpreq *walker;
+    int due = 0;
+
+    pthread_mutex_lock(&(cache->lock));
+
+    /* The sweeper or an ARP reply may have retired req since it was queued.
+       Once sent, a request is driven by its retransmit timer. */
+    for (walker = cache->requests; walker; walker = walker->next) {
+        if (walker == req) {
+            if (!sr_timer_pending(&(req->timer)))
+                due = sr_arpreq_poll(cache, req, &act);
+            break;
         }
     }
+
+    pthread_mutex_unlock(&(cache->lock));
+
+    if (due)
+        sr_arpreq_act(sr, &act);
 }
 
 /* You should not need to touch the rest of this code. */
 
+/* Fields read by lock-free lookups are accessed with relaxed atomics on
+   both sides; the sequence counter orders them. */
+#define SR_READ_ONCE(x)     __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define SR_WRITE_ONCE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+/* Writers hold the cache lock and bracket every change to the hash chains
+   or to an entry's ip/mac with these, leaving cache->seq odd meanwhile. */
+static void sr_arpcache_write_begin(struct sr_arpcache *cache) {
+    SR_WRITE_ONCE(cache->seq, cache->seq + 1);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void sr_arpcache_write_end(struct sr_arpcache *cache) {
+    __atomic_store_n(&(cache->seq), cache->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Bucket index for ip. Multiplicative hashing spreads the mostly
+   sequential host addresses of a subnet across the table. */
+static uint32_t sr_arpcache_hash(struct sr_arpcache *cache, uint32_t ip) {
+    return (ntohl(ip) * 2654435761u) & cache->bucket_mask;
+}
+
+/* Returns the slot holding a valid mapping for ip, or SR_ARPCACHE_NONE.
+   Caller must hold the cache lock. */
+static uint32_t sr_arpcache_find(struct sr_arpcache *cache, uint32_t ip) {
+    uint32_t i = cache->buckets[sr_arpcache_hash(cache, ip)];
+
+    while (i != SR_ARPCACHE_NONE && cache->entries[i].ip != ip) {
+        i = cache->entries[i].hash_next;
+    }
+
+    return i;
+}
+
+static void sr_arpcache_lru_unlink(struct sr_arpcache *cache, uint32_t i) {
+    struct sr_arpentry *entry = &(cache->entries[i]);
+
+    if (entry->lru_prev != SR_ARPCACHE_NONE)
+        cache->entries[entry->lru_prev].lru_next = entry->lru_next;
+    else
+        cache->lru_head = entry->lru_next;
+
+    if (entry->lru_next != SR_ARPCACHE_NONE)
+        cache->entries[entry->lru_next].lru_prev = entry->lru_prev;
+    else
+        cache->lru_tail = entry->lru_prev;
+}
+
+static void sr_arpcache_lru_push(struct sr_arpcache *cache, uint32_t i) {
+    struct sr_arpentry *entry = &(cache->entries[i]);
+
+    entry->lru_prev = SR_ARPCACHE_NONE;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head != SR_ARPCACHE_NONE)
+        cache->entries[cache->lru_head].lru_prev = i;
+    else
+        cache->lru_tail = i;
+    cache->lru_head = i;
+}
+
+/* Picks the entry to evict when the table is full. Lock-free readers cannot
+   reorder the LRU list, so they set the referenced bit instead and the list
+   is aged CLOCK style: referenced entries at the tail get a second chance
+   at the head. Caller must hold the cache lock. */
+static uint32_t sr_arpcache_victim(struct sr_arpcache *cache) {
+    uint32_t i = cache->lru_tail;
+
+    while (SR_READ_ONCE(cache->entries[i].referenced)) {
+        SR_WRITE_ONCE(cache->entries[i].referenced, 0);
+        sr_arpcache_lru_unlink(cache, i);
+        sr_arpcache_lru_push(cache, i);
+        i = cache->lru_tail;
+    }
+
+    return i;
+}
+
+/* Unhashes slot i, takes it off the LRU list and returns it to the free
+   list. Caller must hold the cache lock inside a write section. */
+static void sr_arpcache_remove(struct sr_arpcache *cache, uint32_t i) {
+    struct sr_arpentry *entry = &(cache->entries[i]);
+    uint32_t *link = &(cache->buckets[sr_arpcache_hash(cache, entry->ip)]);
+
+    while (*link != i) {
+        link = &(cache->entries[*link].hash_next);
+    }
+    SR_WRITE_ONCE(*link, entry->hash_next);
+
+    sr_arpcache_lru_unlink(cache, i);
+    sr_timer_del(&(entry->timer));
+
+    entry->valid = 0;
+    entry->lru_next = cache->free_head;
+    cache->free_head = i;
+    cache->count--;
+}
+
 /* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
    You must free the returned structure if it is not NULL. */
 struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
     pthread_mutex_lock(&(cache->lock));
 
-    struct sr_arpentry *entry = NULL, *copy = NULL;
-
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        if ((cache->entries[i].valid) && (cache->entries[i].ip == ip)) {
-            entry = &(cache->entries[i]);
-        }
-    }
+    struct sr_arpentry *copy = NULL;
+    uint32_t i = sr_arpcache_find(cache, ip);
 
     /* Must return a copy b/c another thread could jump in and modify
        table after we return. */
-    if (entry) {
+    __atomic_fetch_add(&(cache->lookups), 1, __ATOMIC_RELAXED);
+    if (i != SR_ARPCACHE_NONE) {
+        SR_WRITE_ONCE(cache->entries[i].referenced, 1);
+
         copy = (struct sr_arpentry *) malloc(sizeof(struct sr_arpentry));
-        memcpy(copy, entry, sizeof(struct sr_arpentry));
+        memcpy(copy, &(cache->entries[i]), sizeof(struct sr_arpentry));
+        __atomic_fetch_add(&(cache->lookup_allocs), 1, __ATOMIC_RELAXED);
     }
 
     pthread_mutex_unlock(&(cache->lock));
@@ -82,6 +259,52 @@ struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
     return copy;
 }
 
+/* Copies the MAC for ip into mac and returns 1 if the mapping is cached,
+   0 otherwise. Nothing is allocated and the cache lock is not taken: the
+   chain walk is retried if a writer ran concurrently. Indices read during
+   a torn walk are bounds checked so a retry is the worst outcome. */
+int sr_arpcache_lookup_mac(struct sr_arpcache *cache, uint32_t ip,
+                           unsigned char mac[ETHER_ADDR_LEN]) {
+    unsigned char copy[ETHER_ADDR_LEN];
+    uint32_t seq, i, steps;
+    int k;
+
+    __atomic_fetch_add(&(cache->lookups), 1, __ATOMIC_RELAXED);
+
+    do {
+        seq = __atomic_load_n(&(cache->seq), __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+
+        i = SR_READ_ONCE(cache->buckets[sr_arpcache_hash(cache, ip)]);
+        for (steps = 0; i < cache->capacity && steps < cache->capacity; steps++) {
+            if (SR_READ_ONCE(cache->entries[i].ip) == ip)
+                break;
+            i = SR_READ_ONCE(cache->entries[i].hash_next);
+        }
+        if (steps == cache->capacity)
+            i = SR_ARPCACHE_NONE;
+
+        if (i < cache->capacity) {
+            for (k = 0; k < ETHER_ADDR_LEN; k++)
+                copy[k] = SR_READ_ONCE(cache->entries[i].mac[k]);
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || SR_READ_ONCE(cache->seq) != seq);
+
+    if (i >= cache->capacity)
+        return 0;
+
+    SR_WRITE_ONCE(cache->entries[i].referenced, 1);
+    memcpy(mac, copy, ETHER_ADDR_LEN);
+    return 1;
+}
+
+uint32_t sr_arpcache_generation(struct sr_arpcache *cache) {
+    return __atomic_load_n(&(cache->seq), __ATOMIC_ACQUIRE);
+}
+
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
    that corresponds to this ARP request. You should free the passed *packet.
@@ -92,7 +315,7 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                                        uint32_t ip,
                                        uint8_t *packet,           /* borrowed */
                                        unsigned int packet_len,
-                                       char *iface)
+                                       unsigned int ifindex)
 {
     pthread_mutex_lock(&(cache->lock));
 
@@ -111,17 +334,20 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
         cache->requests = req;
     }
 
-    /* Add the packet to the list of packets for this request */
-    if (packet && packet_len && iface) {
-        struct sr_packet *new_pkt = (struct sr_packet *)malloc(sizeof(struct sr_packet));
-
-        new_pkt->buf = (uint8_t *)malloc(packet_len);
-        memcpy(new_pkt->buf, packet, packet_len);
-        new_pkt->len = packet_len;
-		new_pkt->iface = (char *)malloc(sr_IFACE_NAMELEN);
-        strncpy(new_pkt->iface, iface, sr_IFACE_NAMELEN);
-        new_pkt->next = req->packets;
-        req->packets = new_pkt;
+    /* Add the packet to the list of packets for this request. The node
+       and the frame copy share a single pool buffer. */
+    if (packet && packet_len) {
+        struct sr_packet *new_pkt = (struct sr_packet *)sr_pktbuf_alloc(
+                sizeof(struct sr_packet) + packet_len);
+
+        if (new_pkt) {
+            new_pkt->buf = (uint8_t *)(new_pkt + 1);
+            memcpy(new_pkt->buf, packet, packet_len);
+            new_pkt->len = packet_len;
+            new_pkt->ifindex = ifindex;
+            new_pkt->next = req->packets;
+            req->packets = new_pkt;
+        }
     }
 
     pthread_mutex_unlock(&(cache->lock));
@@ -139,73 +365,82 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
 {
     pthread_mutex_lock(&(cache->lock));
 
-    struct sr_arpreq *req, *prev = NULL, *next = NULL;
+    struct sr_arpreq *req;
     for (req = cache->requests; req != NULL; req = req->next) {
         if (req->ip == ip) {
-            if (prev) {
-                next = req->next;
-                prev->next = next;
-            }
-            else {
-                next = req->next;
-                cache->requests = next;
-            }
-
+            sr_arpreq_unlink(cache, req);
             break;
         }
-        prev = req;
     }
 
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        if (!(cache->entries[i].valid))
-            break;
-    }
+    /* Refresh an existing mapping in place, otherwise take a free slot,
+       evicting the least recently used entry if the table is full. */
+    uint32_t i = sr_arpcache_find(cache, ip);
+    int k;
+
+    sr_arpcache_write_begin(cache);
 
-    if (i != SR_ARPCACHE_SZ) {
-        memcpy(cache->entries[i].mac, mac, 6);
-        cache->entries[i].ip = ip;
-        cache->entries[i].added = time(NULL);
-        cache->entries[i].valid = 1;
+    if (i == SR_ARPCACHE_NONE) {
+        if (cache->free_head == SR_ARPCACHE_NONE)
+            sr_arpcache_remove(cache, sr_arpcache_victim(cache));
+
+        i = cache->free_head;
+        cache->free_head = cache->entries[i].lru_next;
+
+        uint32_t bucket = sr_arpcache_hash(cache, ip);
+        SR_WRITE_ONCE(cache->entries[i].ip, ip);
+        SR_WRITE_ONCE(cache->entries[i].hash_next, cache->buckets[bucket]);
+        SR_WRITE_ONCE(cache->buckets[bucket], i);
+        cache->count++;
+    }
+    else {
+        sr_arpcache_lru_unlink(cache, i);
     }
 
+    for (k = 0; k < ETHER_ADDR_LEN; k++)
+        SR_WRITE_ONCE(cache->entries[i].mac[k], mac[k]);
+    cache->entries[i].added = time(NULL);
+    cache->entries[i].valid = 1;
+    sr_timer_add(&(cache->entry_timers), &(cache->entries[i].timer),
+                 sr_timer_now() + SR_TIMER_MS((uint64_t)(SR_ARPCACHE_TO * 1000)));
+    SR_WRITE_ONCE(cache->entries[i].referenced, 0);
+    sr_arpcache_lru_push(cache, i);
+
+    sr_arpcache_write_end(cache);
+
     pthread_mutex_unlock(&(cache->lock));
 
     return req;
 }
 
+/* Removes entry from the request queue if it is on it. Returns 1 if it was.
+   Caller must hold the cache lock. */
+static int sr_arpreq_unlink(struct sr_arpcache *cache, struct sr_arpreq *entry) {
+    struct sr_arpreq **link;
+
+    for (link = &(cache->requests); *link; link = &((*link)->next)) {
+        if (*link == entry) {
+            *link = entry->next;
+            sr_timer_del(&(entry->timer));
+            return 1;
+        }
+    }
+    return 0;
+}
+
 /* Frees all memory associated with this arp request entry. If this arp request
    entry is on the arp request queue, it is removed from the queue. */
 void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
     pthread_mutex_lock(&(cache->lock));
 
     if (entry) {
-        struct sr_arpreq *req, *prev = NULL, *next = NULL;
-        for (req = cache->requests; req != NULL; req = req->next) {
-            if (req == entry) {
-                if (prev) {
-                    next = req->next;
-                    prev->next = next;
-                }
-                else {
-                    next = req->next;
-                    cache->requests = next;
-                }
-
-                break;
-            }
-            prev = req;
-        }
+        sr_arpreq_unlink(cache, entry);
 
         struct sr_packet *pkt, *nxt;
 
         for (pkt = entry->packets; pkt; pkt = nxt) {
             nxt = pkt->next;
-            if (pkt->buf)
-                free(pkt->buf);
-            if (pkt->iface)
-                free(pkt->iface);
-            free(pkt);
+            sr_pktbuf_free(pkt);
         }
 
         free(entry);
@@ -219,25 +454,59 @@ void sr_arpcache_dump(struct sr_arpcache *cache) {
     fprintf(stderr, "\nMAC            IP         ADDED                      VALID\n");
     fprintf(stderr, "-----------------------------------------------------------\n");
 
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+    uint32_t i;
+    for (i = cache->lru_head; i != SR_ARPCACHE_NONE; i = cache->entries[i].lru_next) {
         struct sr_arpentry *cur = &(cache->entries[i]);
         unsigned char *mac = cur->mac;
         fprintf(stderr, "%.1x%.1x%.1x%.1x%.1x%.1x   %.8x   %.24s   %d\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], ntohl(cur->ip), ctime(&(cur->added)), cur->valid);
     }
 
-    fprintf(stderr, "\n");
+    fprintf(stderr, "%lu lookups, %lu heap copies\n\n", cache->lookups, cache->lookup_allocs);
 }
 
 /* Initialize table + table lock. Returns 0 on success. */
-int sr_arpcache_init(struct sr_arpcache *cache) {
-    /* Seed RNG to kick out a random entry if all entries full. */
-    srand(time(NULL));
+int sr_arpcache_init(struct sr_arpcache *cache, unsigned int capacity) {
+    uint32_t i, n_buckets = 1;
+
+    if (capacity == 0)
+        capacity = SR_ARPCACHE_SZ;
+    if (capacity > SR_ARPCACHE_MAX)
+        capacity = SR_ARPCACHE_MAX;
+
+    /* One bucket per entry keeps the chains short */
+    while (n_buckets < capacity)
+        n_buckets <<= 1;
+
+    cache->entries = (struct sr_arpentry *) calloc(capacity, sizeof(struct sr_arpentry));
+    cache->buckets = (uint32_t *) malloc(n_buckets * sizeof(uint32_t));
+    if (!cache->entries || !cache->buckets) {
+        free(cache->entries);
+        free(cache->buckets);
+        cache->entries = NULL;
+        cache->buckets = NULL;
+        return -1;
+    }
+
+    cache->capacity = capacity;
+    cache->bucket_mask = n_buckets - 1;
+    cache->count = 0;
+    cache->seq = 0;
+    cache->lookups = 0;
+    cache->lookup_allocs = 0;
+    cache->lru_head = SR_ARPCACHE_NONE;
+    cache->lru_tail = SR_ARPCACHE_NONE;
 
     /* Invalidate all entries */
-    memset(cache->entries, 0, sizeof(cache->entries));
+    for (i = 0; i < n_buckets; i++)
+        cache->buckets[i] = SR_ARPCACHE_NONE;
+    for (i = 0; i < capacity; i++)
+        cache->entries[i].lru_next = (i + 1 < capacity) ? i + 1 : SR_ARPCACHE_NONE;
+    cache->free_head = 0;
     cache->requests = NULL;
 
+    sr_timer_wheel_init(&(cache->entry_timers), sr_timer_now());
+    sr_timer_wheel_init(&(cache->req_timers), sr_timer_now());
+
     /* Acquire mutex lock */
     pthread_mutexattr_init(&(cache->attr));
     pthread_mutexattr_settype(&(cache->attr), PTHREAD_MUTEX_RECURSIVE);
@@ -248,32 +517,39 @@ int sr_arpcache_init(struct sr_arpcache *cache) {
 
 /* Destroys table + table lock. Returns 0 on success. */
 int sr_arpcache_destroy(struct sr_arpcache *cache) {
+    free(cache->entries);
+    free(cache->buckets);
     return pthread_mutex_destroy(&(cache->lock)) && pthread_mutexattr_destroy(&(cache->attr));
 }
 
-/* Thread which sweeps through the cache and invalidates entries that were added
-   more than SR_ARPCACHE_TO seconds ago. */
+/* Thread which times out cache entries SR_ARPCACHE_TO seconds after they were
+   added and drives ARP request retransmission, once per timer tick. */
 void *sr_arpcache_timeout(void *sr_ptr) {
     struct sr_instance *sr = sr_ptr;
     struct sr_arpcache *cache = &(sr->cache);
 
     while (1) {
-        sleep(1.0);
+        usleep(SR_TIMER_TICK_MS * 1000);
 
-        pthread_mutex_lock(&(cache->lock));
+        uint64_t now = sr_timer_now();
 
-        time_t curtime = time(NULL);
+        pthread_mutex_lock(&(cache->lock));
 
-        int i;
-        for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-            if ((cache->entries[i].valid) && (difftime(curtime,cache->entries[i].added) > SR_ARPCACHE_TO)) {
-                cache->entries[i].valid = 0;
-            }
+        /* Each removal is its own write section so lookups only ever wait
+           for a single unlink, not the whole sweep. */
+        struct sr_timer *timer = sr_timer_advance(&(cache->entry_timers), now);
+        while (timer) {
+            struct sr_timer *next = timer->next;
+            struct sr_arpentry *entry = sr_timer_entry(timer, struct sr_arpentry, timer);
+            sr_arpcache_write_begin(cache);
+            sr_arpcache_remove(cache, entry - cache->entries);
+            sr_arpcache_write_end(cache);
+            timer = next;
         }
 
-        sr_arpcache_sweepreqs(sr);
-
         pthread_mutex_unlock(&(cache->lock));
+
+        sr_arpcache_sweepreqs(sr, now);
     }
 
     return NULL;
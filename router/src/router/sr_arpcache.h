@@ -9,11 +9,8 @@
    --
 
    # When sending packet to next_hop_ip
-   entry = arpcache_lookup(next_hop_ip)
-
-   if entry:
-       use next_hop_ip->mac mapping in entry to send the packet
-       free entry
+   if arpcache_lookup_mac(next_hop_ip, mac):
+       use next_hop_ip->mac mapping to send the packet
    else:
        req = arpcache_queuereq(next_hop_ip, packet, len)
        handle_arpreq(req)
@@ -51,16 +48,17 @@
    To meet the guidelines in the assignment (ARP requests are sent every second
    until we send 5 ARP requests, then we send ICMP host unreachable back to
    all packets waiting on this ARP request), you must fill out the following
-   function that is called every second and is defined in sr_arpcache.c:
+   function that is called every SR_TIMER_TICK_MS and is defined in
+   sr_arpcache.c:
 
-   void sr_arpcache_sweepreqs(struct sr_instance *sr) {
-       for each request on sr->cache.requests:
+   void sr_arpcache_sweepreqs(struct sr_instance *sr, uint64_t now) {
+       for each request whose retransmit timer fired by now:
            handle_arpreq(request)
    }
 
-   Since handle_arpreq as defined in the comments above could destroy your
-   current request, make sure to save the next pointer before calling
-   handle_arpreq when traversing through the ARP requests linked list.
+   Entry expiry and request retransmits are both driven by timer wheels
+   (sr_timer.h), so a sweep only touches the entries and requests that are
+   actually due.
  */
 
 #ifndef SR_ARPCACHE_H
@@ -70,14 +68,19 @@
 #include <time.h>
 #include <pthread.h>
 #include "sr_if.h"
+#include "sr_timer.h"
 
-#define SR_ARPCACHE_SZ    100
+#define SR_ARPCACHE_SZ    100   /* default capacity, see sr_arpcache_init */
+#define SR_ARPCACHE_MAX   (1u << 24)    /* largest capacity */
 #define SR_ARPCACHE_TO    15.0
+#define SR_ARPCACHE_NONE  0xffffffffu   /* end of an index-linked list */
 
+/* A queued packet and its frame share one buffer from the packet pool
+   (sr_pktbuf.h): buf points just past this header. */
 struct sr_packet {
     uint8_t *buf;               /* A raw Ethernet frame, presumably with the dest MAC empty */
     unsigned int len;           /* Length of raw Ethernet frame */
-    char *iface;                /* The outgoing interface */
+    unsigned int ifindex;       /* The outgoing interface, see sr_get_interface_by_index */
     struct sr_packet *next;
 };
 
@@ -86,6 +89,11 @@ struct sr_arpentry {
     uint32_t ip;                /* IP addr in network byte order */
     time_t added;
     int valid;
+    int referenced;             /* Looked up since last aged, see below */
+    uint32_t hash_next;         /* Next slot in the same hash bucket */
+    uint32_t lru_prev;          /* Neighbours on the LRU list (head = most */
+    uint32_t lru_next;          /*   recently used), or the free list */
+    struct sr_timer timer;      /* Expiry, SR_ARPCACHE_TO after insertion */
 };
 
 struct sr_arpreq {
@@ -97,10 +105,33 @@ struct sr_arpreq {
                                    should update this. */
     struct sr_packet *packets;  /* List of pkts waiting on this req to finish */
     struct sr_arpreq *next;
+    struct sr_timer timer;      /* Next retransmit, armed once first sent */
 };
 
+/* Entries live in a fixed array of capacity slots. Valid entries are chained
+   off buckets[] by IP hash and kept on a doubly linked LRU list; when the
+   table is full, inserting a new mapping evicts the least recently used
+   one. All links are slot indices.
+
+   sr_arpcache_lookup_mac does not take the lock. Writers (which do) bump
+   seq before and after changing a hash chain or an entry's ip/mac, and a
+   reader that sees seq odd or changed retries. Since readers cannot move
+   entries on the LRU list, lookups only set the entry's referenced bit and
+   eviction gives referenced entries a second chance (CLOCK). */
 struct sr_arpcache {
-    struct sr_arpentry entries[SR_ARPCACHE_SZ];
+    struct sr_arpentry *entries;
+    uint32_t *buckets;
+    uint32_t capacity;
+    uint32_t bucket_mask;       /* number of buckets - 1 */
+    uint32_t count;             /* valid entries */
+    uint32_t lru_head;
+    uint32_t lru_tail;
+    uint32_t free_head;
+    uint32_t seq;               /* Odd while a writer is mid-update */
+    struct sr_timer_wheel entry_timers;
+    struct sr_timer_wheel req_timers;
+    unsigned long lookups;      /* Lookups served, hit or miss */
+    unsigned long lookup_allocs; /* Heap copies made by sr_arpcache_lookup */
     struct sr_arpreq *requests;
     pthread_mutex_t lock;
     pthread_mutexattr_t attr;
@@ -110,6 +141,16 @@ struct sr_arpcache {
    You must free the returned structure if it is not NULL. */
 struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip);
 
+/* Allocation-free variant of sr_arpcache_lookup for the forwarding path.
+   Copies the MAC for ip into the caller's buffer and returns 1, or returns
+   0 if there is no mapping. */
+int sr_arpcache_lookup_mac(struct sr_arpcache *cache, uint32_t ip,
+                           unsigned char mac[ETHER_ADDR_LEN]);
+
+/* Changes whenever any mapping is added, changed or removed (and is odd
+   while that happens). Lets callers cache lookup results. */
+uint32_t sr_arpcache_generation(struct sr_arpcache *cache);
+
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
    that corresponds to this ARP request. The packet argument should not be
@@ -121,7 +162,7 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                          uint32_t ip,
                          uint8_t *packet,               /* borrowed */
                          unsigned int packet_len,
-                         char *iface);
+                         unsigned int ifindex);
 
 /* This method performs two functions:
    1) Looks up this IP in the request queue. If it is found, returns a pointer
@@ -141,9 +182,10 @@ void sr_arpcache_dump(struct sr_arpcache *cache);
 /* You shouldn't have to call these methods--they're already called in the
    starter code for you. The init call is a constructor, the destroy call is
    a destructor, and a cleanup thread times out cache entries every 15
-   seconds. */
+   seconds. A capacity of 0 selects SR_ARPCACHE_SZ entries, larger than
+   SR_ARPCACHE_MAX gets SR_ARPCACHE_MAX. Returns 0 on success. */
 
-int   sr_arpcache_init(struct sr_arpcache *cache);
+int   sr_arpcache_init(struct sr_arpcache *cache, unsigned int capacity);
 int   sr_arpcache_destroy(struct sr_arpcache *cache);
 void *sr_arpcache_timeout(void *cache_ptr);
 void handle_arpreq(struct sr_instance *, struct sr_arpreq *);
@@ -163,6 +205,7 @@ since sr_router already imports sr_arpcache.h! - KM */
 
 /* sr_if.h */
 struct sr_if *sr_get_interface(struct sr_instance *, const char *);
+struct sr_if *sr_get_interface_by_index(struct sr_instance *, unsigned int);
 struct sr_if *get_interface_from_ip(struct sr_instance *, uint32_t);
 struct sr_if *get_interface_from_eth(struct sr_instance *, uint8_t *);
 
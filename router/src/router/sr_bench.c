@@ -0,0 +1,830 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_bench.c
+ *
+ * Description:
+ *
+ * Offline benchmark of the router core. Replays a capture (as written by
+ * sr -l, or any Ethernet pcap) through sr_handlepacket in a tight loop,
+ * with no server, and reports packets/sec, ns/packet and allocations per
+ * packet. sr_send_packet is replaced by a sink that counts frames.
+ *
+ *   sr_bench [-r rtable] [-c IP_CONFIG] [-a arp entries] [-t seconds]
+ *            [-E ICMP limits] capture.pcap
+ *   sr_bench -k [-t seconds]
+ *   sr_bench -L [-t seconds]
+ *
+ * Interfaces come from IP_CONFIG: a "sw0-eth1 192.168.2.1" line makes
+ * interface eth1, any other line names a host. A third column may give
+ * the MAC address; otherwise addresses are learned from the ARP frames
+ * in the capture, and made up if they are not there.
+ *
+ * The ARP cache is seeded with every host and every gateway of the
+ * routing table, and the ARP timeout thread is not started, so the
+ * steady state forwarding path is what gets measured. Frames the router
+ * sent (source MAC of one of its interfaces) are left out. The rest are
+ * replayed on the interface their destination MAC, ARP target or, failing
+ * those, the reverse route to their source points to.
+ *
+ * Each frame is copied to a scratch buffer before it is handled, since
+ * the router edits frames in place; the time taken by the copy alone is
+ * reported alongside. The router's counters (sr_stats.h) are printed at
+ * the end, showing what the capture exercised.
+ *
+ * With -k it instead times each checksum kernel (sr_utils.c), and cksum()
+ * as the router calls it, over payload sizes from a header to the largest
+ * IP packet, splitting -t seconds among them.
+ *
+ * With -L it instead times sr_fib_lookup against the list walk it
+ * replaced (sr_fib_lookup_list) on generated tables of 10, 10k and 1M
+ * routes, looking up addresses inside random routes.
+ *
+ * ICMP errors are rate limited as in sr (sr_icmplimit.h), so a capture
+ * that draws many of them measures the suppressed path; -E 0,source=0
+ * lifts the limits.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_fib.h"
+#include "sr_arpcache.h"
+#include "sr_pktbuf.h"
+#include "sr_protocol.h"
+#include "sr_dumper.h"
+#include "sr_utils.h"
+#include "sr_stats.h"
+#include "sr_icmplimit.h"
+
+#define SR_BENCH_SECONDS    2.0
+#define SR_BENCH_MAX_HOSTS  256
+#define SR_BENCH_FRAME_MAX  65536
+#define SR_BENCH_PCAP_NSEC  0xa1b23c4d  /* nanosecond timestamps */
+#define SR_BENCH_LPM_ADDRS  4096        /* addresses looked up, in turn */
+
+struct sr_bench_frame
+{
+    uint8_t* data;
+    unsigned int len;
+    char* iface;
+};
+
+struct sr_bench_host
+{
+    uint32_t ip;                        /* nbo */
+    unsigned char mac[ETHER_ADDR_LEN];
+    int have_mac;
+};
+
+static unsigned long sr_bench_sent = 0;
+static unsigned long sr_bench_sent_bytes = 0;
+static unsigned long sr_bench_mallocs = 0;
+
+/*---------------------------------------------------------------------
+ * Allocation counting. glibc lets the program interpose on malloc and
+ * reach the real one through its __libc_ names.
+ *
+ *---------------------------------------------------------------------*/
+
+#ifdef __GLIBC__
+extern void* __libc_malloc(size_t);
+extern void* __libc_calloc(size_t, size_t);
+extern void* __libc_realloc(void*, size_t);
+
+void* malloc(size_t size)
+{
+    __atomic_add_fetch(&sr_bench_mallocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+    __atomic_add_fetch(&sr_bench_mallocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size)
+{
+    __atomic_add_fetch(&sr_bench_mallocs, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(p, size);
+}
+#endif /* __GLIBC__ */
+
+/*---------------------------------------------------------------------
+ * Method: sr_send_packet(..)
+ * Scope:  Global
+ *
+ * Stands in for the one in sr_vns_comm.c: counts and discards.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_send_packet(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                   const char* iface)
+{
+    __atomic_add_fetch(&sr_bench_sent, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&sr_bench_sent_bytes, len, __ATOMIC_RELAXED);
+    return 0;
+} /* -- sr_send_packet -- */
+
+static double sr_bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_parse_mac(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_parse_mac(const char* s, unsigned char* mac)
+{
+    unsigned int b[ETHER_ADDR_LEN];
+    int i;
+
+    if (sscanf(s, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2],
+               &b[3], &b[4], &b[5]) != ETHER_ADDR_LEN)
+    { return -1; }
+    for (i = 0; i < ETHER_ADDR_LEN; i++)
+    { mac[i] = b[i]; }
+    return 0;
+} /* -- sr_bench_parse_mac -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_read_config(..)
+ * Scope:  Local
+ *
+ * Add the router interfaces listed in an IP_CONFIG file and collect
+ * the hosts. Interface MACs not given are left zero.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_read_config(struct sr_instance* sr, const char* filename,
+                                struct sr_bench_host* hosts,
+                                unsigned int* nhosts)
+{
+    FILE* fp;
+    char line[256], name[64], ip[64], mac[64];
+    unsigned char addr[ETHER_ADDR_LEN];
+    struct in_addr in;
+    const char* dash;
+    int n;
+
+    if ((fp = fopen(filename, "r")) == 0)
+    {
+        perror(filename);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        if ((n = sscanf(line, "%63s %63s %63s", name, ip, mac)) < 2)
+        { continue; }
+        if (inet_aton(ip, &in) == 0)
+        {
+            fprintf(stderr, "Error: bad address %s in %s\n", ip, filename);
+            fclose(fp);
+            return -1;
+        }
+        memset(addr, 0, sizeof(addr));
+        if (n == 3 && sr_bench_parse_mac(mac, addr) != 0)
+        {
+            fprintf(stderr, "Error: bad MAC %s in %s\n", mac, filename);
+            fclose(fp);
+            return -1;
+        }
+
+        if ((dash = strchr(name, '-')) != 0)
+        {
+            sr_add_interface(sr, dash + 1);
+            sr_set_ether_addr(sr, addr);
+            sr_set_ether_ip(sr, in.s_addr);
+        }
+        else if (*nhosts < SR_BENCH_MAX_HOSTS)
+        {
+            hosts[*nhosts].ip = in.s_addr;
+            memcpy(hosts[*nhosts].mac, addr, ETHER_ADDR_LEN);
+            hosts[*nhosts].have_mac = (n == 3);
+            (*nhosts)++;
+        }
+    }
+
+    fclose(fp);
+    return 0;
+} /* -- sr_bench_read_config -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_read_pcap(..)
+ * Scope:  Local
+ *
+ * Read every complete frame of a capture into memory. Returns the
+ * number of frames, or -1.
+ *
+ *---------------------------------------------------------------------*/
+
+static long sr_bench_read_pcap(const char* filename,
+                               struct sr_bench_frame** framesp,
+                               unsigned long* truncated)
+{
+    struct pcap_file_header fh;
+    struct pcap_sf_pkthdr ph;
+    struct sr_bench_frame* frames = 0;
+    long n = 0, cap = 0;
+    int swap;
+    FILE* fp;
+
+    if ((fp = fopen(filename, "r")) == 0)
+    {
+        perror(filename);
+        return -1;
+    }
+
+    if (fread(&fh, sizeof(fh), 1, fp) != 1)
+    { goto bad; }
+    if (fh.magic == TCPDUMP_MAGIC || fh.magic == SR_BENCH_PCAP_NSEC)
+    { swap = 0; }
+    else if (fh.magic == ntohl(TCPDUMP_MAGIC) ||
+             fh.magic == ntohl(SR_BENCH_PCAP_NSEC))
+    { swap = 1; }
+    else
+    { goto bad; }
+    if ((swap ? ntohl(fh.linktype) : fh.linktype) != LINKTYPE_ETHERNET)
+    {
+        fprintf(stderr, "Error: %s is not an Ethernet capture\n", filename);
+        fclose(fp);
+        return -1;
+    }
+
+    while (fread(&ph, sizeof(ph), 1, fp) == 1)
+    {
+        if (swap)
+        {
+            ph.caplen = ntohl(ph.caplen);
+            ph.len = ntohl(ph.len);
+        }
+        if (ph.caplen > SR_BENCH_FRAME_MAX)
+        { goto bad; }
+
+        if (n == cap)
+        {
+            struct sr_bench_frame* grown;
+
+            cap = cap ? cap * 2 : 1024;
+            grown = realloc(frames, cap * sizeof(struct sr_bench_frame));
+            if (!grown)
+            { goto bad; }
+            frames = grown;
+        }
+
+        frames[n].len = ph.caplen;
+        frames[n].iface = 0;
+        if (!(frames[n].data = malloc(ph.caplen ? ph.caplen : 1)) ||
+            fread(frames[n].data, 1, ph.caplen, fp) != ph.caplen)
+        { goto bad; }
+
+        /* -- cut short by the snaplen, the router would read past it -- */
+        if (ph.caplen < ph.len)
+        {
+            free(frames[n].data);
+            (*truncated)++;
+            continue;
+        }
+        n++;
+    }
+
+    fclose(fp);
+    *framesp = frames;
+    return n;
+
+bad:
+    fprintf(stderr, "Error: %s is not a valid capture\n", filename);
+    fclose(fp);
+    return -1;
+} /* -- sr_bench_read_pcap -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_learn(..)
+ * Scope:  Local
+ *
+ * Take interface and host MACs from the ARP frames of the capture.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_bench_learn(struct sr_instance* sr,
+                           struct sr_bench_frame* frames, long nframes,
+                           struct sr_bench_host* hosts, unsigned int nhosts)
+{
+    static const unsigned char zero[ETHER_ADDR_LEN];
+    struct sr_arp_hdr* arp;
+    struct sr_if* iface;
+    unsigned int i;
+    long f;
+
+    for (f = 0; f < nframes; f++)
+    {
+        if (frames[f].len < sizeof(struct sr_ethernet_hdr) +
+                sizeof(struct sr_arp_hdr) ||
+            ethertype(frames[f].data) != ethertype_arp)
+        { continue; }
+        arp = (struct sr_arp_hdr*)(frames[f].data +
+                sizeof(struct sr_ethernet_hdr));
+
+        if ((iface = get_interface_from_ip(sr, arp->ar_sip)) != 0)
+        {
+            if (memcmp(iface->addr, zero, ETHER_ADDR_LEN) == 0)
+            { memcpy(iface->addr, arp->ar_sha, ETHER_ADDR_LEN); }
+            continue;
+        }
+        for (i = 0; i < nhosts; i++)
+        {
+            if (hosts[i].ip == arp->ar_sip && !hosts[i].have_mac)
+            {
+                memcpy(hosts[i].mac, arp->ar_sha, ETHER_ADDR_LEN);
+                hosts[i].have_mac = 1;
+            }
+        }
+    }
+
+    /* -- made up, locally administered -- */
+    for (iface = sr->if_list; iface; iface = iface->next)
+    {
+        if (memcmp(iface->addr, zero, ETHER_ADDR_LEN) == 0)
+        {
+            iface->addr[0] = 0x02;
+            iface->addr[5] = iface->index + 1;
+            fprintf(stderr, "Warning: no MAC for %s, using a made up one\n",
+                    iface->name);
+        }
+    }
+} /* -- sr_bench_learn -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_seed_arp(..)
+ * Scope:  Local
+ *
+ * Enter every host and every gateway into the ARP cache. Returns the
+ * number of entries whose MAC had to be made up.
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned int sr_bench_seed_arp(struct sr_instance* sr,
+                                      struct sr_bench_host* hosts,
+                                      unsigned int nhosts)
+{
+    unsigned char mac[ETHER_ADDR_LEN];
+    struct sr_rt* rt;
+    unsigned int i, made_up = 0;
+    uint32_t gw;
+
+    for (i = 0; i < nhosts; i++)
+    {
+        if (hosts[i].have_mac)
+        { sr_arpcache_insert(&(sr->cache), hosts[i].mac, hosts[i].ip); }
+    }
+
+    for (rt = sr->routing_table; rt; rt = rt->next)
+    {
+        if (sr_arpcache_lookup_mac(&(sr->cache), rt->gw.s_addr, mac))
+        { continue; }
+        gw = ntohl(rt->gw.s_addr);
+        mac[0] = 0x02;
+        mac[1] = 0x01;
+        mac[2] = gw >> 24;
+        mac[3] = gw >> 16;
+        mac[4] = gw >> 8;
+        mac[5] = gw;
+        sr_arpcache_insert(&(sr->cache), mac, rt->gw.s_addr);
+        made_up++;
+    }
+
+    return made_up;
+} /* -- sr_bench_seed_arp -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_ingress(..)
+ * Scope:  Local
+ *
+ * The interface a frame would have arrived on, or NULL for frames the
+ * router sent and frames that cannot be placed.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_if* sr_bench_ingress(struct sr_instance* sr,
+                                      struct sr_bench_frame* f)
+{
+    struct sr_ethernet_hdr* eth = (struct sr_ethernet_hdr*)f->data;
+    struct sr_arp_hdr* arp;
+    struct sr_ip_hdr* ip;
+    struct sr_if* iface;
+    struct sr_rt* rt;
+
+    if (f->len < sizeof(struct sr_ethernet_hdr) ||
+        get_interface_from_eth(sr, eth->ether_shost))
+    { return 0; }
+
+    if ((iface = get_interface_from_eth(sr, eth->ether_dhost)) != 0)
+    { return iface; }
+
+    if (ethertype(f->data) == ethertype_arp &&
+        f->len >= sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr))
+    {
+        arp = (struct sr_arp_hdr*)(f->data + sizeof(struct sr_ethernet_hdr));
+        return get_interface_from_ip(sr, arp->ar_tip);
+    }
+
+    if (ethertype(f->data) == ethertype_ip &&
+        f->len >= sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr))
+    {
+        ip = (struct sr_ip_hdr*)(f->data + sizeof(struct sr_ethernet_hdr));
+        if ((rt = sr_get_longest_prefix_match(sr, ip->ip_src)) != 0)
+        { return sr_get_interface_by_index(sr, rt->ifindex); }
+    }
+
+    return 0;
+} /* -- sr_bench_ingress -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_run(..)
+ * Scope:  Local
+ *
+ * Replay the frames for at least seconds, handling them or, with
+ * handle unset, only copying them. Returns the frames replayed and sets
+ * *elapsed.
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned long sr_bench_run(struct sr_instance* sr,
+                                  struct sr_bench_frame* frames, long nframes,
+                                  uint8_t* scratch, double seconds,
+                                  int handle, double* elapsed)
+{
+    unsigned long done = 0;
+    double start = sr_bench_now();
+    long i;
+
+    do
+    {
+        for (i = 0; i < nframes; i++)
+        {
+            memcpy(scratch, frames[i].data, frames[i].len);
+            if (handle)
+            { sr_handlepacket(sr, scratch, frames[i].len, frames[i].iface); }
+            else
+            { __asm__ __volatile__ ("" : : "r" (scratch) : "memory"); }
+        }
+        done += nframes;
+        *elapsed = sr_bench_now() - start;
+    } while (*elapsed < seconds);
+
+    return done;
+} /* -- sr_bench_run -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_cksum(..)
+ * Scope:  Local
+ *
+ * Time every checksum kernel the CPU has at each payload size, and
+ * cksum(), which picks a kernel by size.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_cksum(double seconds)
+{
+    static const int sizes[] =
+    { 20, 64, 128, 256, 576, 1024, 1500, 4096, 9000, 65535 };
+    const int nsizes = sizeof(sizes) / sizeof(sizes[0]);
+    uint16_t (*fn[8])(const void*, int);
+    const char* name[8];
+    volatile uint16_t sink = 0;
+    unsigned int k, nk, ncells = 0;
+    unsigned long calls, j;
+    double start, elapsed;
+    uint8_t* buf;
+    int i;
+
+    for (nk = 0; nk < 8 && (name[nk] = cksum_kernel(nk, &fn[nk])); nk++)
+    {
+        if (fn[nk])
+        { ncells += nsizes; }
+    }
+    ncells += nsizes;
+
+    if ((buf = (uint8_t*)malloc(sizes[nsizes - 1])) == 0)
+    { return 1; }
+    for (i = 0; i < sizes[nsizes - 1]; i++)
+    { buf[i] = (uint8_t)(i * 131 + 7); }
+
+    printf("%-8s", "size");
+    for (k = 0; k <= nk; k++)
+    {
+        if (k == nk || fn[k])
+        { printf(" %21s", k < nk ? name[k] : "cksum"); }
+    }
+    printf("\n");
+
+    for (i = 0; i < nsizes; i++)
+    {
+        printf("%-8d", sizes[i]);
+        for (k = 0; k <= nk; k++)
+        {
+            if (k < nk && !fn[k])
+            { continue; }
+            calls = 0;
+            start = sr_bench_now();
+            do
+            {
+                for (j = 0; j < 64; j++)
+                {
+                    sink += k < nk ? fn[k](buf, sizes[i])
+                                   : cksum(buf, sizes[i]);
+                }
+                calls += 64;
+                elapsed = sr_bench_now() - start;
+            } while (elapsed < seconds / ncells);
+            printf(" %7.1f ns %5.2f GB/s", elapsed / calls * 1e9,
+                   sizes[i] * (double)calls / elapsed / 1e9);
+        }
+        printf("\n");
+    }
+
+    free(buf);
+    return 0;
+} /* -- sr_bench_cksum -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_lpm(..)
+ * Scope:  Local
+ *
+ * Prefix lengths are drawn roughly as in a full Internet table: most
+ * /24, then /16-/23, a few shorter and a few longer.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_lpm(double seconds)
+{
+    static const unsigned int sizes[] = { 10, 10000, 1000000 };
+    const int nsizes = sizeof(sizes) / sizeof(sizes[0]);
+    struct sr_rt* routes;
+    struct sr_rt* rt;
+    struct sr_fib* fib;
+    uint32_t addrs[SR_BENCH_LPM_ADDRS];
+    uint32_t seed = 1, mask, r;
+    unsigned long calls;
+    double start, elapsed, ns[2];
+    volatile uintptr_t sink = 0;
+    unsigned int i, j, len;
+    int s, walk;
+
+    routes = (struct sr_rt*)calloc(sizes[nsizes - 1], sizeof(struct sr_rt));
+    if (!routes)
+    { return 1; }
+
+    printf("%-8s %14s %14s\n", "routes", "fib", "list walk");
+    for (s = 0; s < nsizes; s++)
+    {
+        for (i = 0; i < sizes[s]; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            r = seed >> 8;
+            switch (r % 10)
+            {
+                case 0:
+                    len = 8 + (r >> 4) % 8;
+                    break;
+                case 1:
+                    len = 25 + (r >> 4) % 8;
+                    break;
+                case 2:
+                case 3:
+                    len = 16 + (r >> 4) % 8;
+                    break;
+                default:
+                    len = 24;
+            }
+            seed = seed * 1103515245 + 12345;
+            mask = 0xffffffffu << (32 - len);
+            rt = &routes[i];
+            rt->dest.s_addr = htonl((seed ^ (seed << 16)) & mask);
+            rt->mask.s_addr = htonl(mask);
+            rt->next = i + 1 < sizes[s] ? &routes[i + 1] : 0;
+        }
+        if ((fib = sr_fib_build(routes)) == 0)
+        {
+            free(routes);
+            return 1;
+        }
+        for (j = 0; j < SR_BENCH_LPM_ADDRS; j++)
+        {
+            seed = seed * 1103515245 + 12345;
+            rt = &routes[(seed >> 4) % sizes[s]];
+            addrs[j] = rt->dest.s_addr | (htonl(seed) & ~rt->mask.s_addr);
+        }
+
+        for (walk = 0; walk < 2; walk++)
+        {
+            calls = 0;
+            start = sr_bench_now();
+            do
+            {
+                for (j = 0; j < SR_BENCH_LPM_ADDRS && (walk == 0 || j < 16);
+                     j++)
+                {
+                    sink += (uintptr_t)(walk ? sr_fib_lookup_list(routes,
+                                                                  addrs[j])
+                                             : sr_fib_lookup(fib, addrs[j]));
+                    calls++;
+                }
+                elapsed = sr_bench_now() - start;
+            } while (elapsed < seconds / (2 * nsizes));
+            ns[walk] = elapsed / calls * 1e9;
+        }
+
+        printf("%-8u %11.1f ns %11.1f ns\n", sizes[s], ns[0], ns[1]);
+        sr_fib_destroy(fib);
+    }
+
+    free(routes);
+    return 0;
+} /* -- sr_bench_lpm -- */
+
+static void usage(char* argv0)
+{
+    printf("Format: %s [-r routing table] [-c IP_CONFIG] [-a arp cache entries]\n"
+           "           [-t seconds] [-E ICMP limits] capture.pcap\n"
+           "        %s -k [-t seconds]   (checksum kernels)\n"
+           "        %s -L [-t seconds]   (FIB lookups)\n", argv0, argv0, argv0);
+} /* -- usage -- */
+
+int main(int argc, char** argv)
+{
+    char* rtable = "rtable";
+    char* config = "IP_CONFIG";
+    unsigned long arpcache_size = 0;
+    double seconds = SR_BENCH_SECONDS;
+    char* icmp_limit = 0;
+    char err[128];
+    char* end;
+    struct sr_bench_host hosts[SR_BENCH_MAX_HOSTS];
+    unsigned int nhosts = 0, made_up;
+    struct sr_bench_frame* frames = 0;
+    unsigned long truncated = 0, skipped = 0, done, copied, mallocs;
+    struct sr_pktbuf_stats before, after;
+    struct sr_instance sr;
+    struct sr_if* iface;
+    uint8_t* scratch;
+    double elapsed, copy_elapsed;
+    long nframes, n, i;
+    int c, kernels = 0, lpm = 0;
+
+    while ((c = getopt(argc, argv, "hr:c:a:t:E:kL")) != EOF)
+    {
+        switch (c)
+        {
+            case 'r':
+                rtable = optarg;
+                break;
+            case 'c':
+                config = optarg;
+                break;
+            case 'a':
+                arpcache_size = strtoul(optarg, &end, 10);
+                if (*optarg == '-' || *end != 0 || arpcache_size == 0 ||
+                    arpcache_size > SR_ARPCACHE_MAX)
+                {
+                    fprintf(stderr, "Error: -a takes 1 to %u entries\n",
+                            SR_ARPCACHE_MAX);
+                    return 1;
+                }
+                break;
+            case 't':
+                seconds = atof(optarg);
+                break;
+            case 'E':
+                icmp_limit = optarg;
+                break;
+            case 'k':
+                kernels = 1;
+                break;
+            case 'L':
+                lpm = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if (kernels)
+    { return sr_bench_cksum(seconds); }
+    if (lpm)
+    { return sr_bench_lpm(seconds); }
+    if (optind != argc - 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    memset(&sr, 0, sizeof(sr));
+    sr.sockfd = -1;
+    pthread_mutex_init(&(sr.send_lock), NULL);
+    if ((sr.icmp_limit = sr_icmplimit_create(icmp_limit, err,
+                                             sizeof(err))) == 0)
+    {
+        fprintf(stderr, "Error in ICMP limits: %s\n", err);
+        return 1;
+    }
+
+    if (sr_bench_read_config(&sr, config, hosts, &nhosts) != 0)
+    { return 1; }
+    if (sr.if_count == 0)
+    {
+        fprintf(stderr, "Error: no router interfaces in %s\n", config);
+        return 1;
+    }
+    if (sr_load_rt(&sr, rtable) != 0)
+    {
+        fprintf(stderr, "Error setting up routing table from file %s\n",
+                rtable);
+        return 1;
+    }
+    if ((nframes = sr_bench_read_pcap(argv[optind], &frames, &truncated)) < 0)
+    { return 1; }
+
+    /* -- the ARP timeout thread stays off, seeded entries never expire -- */
+    if (sr_arpcache_init(&(sr.cache), arpcache_size) != 0)
+    {
+        fprintf(stderr, "Error: cannot allocate an ARP cache of %lu entries\n",
+                arpcache_size ? arpcache_size : SR_ARPCACHE_SZ);
+        return 1;
+    }
+    sr_bench_learn(&sr, frames, nframes, hosts, nhosts);
+    made_up = sr_bench_seed_arp(&sr, hosts, nhosts);
+
+    /* -- keep only the frames the router would have received -- */
+    for (i = 0, n = 0; i < nframes; i++)
+    {
+        if ((iface = sr_bench_ingress(&sr, &frames[i])) == 0)
+        {
+            free(frames[i].data);
+            skipped++;
+            continue;
+        }
+        frames[i].iface = iface->name;
+        frames[n++] = frames[i];
+    }
+    nframes = n;
+
+    printf("%s: %ld frames to replay, %lu sent by the router or unplaced, "
+           "%lu truncated\n", argv[optind], nframes, skipped, truncated);
+    printf("%u interfaces, %u routes, %u ARP entries made up\n",
+           sr.if_count, sr.fib->n_routes, made_up);
+    if (nframes == 0)
+    { return 1; }
+
+    scratch = (uint8_t*)malloc(SR_BENCH_FRAME_MAX);
+
+    /* -- one pass to warm caches and the packet pool -- */
+    sr_bench_run(&sr, frames, nframes, scratch, 0, 1, &elapsed);
+    sr_bench_sent = sr_bench_sent_bytes = 0;
+
+    sr_pktbuf_get_stats(&before);
+    mallocs = __atomic_load_n(&sr_bench_mallocs, __ATOMIC_RELAXED);
+    done = sr_bench_run(&sr, frames, nframes, scratch, seconds, 1, &elapsed);
+    mallocs = __atomic_load_n(&sr_bench_mallocs, __ATOMIC_RELAXED) - mallocs;
+    sr_pktbuf_get_stats(&after);
+
+    copied = sr_bench_run(&sr, frames, nframes, scratch, seconds / 4, 0,
+                          &copy_elapsed);
+
+    printf("%lu packets in %.3f s: %.3f Mpps, %.1f ns/packet "
+           "(of which %.1f ns copying the frame)\n",
+           done, elapsed, done / elapsed / 1e6, elapsed / done * 1e9,
+           copy_elapsed / copied * 1e9);
+    printf("sent %.3f frames/packet, %.1f bytes/packet\n",
+           (double)sr_bench_sent / done, (double)sr_bench_sent_bytes / done);
+#ifdef __GLIBC__
+    printf("allocations/packet: %.4f malloc, %.4f packet buffers\n",
+           (double)mallocs / done,
+           (double)(after.hits + after.misses - before.hits - before.misses)
+                / done);
+#else
+    printf("allocations/packet: %.4f packet buffers\n",
+           (double)(after.hits + after.misses - before.hits - before.misses)
+                / done);
+#endif
+
+    printf("counters, over all passes:\n");
+    sr_stats_print(&sr, stdout, SR_STATS_COUNTERS | SR_STATS_LATENCY);
+
+    return 0;
+} /* -- main -- */
@@ -0,0 +1,575 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_check.c
+ *
+ * Description:
+ *
+ * Self-checks of the router's building blocks that are easy to get
+ * subtly wrong and hard to see go wrong through a whole router. Each
+ * check prints one line; the exit status is the number that failed.
+ *
+ *   sr_check [-n iterations] [-s seed]
+ *
+ * "make check" builds and runs it.
+ *
+ * Inputs are random, from a fixed seed so that a failure can be
+ * reproduced; -s picks another.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_fib.h"
+#include "sr_timer.h"
+
+#define SR_CHECK_ITERATIONS  1000000
+#define SR_CHECK_SEED        1
+#define SR_CHECK_CKSUM_MAX   65535  /* longest buffer checksummed */
+#define SR_CHECK_ALIGN       32     /* start offsets tried, an AVX2 load */
+#define SR_CHECK_ALL_LENS    2048   /* lengths up to here all tried */
+#define SR_CHECK_FLOWS       65536  /* flows per ECMP mix */
+#define SR_CHECK_ECMP_MAX    8      /* paths per group, up to */
+#define SR_CHECK_ECMP_SKEW   0.05   /* share a path may be off by */
+#define SR_CHECK_LPM_TABLES  64     /* routing tables tried */
+#define SR_CHECK_LPM_ROUTES  1024   /* routes per table, up to */
+#define SR_CHECK_LPM_LOOKUPS 4096   /* addresses per table */
+#define SR_CHECK_TIMERS      4096   /* timers armed */
+#define SR_CHECK_TIMER_SPAN  (3 << 16)  /* ticks the wheel is turned */
+
+static uint64_t sr_check_state = SR_CHECK_SEED;
+
+/* xorshift64*, good enough for test inputs and the same everywhere */
+static uint32_t sr_check_random(void)
+{
+    sr_check_state ^= sr_check_state >> 12;
+    sr_check_state ^= sr_check_state << 25;
+    sr_check_state ^= sr_check_state >> 27;
+    return (uint32_t)((sr_check_state * 0x2545f4914f6cdd1dull) >> 32);
+}
+
+static void sr_check_fill(uint8_t* buf, unsigned int len)
+{
+    unsigned int i;
+
+    for (i = 0; i < len; i++)
+    { buf[i] = (uint8_t)sr_check_random(); }
+}
+
+static int sr_check_result(const char* name, unsigned long failed,
+                           unsigned long n)
+{
+    printf("%-40s %s (%lu/%lu failed)\n", name, failed ? "FAIL" : "ok",
+           failed, n);
+    return failed != 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_check_cksum_update(..)
+ * Scope:  Local
+ *
+ * cksum_update16/32 against recomputing with cksum(), as the forward
+ * path uses them: a TTL decrement, and an address rewrite. Headers are
+ * random, with some all-zero and all-ones ones among them, since those
+ * are where one's complement arithmetic has its two zeroes.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_check_cksum_update(unsigned long n)
+{
+    sr_ip_hdr_t hdr;
+    uint16_t old16, new16, sum;
+    uint32_t new32;
+    unsigned long i, failed = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        switch (i % 16)
+        {
+            case 0:
+                memset(&hdr, 0, sizeof(hdr));
+                break;
+            case 1:
+                memset(&hdr, 0xff, sizeof(hdr));
+                break;
+            default:
+                sr_check_fill((uint8_t*)&hdr, sizeof(hdr));
+        }
+        hdr.ip_sum = 0;
+        hdr.ip_sum = cksum(&hdr, sizeof(hdr));
+
+        /* -- TTL decrement, TTL shares a word with the protocol -- */
+        memcpy(&old16, &hdr.ip_ttl, 2);
+        hdr.ip_ttl--;
+        memcpy(&new16, &hdr.ip_ttl, 2);
+        hdr.ip_sum = cksum_update16(hdr.ip_sum, old16, new16);
+        sum = hdr.ip_sum;
+        hdr.ip_sum = 0;
+        if (cksum(&hdr, sizeof(hdr)) != sum)
+        { failed++; }
+        hdr.ip_sum = sum;
+
+        /* -- address rewrite -- */
+        new32 = (i % 16 == 1) ? 0 : sr_check_random();
+        hdr.ip_sum = cksum_update32(hdr.ip_sum, hdr.ip_dst, new32);
+        hdr.ip_dst = new32;
+        sum = hdr.ip_sum;
+        hdr.ip_sum = 0;
+        if (cksum(&hdr, sizeof(hdr)) != sum)
+        { failed++; }
+    }
+
+    return sr_check_result("cksum_update16/32 vs cksum", failed, 2 * n);
+} /* -- sr_check_cksum_update -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_check_cksum_kernels(..)
+ * Scope:  Local
+ *
+ * Every checksum kernel the CPU has, and cksum() itself, against the
+ * original byte-pair loop, over random bytes and over all-ones bytes
+ * (the most carries): every length up to SR_CHECK_ALL_LENS at every
+ * offset within a vector, and longer ones up to the largest at one
+ * offset each, in turn.
+ *
+ *---------------------------------------------------------------------*/
+
+/* Every length up to SR_CHECK_ALL_LENS, then strides up to and including
+   SR_CHECK_CKSUM_MAX. */
+static int sr_check_next_len(int len)
+{
+    if (len < SR_CHECK_ALL_LENS || len == SR_CHECK_CKSUM_MAX)
+    { return len + 1; }
+    return len + 61 < SR_CHECK_CKSUM_MAX ? len + 61 : SR_CHECK_CKSUM_MAX;
+}
+
+static int sr_check_cksum_kernels(void)
+{
+    uint16_t (*fn[8])(const void*, int);
+    uint16_t (*ref)(const void*, int);
+    const char* name[8];
+    uint8_t* buf;
+    unsigned int k, nk, pattern;
+    unsigned long n = 0, failed = 0;
+    uint16_t want;
+    int len, off;
+
+    for (nk = 0; nk < 8 && (name[nk] = cksum_kernel(nk, &fn[nk])); nk++)
+    { }
+    ref = fn[0];
+
+    buf = (uint8_t*)malloc(SR_CHECK_CKSUM_MAX + SR_CHECK_ALIGN);
+    if (!buf)
+    { return sr_check_result("cksum kernels vs byte pairs", 1, 1); }
+
+    for (pattern = 0; pattern < 2; pattern++)
+    {
+        if (pattern == 0)
+        { sr_check_fill(buf, SR_CHECK_CKSUM_MAX + SR_CHECK_ALIGN); }
+        else
+        { memset(buf, 0xff, SR_CHECK_CKSUM_MAX + SR_CHECK_ALIGN); }
+
+        for (len = 0; len <= SR_CHECK_CKSUM_MAX;
+             len = sr_check_next_len(len))
+        {
+            for (off = len <= SR_CHECK_ALL_LENS ? 0 : len % SR_CHECK_ALIGN;
+                 off < SR_CHECK_ALIGN;
+                 off += len <= SR_CHECK_ALL_LENS ? 1 : SR_CHECK_ALIGN)
+            {
+                want = ref(buf + off, len);
+                for (k = 1; k <= nk; k++)
+                {
+                    if (k < nk && !fn[k])
+                    { continue; }
+                    n++;
+                    if ((k < nk ? fn[k](buf + off, len)
+                                : cksum(buf + off, len)) != want)
+                    {
+                        if (failed++ < 5)
+                        {
+                            fprintf(stderr, "%s: length %d offset %d\n",
+                                    k < nk ? name[k] : "cksum", len, off);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    free(buf);
+
+    printf("(kernels:");
+    for (k = 0; k < nk; k++)
+    { printf(" %s%s", name[k], fn[k] ? "" : " (not on this CPU)"); }
+    printf(")\n");
+    return sr_check_result("cksum kernels vs byte pairs", failed, n);
+} /* -- sr_check_cksum_kernels -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_check_flow(..)
+ * Scope:  Local
+ *
+ * The i'th flow of a synthetic mix as the frame flow_hash sees:
+ *
+ *   0  random addresses, protocol and ports
+ *   1  a /24 of clients, a few ports each, to one server port
+ *   2  one pair of hosts, only the source port varying
+ *
+ * The last two are what hash badly if any field is left out or the
+ * mixing is weak.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_check_flow(uint8_t* frame, int mix, uint32_t i)
+{
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)frame;
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+    uint16_t* ports = (uint16_t*)(ip + 1);
+
+    memset(frame, 0, sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + 4);
+    eth->ether_type = htons(ethertype_ip);
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_ttl = 64;
+    switch (mix)
+    {
+        case 0:
+            ip->ip_p = (sr_check_random() & 1) ? 6 : 17;
+            ip->ip_src = sr_check_random();
+            ip->ip_dst = sr_check_random();
+            ports[0] = sr_check_random();
+            ports[1] = sr_check_random();
+            break;
+        case 1:
+            ip->ip_p = 6;
+            ip->ip_src = htonl(0x0a000100 | (i & 0xff));
+            ip->ip_dst = htonl(0xc0a80201);
+            ports[0] = htons(32768 + (i >> 8));
+            ports[1] = htons(443);
+            break;
+        default:
+            ip->ip_p = 17;
+            ip->ip_src = htonl(0x0a000101);
+            ip->ip_dst = htonl(0xc0a80201);
+            ports[0] = htons(i);
+            ports[1] = htons(53);
+    }
+} /* -- sr_check_flow -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_check_ecmp(..)
+ * Scope:  Local
+ *
+ * Flows of each mix spread over groups of 2 to SR_CHECK_ECMP_MAX equal
+ * cost paths, through flow_hash and sr_rt_ecmp_path as the forward path
+ * does. Every path must get its fair share to within SR_CHECK_ECMP_SKEW,
+ * and sr_rt_ecmp_path must take the path sr_rt_ecmp_index names.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_check_ecmp(void)
+{
+    struct sr_rt paths[SR_CHECK_ECMP_MAX];
+    struct sr_rt* path;
+    unsigned long count[SR_CHECK_ECMP_MAX];
+    unsigned long n = 0, failed = 0;
+    uint8_t frame[sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + 4];
+    double share, worst = 0;
+    uint32_t flow, i;
+    unsigned int npaths, k;
+    int mix;
+
+    for (mix = 0; mix < 3; mix++)
+    {
+        for (npaths = 2; npaths <= SR_CHECK_ECMP_MAX; npaths++)
+        {
+            /* -- a group as sr_fib_build links it, the last route
+                  standing for the group -- */
+            memset(paths, 0, sizeof(paths));
+            for (k = 0; k < npaths; k++)
+            { paths[k].ecmp = &paths[(k + 1) % npaths]; }
+            paths[npaths - 1].ecmp_n = npaths;
+
+            memset(count, 0, sizeof(count));
+            for (i = 0; i < SR_CHECK_FLOWS; i++)
+            {
+                sr_check_flow(frame, mix, i);
+                flow = flow_hash(frame, sizeof(frame));
+                path = sr_rt_ecmp_path(&paths[npaths - 1], flow);
+                if (path != &paths[sr_rt_ecmp_index(flow, npaths)])
+                { failed++; }
+                count[path - paths]++;
+            }
+
+            for (k = 0; k < npaths; k++)
+            {
+                n++;
+                share = (double)count[k] * npaths / SR_CHECK_FLOWS - 1;
+                if (share < 0)
+                { share = -share; }
+                if (share > worst)
+                { worst = share; }
+                if (share > SR_CHECK_ECMP_SKEW)
+                {
+                    fprintf(stderr, "mix %d, %u paths: path %u got %lu of "
+                            "%u flows\n", mix, npaths, k, count[k],
+                            SR_CHECK_FLOWS);
+                    failed++;
+                }
+            }
+        }
+    }
+
+    printf("(ECMP: worst path %.1f%% off its share)\n", worst * 100);
+    return sr_check_result("ECMP spread of flow_hash", failed, n);
+} /* -- sr_check_ecmp -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_check_lpm_len(..)
+ * Scope:  Local
+ *
+ * A prefix length for a generated route, mostly the ones around the
+ * levels of the FIB: /0, /16 and /24 where chunks begin, /32 and their
+ * neighbours.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_check_lpm_len(void)
+{
+    static const int edges[] = { 0, 1, 8, 15, 16, 17, 23, 24, 25, 31, 32 };
+    uint32_t r = sr_check_random();
+
+    if (r & 1)
+    { return (r >> 1) % 33; }
+    return edges[(r >> 1) % (sizeof(edges) / sizeof(edges[0]))];
+}
+
+static uint32_t sr_check_lpm_mask(int len)
+{
+    return len ? 0xffffffffu << (32 - len) : 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_check_lpm(..)
+ * Scope:  Local
+ *
+ * sr_fib_lookup against the list walk it replaced, over generated
+ * tables: routes of random length and prefix, some nested in an earlier
+ * one, and some repeating an earlier one's prefix and length (an ECMP
+ * group, where the last must win). Addresses are random, inside a
+ * route's prefix, or on its first or last address.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_check_lpm(void)
+{
+    struct sr_rt* routes;
+    struct sr_rt* rt;
+    struct sr_fib* fib;
+    unsigned long n = 0, failed = 0;
+    uint32_t prefix, mask, ip;
+    unsigned int t, i, nroutes, lookup;
+    int len;
+
+    routes = (struct sr_rt*)calloc(SR_CHECK_LPM_ROUTES, sizeof(struct sr_rt));
+    if (!routes)
+    { return sr_check_result("FIB vs list walk", 1, 1); }
+
+    for (t = 0; t < SR_CHECK_LPM_TABLES; t++)
+    {
+        nroutes = 1 + sr_check_random() % SR_CHECK_LPM_ROUTES;
+        for (i = 0; i < nroutes; i++)
+        {
+            rt = &routes[i];
+            memset(rt, 0, sizeof(*rt));
+            len = sr_check_lpm_len();
+            prefix = sr_check_random();
+            if (i > 0 && sr_check_random() % 8 == 0)
+            {
+                /* -- the same prefix and length again -- */
+                rt->dest = routes[i - 1].dest;
+                rt->mask = routes[i - 1].mask;
+            }
+            else
+            {
+                if (i > 0 && sr_check_random() % 4 == 0)
+                {
+                    /* -- nested in an earlier route -- */
+                    ip = ntohl(routes[sr_check_random() % i].dest.s_addr);
+                    mask = ntohl(routes[sr_check_random() % i].mask.s_addr);
+                    prefix = (ip & mask) | (prefix & ~mask);
+                }
+                rt->dest.s_addr = htonl(prefix & sr_check_lpm_mask(len));
+                rt->mask.s_addr = htonl(sr_check_lpm_mask(len));
+            }
+            rt->next = i + 1 < nroutes ? &routes[i + 1] : 0;
+        }
+
+        if ((fib = sr_fib_build(routes)) == 0)
+        {
+            failed++;
+            continue;
+        }
+
+        for (lookup = 0; lookup < SR_CHECK_LPM_LOOKUPS; lookup++)
+        {
+            rt = &routes[sr_check_random() % nroutes];
+            prefix = ntohl(rt->dest.s_addr);
+            mask = ntohl(rt->mask.s_addr);
+            switch (lookup % 4)
+            {
+                case 0:
+                    ip = sr_check_random();
+                    break;
+                case 1:
+                    ip = prefix;
+                    break;
+                case 2:
+                    ip = prefix | ~mask;
+                    break;
+                default:
+                    ip = prefix | (sr_check_random() & ~mask);
+            }
+            ip = htonl(ip);
+            n++;
+            if (sr_fib_lookup(fib, ip) != sr_fib_lookup_list(routes, ip))
+            {
+                if (failed++ < 5)
+                {
+                    fprintf(stderr, "table %u of %u routes: %08x\n", t,
+                            nroutes, ntohl(ip));
+                }
+            }
+        }
+        sr_fib_destroy(fib);
+    }
+    free(routes);
+
+    return sr_check_result("FIB vs list walk", failed, n);
+} /* -- sr_check_lpm -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_check_timers(..)
+ * Scope:  Local
+ *
+ * The timer wheel turned one tick at a time, as sr_arpcache_sweepreqs
+ * does, must fire every timer on the tick it was armed for. Most are
+ * armed on or next to a multiple of 256 or 65536 ticks, where they are
+ * cascaded down from an upper level on the tick they are due.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_check_timers(void)
+{
+    static struct sr_timer timers[SR_CHECK_TIMERS];
+    struct sr_timer_wheel wheel;
+    struct sr_timer* timer;
+    struct sr_timer* next;
+    unsigned long n = 0, failed = 0;
+    uint64_t start, expires;
+    unsigned int i;
+
+    /* -- start short of the first boundary, so none is overdue -- */
+    start = sr_check_random() % SR_TIMER_SLOTS;
+    sr_timer_wheel_init(&wheel, start);
+
+    for (i = 0; i < SR_CHECK_TIMERS; i++)
+    {
+        switch (i % 4)
+        {
+            case 0:
+                expires = (uint64_t)(1 + sr_check_random() %
+                        (SR_CHECK_TIMER_SPAN / SR_TIMER_SLOTS - 1)) <<
+                    SR_TIMER_BITS;
+                break;
+            case 1:
+                expires = (uint64_t)(1 + sr_check_random() %
+                        ((SR_CHECK_TIMER_SPAN >> (2 * SR_TIMER_BITS)) - 1)) <<
+                    (2 * SR_TIMER_BITS);
+                break;
+            case 2:
+                expires = ((uint64_t)(2 + sr_check_random() %
+                        (SR_CHECK_TIMER_SPAN / SR_TIMER_SLOTS - 2)) <<
+                    SR_TIMER_BITS) + (sr_check_random() % 2 ? 1 : -1);
+                break;
+            default:
+                expires = start + 1 +
+                    sr_check_random() % (SR_CHECK_TIMER_SPAN - 1);
+                break;
+        }
+        sr_timer_init(&timers[i]);
+        sr_timer_add(&wheel, &timers[i], expires);
+    }
+
+    while (wheel.now < start + SR_CHECK_TIMER_SPAN)
+    {
+        for (timer = sr_timer_advance(&wheel, wheel.now + 1); timer;
+             timer = next)
+        {
+            next = timer->next;
+            n++;
+            if (timer->expires != wheel.now)
+            {
+                fprintf(stderr, "timer for tick %llu fired on %llu\n",
+                        (unsigned long long)timer->expires,
+                        (unsigned long long)wheel.now);
+                failed++;
+            }
+        }
+    }
+
+    for (i = 0; i < SR_CHECK_TIMERS; i++)
+    {
+        if (sr_timer_pending(&timers[i]))
+        {
+            fprintf(stderr, "timer for tick %llu never fired\n",
+                    (unsigned long long)timers[i].expires);
+            n++;
+            failed++;
+        }
+    }
+
+    return sr_check_result("timer wheel fires on time", failed, n);
+} /* -- sr_check_timers -- */
+
+static void usage(char* argv0)
+{
+    printf("Format: %s [-n iterations] [-s seed]\n", argv0);
+} /* -- usage -- */
+
+int main(int argc, char** argv)
+{
+    unsigned long n = SR_CHECK_ITERATIONS;
+    int c, failed = 0;
+
+    while ((c = getopt(argc, argv, "hn:s:")) != EOF)
+    {
+        switch (c)
+        {
+            case 'n':
+                n = strtoul(optarg, 0, 10);
+                break;
+            case 's':
+                sr_check_state = strtoull(optarg, 0, 0);
+                if (sr_check_state == 0)
+                { sr_check_state = SR_CHECK_SEED; }
+                break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    failed += sr_check_cksum_update(n);
+    failed += sr_check_cksum_kernels();
+    failed += sr_check_ecmp();
+    failed += sr_check_lpm();
+    failed += sr_check_timers();
+
+    return failed;
+} /* -- main -- */
@@ -0,0 +1,117 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_epoch.c
+ *
+ * Description:
+ *
+ * Deferred reclamation, see sr_epoch.h.
+ *
+ * Each reading thread owns a slot holding the global epoch it observed on
+ * entering its outermost section, or 0 while outside. synchronize advances
+ * the global epoch and waits for every slot to be 0 or at the new value.
+ * The reader's slot store and the writer's pointer store are both followed
+ * by a full fence, so either the writer sees the reader's slot, or the
+ * reader's later load of the shared pointer sees the replacement.
+ *
+ * Threads beyond SR_EPOCH_MAX_READERS share one counter of active
+ * readers instead, which synchronize waits on to drain.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sched.h>
+
+#include "sr_epoch.h"
+
+struct sr_epoch_slot
+{
+    uint64_t active;
+} __attribute__ ((aligned (64)));
+
+static struct sr_epoch_slot sr_epoch_slots[SR_EPOCH_MAX_READERS];
+static unsigned int sr_epoch_nslots = 0;
+static uint64_t sr_epoch_global = 1;
+static unsigned long sr_epoch_overflow = 0;
+
+static __thread struct sr_epoch_slot* sr_epoch_self = 0;
+static __thread unsigned int sr_epoch_depth = 0;
+static __thread int sr_epoch_registered = 0;
+
+/*---------------------------------------------------------------------
+ * Method: sr_epoch_enter(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_epoch_enter(void)
+{
+    unsigned int i;
+
+    if (sr_epoch_depth++)
+    { return; }
+
+    if (!sr_epoch_registered)
+    {
+        sr_epoch_registered = 1;
+        i = __atomic_fetch_add(&sr_epoch_nslots, 1, __ATOMIC_RELAXED);
+        if (i < SR_EPOCH_MAX_READERS)
+        { sr_epoch_self = &sr_epoch_slots[i]; }
+    }
+
+    if (sr_epoch_self)
+    {
+        __atomic_store_n(&sr_epoch_self->active,
+                __atomic_load_n(&sr_epoch_global, __ATOMIC_RELAXED),
+                __ATOMIC_RELAXED);
+    }
+    else
+    { __atomic_add_fetch(&sr_epoch_overflow, 1, __ATOMIC_RELAXED); }
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+} /* -- sr_epoch_enter -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_epoch_exit(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_epoch_exit(void)
+{
+    if (--sr_epoch_depth)
+    { return; }
+
+    if (sr_epoch_self)
+    { __atomic_store_n(&sr_epoch_self->active, 0, __ATOMIC_RELEASE); }
+    else
+    { __atomic_sub_fetch(&sr_epoch_overflow, 1, __ATOMIC_RELEASE); }
+} /* -- sr_epoch_exit -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_epoch_synchronize(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_epoch_synchronize(void)
+{
+    unsigned int n, i;
+    uint64_t epoch, active;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    epoch = __atomic_add_fetch(&sr_epoch_global, 1, __ATOMIC_SEQ_CST);
+
+    n = __atomic_load_n(&sr_epoch_nslots, __ATOMIC_ACQUIRE);
+    if (n > SR_EPOCH_MAX_READERS)
+    { n = SR_EPOCH_MAX_READERS; }
+
+    for (i = 0; i < n; i++)
+    {
+        while ((active = __atomic_load_n(&sr_epoch_slots[i].active,
+                        __ATOMIC_ACQUIRE)) != 0 && active < epoch)
+        { sched_yield(); }
+    }
+
+    while (__atomic_load_n(&sr_epoch_overflow, __ATOMIC_ACQUIRE) != 0)
+    { sched_yield(); }
+} /* -- sr_epoch_synchronize -- */
@@ -0,0 +1,29 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_epoch.h
+ * Description:
+ *
+ * Epoch based deferred reclamation for structures the forwarding threads
+ * read without locks, such as the FIB. A reader brackets its use of a
+ * shared pointer with sr_epoch_enter/sr_epoch_exit, which costs two stores
+ * to a cache line owned by the thread. A writer publishes the replacement
+ * with an atomic store, calls sr_epoch_synchronize, and may then free the
+ * old structure: synchronize returns only once every reader that could
+ * still be looking at it has left its section.
+ *
+ * Sections nest and must not block; synchronize must not be called from
+ * inside one.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_EPOCH_H
+#define sr_EPOCH_H
+
+#define SR_EPOCH_MAX_READERS  128   /* threads with a private slot */
+
+void sr_epoch_enter(void);
+void sr_epoch_exit(void);
+
+/* Waits for all read sections entered before the call to end. */
+void sr_epoch_synchronize(void);
+
+#endif  /* --  sr_EPOCH_H -- */
@@ -0,0 +1,353 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib.c
+ *
+ * Description:
+ *
+ * DIR-16-8-8 forwarding table. Routes are inserted shortest prefix first so
+ * that a longer prefix always overwrites the slots of a shorter one it is
+ * nested in (controlled prefix expansion with leaf pushing). Routes of equal
+ * length are inserted in routing table order, so the last one wins, which
+ * matches the old linear scan. A route that lands on a leaf for the same
+ * prefix and length joins that route's ECMP group instead of replacing it
+ * outright, so the surviving leaf is the group's last member.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_fib.h"
+#include "sr_rt.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_mask_len(..)
+ * Scope:  Local
+ *
+ * Number of leading one bits in a host byte order netmask.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_fib_mask_len(uint32_t mask)
+{
+    return ~mask ? __builtin_clz(~mask) : 32;
+} /* -- sr_fib_mask_len -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_new_chunk(..)
+ * Scope:  Local
+ *
+ * Allocate a chunk with every slot set to fill (the leaf being pushed
+ * down from the level above). Returns the chunk number or -1.
+ *
+ *---------------------------------------------------------------------*/
+
+static int64_t sr_fib_new_chunk(struct sr_fib* fib, uint32_t fill)
+{
+    uint32_t* chunk;
+    int i;
+
+    if (fib->n_chunks == fib->cap_chunks)
+    {
+        uint32_t cap = fib->cap_chunks ? fib->cap_chunks * 2 : 64;
+        uint32_t* chunks = realloc(fib->chunks,
+                (size_t)cap * SR_FIB_CHUNK_SZ * sizeof(uint32_t));
+        if (!chunks)
+        { return -1; }
+        fib->chunks = chunks;
+        fib->cap_chunks = cap;
+    }
+
+    chunk = fib->chunks + (size_t)fib->n_chunks * SR_FIB_CHUNK_SZ;
+    if (fill == 0)
+    { memset(chunk, 0, SR_FIB_CHUNK_SZ * sizeof(uint32_t)); }
+    else
+    {
+        /* -- fill by doubling, eight copies instead of 256 stores -- */
+        chunk[0] = fill;
+        for (i = 1; i < SR_FIB_CHUNK_SZ; i *= 2)
+        { memcpy(chunk + i, chunk, i * sizeof(uint32_t)); }
+    }
+
+    return fib->n_chunks++;
+} /* -- sr_fib_new_chunk -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_descend(..)
+ * Scope:  Local
+ *
+ * Return the chunk referenced by *slot, creating it first if the slot
+ * still holds a leaf. slot is given as an offset into tbl16 (level 1) or
+ * into the chunk pool since the pool may move when it grows.
+ *
+ *---------------------------------------------------------------------*/
+
+static int64_t sr_fib_descend(struct sr_fib* fib, int level1, size_t slot)
+{
+    uint32_t entry = level1 ? fib->tbl16[slot] : fib->chunks[slot];
+    int64_t chunk;
+
+    if (entry & SR_FIB_CHUNK_FLAG)
+    { return entry & ~SR_FIB_CHUNK_FLAG; }
+
+    if ((chunk = sr_fib_new_chunk(fib, entry)) < 0)
+    { return -1; }
+
+    if (level1)
+    { fib->tbl16[slot] = SR_FIB_CHUNK_FLAG | (uint32_t)chunk; }
+    else
+    { fib->chunks[slot] = SR_FIB_CHUNK_FLAG | (uint32_t)chunk; }
+
+    return chunk;
+} /* -- sr_fib_descend -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_insert(..)
+ * Scope:  Local
+ *
+ * Expand prefix/len into the table slots it covers, storing leaf.
+ * *prev is set to the leaf previously in the first of them.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_fib_insert(struct sr_fib* fib, uint32_t prefix, int len,
+                         uint32_t leaf, uint32_t* prev)
+{
+    uint32_t* tbl;
+    uint32_t start, count, i;
+    int64_t chunk;
+
+    if (len <= 16)
+    {
+        tbl   = fib->tbl16;
+        start = prefix >> 16;
+        count = 1u << (16 - len);
+    }
+    else
+    {
+        if ((chunk = sr_fib_descend(fib, 1, prefix >> 16)) < 0)
+        { return -1; }
+
+        if (len > 24)
+        {
+            chunk = sr_fib_descend(fib, 0,
+                    (size_t)chunk * SR_FIB_CHUNK_SZ + ((prefix >> 8) & 0xff));
+            if (chunk < 0)
+            { return -1; }
+            start = prefix & 0xff;
+            count = 1u << (32 - len);
+        }
+        else
+        {
+            start = (prefix >> 8) & 0xff;
+            count = 1u << (24 - len);
+        }
+        tbl = fib->chunks + (size_t)chunk * SR_FIB_CHUNK_SZ;
+    }
+
+    *prev = tbl[start];
+    for (i = start; i < start + count; i++)
+    {
+        /* shorter prefixes go in first, so nothing deeper exists yet */
+        assert(!(tbl[i] & SR_FIB_CHUNK_FLAG));
+        tbl[i] = leaf;
+    }
+
+    return 0;
+} /* -- sr_fib_insert -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_build(..)
+ * Scope:  Global
+ *
+ * Build a FIB from the routing table list.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_fib* sr_fib_build(struct sr_rt* rt_list)
+{
+    struct sr_fib* fib = 0;
+    struct sr_rt* rt_walker = 0;
+    uint32_t* prefix = 0;     /* per route, host byte order */
+    uint8_t* lens = 0;        /* per route */
+    uint32_t* by_hi = 0;      /* route indices sorted by prefix >> 16 */
+    uint32_t* order = 0;      /* ... then by length */
+    uint32_t* hi = 0;
+    uint32_t bucket[34];
+    uint32_t i, r, prev, mask;
+    int len;
+
+    fib = (struct sr_fib*)calloc(1, sizeof(struct sr_fib));
+    if (!fib)
+    { return 0; }
+
+    fib->tbl16 = (uint32_t*)calloc(SR_FIB_TBL16_SZ, sizeof(uint32_t));
+    if (!fib->tbl16)
+    { goto fail; }
+
+    for (rt_walker = rt_list; rt_walker; rt_walker = rt_walker->next)
+    { fib->n_routes++; }
+
+    fib->routes = (struct sr_rt**)malloc(
+            (fib->n_routes + 1) * sizeof(struct sr_rt*));
+    prefix = (uint32_t*)malloc((fib->n_routes + 1) * sizeof(uint32_t));
+    lens = (uint8_t*)malloc(fib->n_routes + 1);
+    by_hi = (uint32_t*)malloc((fib->n_routes + 1) * sizeof(uint32_t));
+    order = (uint32_t*)malloc((fib->n_routes + 1) * sizeof(uint32_t));
+    hi = (uint32_t*)calloc(SR_FIB_TBL16_SZ + 1, sizeof(uint32_t));
+    if (!fib->routes || !prefix || !lens || !by_hi || !order || !hi)
+    { goto fail; }
+
+    /* -- one pass over the list, after which only the dense per-route
+          arrays are touched -- */
+    memset(bucket, 0, sizeof(bucket));
+    for (i = 0, rt_walker = rt_list; rt_walker; rt_walker = rt_walker->next, i++)
+    {
+        mask = ntohl(rt_walker->mask.s_addr);
+        len = sr_fib_mask_len(mask);
+        if (len < 32 && (mask << len) != 0)
+        {
+            fprintf(stderr, "Warning: non-contiguous mask %s treated as /%d\n",
+                    inet_ntoa(rt_walker->mask), len);
+        }
+
+        fib->routes[i] = rt_walker;
+        rt_walker->ecmp = rt_walker;
+        rt_walker->ecmp_n = 1;
+        prefix[i] = ntohl(rt_walker->dest.s_addr) & mask;
+        lens[i] = len;
+        bucket[len + 1]++;
+        hi[(prefix[i] >> 16) + 1]++;
+    }
+
+    /* -- stable counting sort by length, and within a length by the top
+          16 bits of the prefix so the inserts sweep the table in address
+          order instead of hopping around it -- */
+    for (len = 1; len < 34; len++)
+    { bucket[len] += bucket[len - 1]; }
+    for (i = 1; i <= SR_FIB_TBL16_SZ; i++)
+    { hi[i] += hi[i - 1]; }
+    for (i = 0; i < fib->n_routes; i++)
+    { by_hi[hi[prefix[i] >> 16]++] = i; }
+    for (i = 0; i < fib->n_routes; i++)
+    { order[bucket[lens[by_hi[i]]]++] = by_hi[i]; }
+
+    for (i = 0; i < fib->n_routes; i++)
+    {
+        r = order[i];
+        if (sr_fib_insert(fib, prefix[r], lens[r], r + 1, &prev) != 0)
+        { goto fail; }
+
+        /* -- same prefix as the leaf it replaced: add the new route to
+              that route's group, after it in the ring -- */
+        if (prev && !(prev & SR_FIB_CHUNK_FLAG) &&
+            prefix[prev - 1] == prefix[r] && lens[prev - 1] == lens[r])
+        {
+            fib->routes[r]->ecmp = fib->routes[prev - 1]->ecmp;
+            fib->routes[prev - 1]->ecmp = fib->routes[r];
+            fib->routes[r]->ecmp_n = fib->routes[prev - 1]->ecmp_n + 1;
+        }
+    }
+
+    free(prefix);
+    free(lens);
+    free(by_hi);
+    free(order);
+    free(hi);
+    return fib;
+
+fail:
+    fprintf(stderr, "Error: out of memory building forwarding table\n");
+    free(prefix);
+    free(lens);
+    free(by_hi);
+    free(order);
+    free(hi);
+    sr_fib_destroy(fib);
+    return 0;
+} /* -- sr_fib_build -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_lookup(..)
+ * Scope:  Global
+ *
+ * Longest prefix match, ip in network byte order.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_fib_lookup(const struct sr_fib* fib, uint32_t ip)
+{
+    uint32_t addr = ntohl(ip);
+    uint32_t entry = fib->tbl16[addr >> 16];
+
+    if (entry & SR_FIB_CHUNK_FLAG)
+    {
+        entry = fib->chunks[(size_t)(entry & ~SR_FIB_CHUNK_FLAG) *
+                SR_FIB_CHUNK_SZ + ((addr >> 8) & 0xff)];
+        if (entry & SR_FIB_CHUNK_FLAG)
+        {
+            entry = fib->chunks[(size_t)(entry & ~SR_FIB_CHUNK_FLAG) *
+                    SR_FIB_CHUNK_SZ + (addr & 0xff)];
+        }
+    }
+
+    return entry ? fib->routes[entry - 1] : 0;
+} /* -- sr_fib_lookup -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_lookup_list(..)
+ * Scope:  Global
+ *
+ * The walk over the whole list the FIB replaced: the longest matching
+ * mask wins, and of equal ones the last in the list.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_fib_lookup_list(struct sr_rt* rt_list, uint32_t ip)
+{
+    struct sr_rt* rt_walker = 0;
+    struct sr_rt* best = 0;
+    uint32_t addr = ntohl(ip);
+    uint32_t mask;
+    int len, best_len = -1;
+
+    for (rt_walker = rt_list; rt_walker; rt_walker = rt_walker->next)
+    {
+        len = sr_fib_mask_len(ntohl(rt_walker->mask.s_addr));
+        mask = len ? 0xffffffffu << (32 - len) : 0;
+        if (((addr ^ ntohl(rt_walker->dest.s_addr)) & mask) == 0 &&
+            len >= best_len)
+        {
+            best = rt_walker;
+            best_len = len;
+        }
+    }
+    return best;
+} /* -- sr_fib_lookup_list -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_destroy(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fib_destroy(struct sr_fib* fib)
+{
+    if (!fib)
+    { return; }
+
+    if (fib->map)
+    { munmap(fib->map, fib->map_len); }
+    else
+    {
+        free(fib->tbl16);
+        free(fib->chunks);
+    }
+    free(fib->routes);
+    free(fib);
+} /* -- sr_fib_destroy -- */
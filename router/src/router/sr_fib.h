@@ -0,0 +1,67 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib.h
+ * Description:
+ *
+ * Forwarding information base built from the routing table. Lookups are
+ * done in a DIR-16-8-8 multibit trie: a 2^16 entry first level indexed by
+ * the top 16 bits of the destination, followed by up to two 256 entry chunks
+ * for prefixes longer than /16 and /24. Every lookup costs at most three
+ * memory references regardless of the number of routes.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_FIB_H
+#define sr_FIB_H
+
+#ifdef _DARWIN_
+#include <sys/types.h>
+#endif
+
+#include <stdint.h>
+
+#define SR_FIB_TBL16_SZ   (1 << 16)
+#define SR_FIB_CHUNK_SZ   256
+#define SR_FIB_CHUNK_FLAG 0x80000000u  /* entry refers to a chunk, not a route */
+
+struct sr_rt;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_fib
+ *
+ * Table entries are 0 for "no route", (SR_FIB_CHUNK_FLAG | chunk) for a
+ * pointer to the next level, or (route index + 1) for a leaf.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_fib
+{
+    uint32_t* tbl16;          /* first level, SR_FIB_TBL16_SZ entries */
+    uint32_t* chunks;         /* n_chunks * SR_FIB_CHUNK_SZ entries */
+    uint32_t  n_chunks;
+    uint32_t  cap_chunks;
+    struct sr_rt** routes;    /* leaf index -> routing table entry (borrowed) */
+    uint32_t  n_routes;
+    void*     map;            /* snapshot tbl16 and chunks live in, or NULL */
+    size_t    map_len;
+};
+
+/* Builds a FIB from the routing table list. The list entries are borrowed
+   and must outlive the FIB. Entries with the same prefix and mask form an
+   ECMP group, linked in table order through their ecmp fields; ecmp_n is
+   the size of the group in its last entry. Returns NULL on allocation
+   failure. */
+struct sr_fib* sr_fib_build(struct sr_rt* rt_list);
+
+/* Longest prefix match for ip (network byte order). Of a group of entries
+   with the same prefix, returns the one appearing last in the routing
+   table; see sr_rt_ecmp_path for picking among them. */
+struct sr_rt* sr_fib_lookup(const struct sr_fib* fib, uint32_t ip);
+
+/* The same lookup done by walking the list, as the router did before the
+   FIB; the reference sr_check and sr_bench -L hold sr_fib_lookup to. */
+struct sr_rt* sr_fib_lookup_list(struct sr_rt* rt_list, uint32_t ip);
+
+/* Frees the FIB, or unmaps it if it was mapped from a snapshot. */
+void sr_fib_destroy(struct sr_fib* fib);
+
+#endif  /* --  sr_FIB_H -- */
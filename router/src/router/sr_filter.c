@@ -0,0 +1,543 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_filter.c
+ *
+ * Description:
+ *
+ * Capture filter compiler and interpreter, see sr_filter.h.
+ *
+ * The expression is parsed into a tree and the tree is turned into code
+ * back to front: the accept and reject instructions are placed last, and
+ * each node is emitted knowing where control goes when it is true or
+ * false. "a and b" sends a's true edge to b, "a or b" sends a's false edge
+ * to b and "not a" swaps a's edges, so the boolean structure costs no
+ * instructions of its own.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "sr_protocol.h"
+#include "sr_filter.h"
+
+#define SR_FILTER_MAX_TOKENS  256
+#define SR_FILTER_MAX_TOKLEN  32
+
+/* Instruction (and leaf node) opcodes */
+enum sr_filter_op
+{
+    SR_FOP_ACCEPT,
+    SR_FOP_REJECT,
+    SR_FOP_ARP,
+    SR_FOP_IP,
+    SR_FOP_PROTO,        /* ip_p == k */
+    SR_FOP_SRC,          /* (ip_src & mask) == k */
+    SR_FOP_DST,          /* (ip_dst & mask) == k */
+    SR_FOP_ICMP_TYPE,
+    SR_FOP_ICMP_CODE,
+    SR_FOP_LEN_LT,
+    SR_FOP_LEN_GT,
+
+    /* -- interior nodes only -- */
+    SR_FOP_AND,
+    SR_FOP_OR,
+    SR_FOP_NOT
+};
+
+struct sr_filter_insn
+{
+    uint8_t op;
+    uint16_t jt, jf;     /* next instruction when true / false */
+    uint32_t k, mask;    /* addresses in network byte order */
+};
+
+struct sr_filter
+{
+    unsigned int entry;
+    unsigned int len;
+    struct sr_filter_insn insns[];
+};
+
+struct sr_filter_node
+{
+    enum sr_filter_op op;
+    uint32_t k, mask;
+    struct sr_filter_node* a;
+    struct sr_filter_node* b;
+};
+
+struct sr_filter_parser
+{
+    char tok[SR_FILTER_MAX_TOKENS][SR_FILTER_MAX_TOKLEN];
+    int ntok, pos;
+    struct sr_filter_node nodes[2 * SR_FILTER_MAX_TOKENS];
+    int nnodes;
+    char* err;
+    size_t errlen;
+    int failed;
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_filter_match(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_filter_match(const struct sr_filter* filter, const uint8_t* frame,
+                    unsigned int len)
+{
+    const struct sr_ethernet_hdr* eth_hdr = (const struct sr_ethernet_hdr*)frame;
+    const struct sr_ip_hdr* ip_hdr = 0;
+    const uint8_t* icmp = 0;
+    const struct sr_filter_insn* insn;
+    unsigned int pc = filter->entry;
+    unsigned int hl;
+    int r;
+
+    /* -- locate the headers the tests may need, once -- */
+    if (len >= sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr) &&
+        eth_hdr->ether_type == htons(ethertype_ip))
+    {
+        ip_hdr = (const struct sr_ip_hdr*)(frame + sizeof(struct sr_ethernet_hdr));
+        hl = ip_hdr->ip_hl * 4;
+        if (ip_hdr->ip_v != 4 || hl < sizeof(struct sr_ip_hdr) ||
+            len < sizeof(struct sr_ethernet_hdr) + hl)
+        { ip_hdr = 0; }
+        else if (ip_hdr->ip_p == ip_protocol_icmp &&
+                 !(ip_hdr->ip_off & htons(IP_OFFMASK)) &&
+                 len >= sizeof(struct sr_ethernet_hdr) + hl + 2)
+        { icmp = frame + sizeof(struct sr_ethernet_hdr) + hl; }
+    }
+
+    while (1)
+    {
+        insn = &filter->insns[pc];
+        switch (insn->op)
+        {
+            case SR_FOP_ACCEPT:
+                return 1;
+            case SR_FOP_REJECT:
+                return 0;
+            case SR_FOP_ARP:
+                r = len >= sizeof(struct sr_ethernet_hdr) &&
+                    eth_hdr->ether_type == htons(ethertype_arp);
+                break;
+            case SR_FOP_IP:
+                r = ip_hdr != 0;
+                break;
+            case SR_FOP_PROTO:
+                r = ip_hdr && ip_hdr->ip_p == insn->k;
+                break;
+            case SR_FOP_SRC:
+                r = ip_hdr && (ip_hdr->ip_src & insn->mask) == insn->k;
+                break;
+            case SR_FOP_DST:
+                r = ip_hdr && (ip_hdr->ip_dst & insn->mask) == insn->k;
+                break;
+            case SR_FOP_ICMP_TYPE:
+                r = icmp && icmp[0] == insn->k;
+                break;
+            case SR_FOP_ICMP_CODE:
+                r = icmp && icmp[1] == insn->k;
+                break;
+            case SR_FOP_LEN_LT:
+                r = len < insn->k;
+                break;
+            case SR_FOP_LEN_GT:
+                r = len > insn->k;
+                break;
+            default:
+                return 0;
+        }
+        pc = r ? insn->jt : insn->jf;
+    }
+} /* -- sr_filter_match -- */
+
+/*---------------------------------------------------------------------
+ * Parser
+ *---------------------------------------------------------------------*/
+
+static void sr_filter_error(struct sr_filter_parser* p, const char* msg,
+                            const char* tok)
+{
+    if (p->failed)
+    { return; }
+    p->failed = 1;
+    snprintf(p->err, p->errlen, "%s%s%s%s", msg, tok ? " near '" : "",
+             tok ? tok : "", tok ? "'" : "");
+} /* -- sr_filter_error -- */
+
+static int sr_filter_tokenize(struct sr_filter_parser* p, const char* s)
+{
+    int n;
+
+    p->ntok = 0;
+    while (*s)
+    {
+        if (*s == ' ' || *s == '\t')
+        { s++; continue; }
+
+        if (p->ntok == SR_FILTER_MAX_TOKENS)
+        {
+            sr_filter_error(p, "expression too long", 0);
+            return -1;
+        }
+
+        if (strchr("()<>", *s))
+        { n = 1; }
+        else
+        { n = strcspn(s, " \t()<>"); }
+
+        if (n >= SR_FILTER_MAX_TOKLEN)
+        {
+            sr_filter_error(p, "token too long", 0);
+            return -1;
+        }
+        memcpy(p->tok[p->ntok], s, n);
+        p->tok[p->ntok][n] = 0;
+        p->ntok++;
+        s += n;
+    }
+
+    return 0;
+} /* -- sr_filter_tokenize -- */
+
+static const char* sr_filter_peek(struct sr_filter_parser* p)
+{
+    return p->pos < p->ntok ? p->tok[p->pos] : 0;
+} /* -- sr_filter_peek -- */
+
+static const char* sr_filter_next(struct sr_filter_parser* p)
+{
+    return p->pos < p->ntok ? p->tok[p->pos++] : 0;
+} /* -- sr_filter_next -- */
+
+static int sr_filter_accept(struct sr_filter_parser* p, const char* word)
+{
+    const char* tok = sr_filter_peek(p);
+
+    if (tok && !strcmp(tok, word))
+    {
+        p->pos++;
+        return 1;
+    }
+    return 0;
+} /* -- sr_filter_accept -- */
+
+static struct sr_filter_node* sr_filter_node(struct sr_filter_parser* p,
+        enum sr_filter_op op, struct sr_filter_node* a, struct sr_filter_node* b)
+{
+    struct sr_filter_node* node;
+
+    if (p->nnodes == 2 * SR_FILTER_MAX_TOKENS)
+    {
+        sr_filter_error(p, "expression too long", 0);
+        return 0;
+    }
+    node = &p->nodes[p->nnodes++];
+    node->op = op;
+    node->k = node->mask = 0;
+    node->a = a;
+    node->b = b;
+    return node;
+} /* -- sr_filter_node -- */
+
+static int sr_filter_number(struct sr_filter_parser* p, uint32_t max, uint32_t* out)
+{
+    const char* tok = sr_filter_next(p);
+    char* end;
+    unsigned long v;
+
+    if (!tok)
+    {
+        sr_filter_error(p, "expected a number at end of expression", 0);
+        return -1;
+    }
+    v = strtoul(tok, &end, 10);
+    if (*end || end == tok || v > max)
+    {
+        sr_filter_error(p, "bad number", tok);
+        return -1;
+    }
+    *out = v;
+    return 0;
+} /* -- sr_filter_number -- */
+
+/* Parses "A.B.C.D" (net == 0) or "A.B.C.D/LEN" (net != 0) */
+static int sr_filter_address(struct sr_filter_parser* p, int net,
+                             uint32_t* addr, uint32_t* mask)
+{
+    const char* tok = sr_filter_next(p);
+    char buf[SR_FILTER_MAX_TOKLEN];
+    char* slash;
+    char* end;
+    unsigned long bits = 32;
+    struct in_addr in;
+
+    if (!tok)
+    {
+        sr_filter_error(p, "expected an address at end of expression", 0);
+        return -1;
+    }
+    strcpy(buf, tok);
+
+    slash = strchr(buf, '/');
+    if (net && slash)
+    {
+        *slash = 0;
+        bits = strtoul(slash + 1, &end, 10);
+        if (*end || end == slash + 1 || bits > 32)
+        {
+            sr_filter_error(p, "bad prefix length", tok);
+            return -1;
+        }
+    }
+    else if (net || slash)
+    {
+        sr_filter_error(p, net ? "expected A.B.C.D/LEN" : "expected A.B.C.D", tok);
+        return -1;
+    }
+
+    if (inet_pton(AF_INET, buf, &in) != 1)
+    {
+        sr_filter_error(p, "bad address", tok);
+        return -1;
+    }
+
+    *mask = bits ? htonl(0xffffffffu << (32 - bits)) : 0;
+    *addr = in.s_addr & *mask;
+    return 0;
+} /* -- sr_filter_address -- */
+
+static struct sr_filter_node* sr_filter_leaf(struct sr_filter_parser* p,
+        enum sr_filter_op op, uint32_t k, uint32_t mask)
+{
+    struct sr_filter_node* node = sr_filter_node(p, op, 0, 0);
+
+    if (node)
+    {
+        node->k = k;
+        node->mask = mask;
+    }
+    return node;
+} /* -- sr_filter_leaf -- */
+
+static struct sr_filter_node* sr_filter_expr(struct sr_filter_parser* p);
+
+static struct sr_filter_node* sr_filter_primitive(struct sr_filter_parser* p)
+{
+    const char* tok = sr_filter_next(p);
+    struct sr_filter_node* node;
+    uint32_t k, mask;
+    int dir = 0;    /* 1 src, 2 dst, 0 either */
+
+    if (!tok)
+    {
+        sr_filter_error(p, "unexpected end of expression", 0);
+        return 0;
+    }
+
+    if (!strcmp(tok, "arp"))
+    { return sr_filter_leaf(p, SR_FOP_ARP, 0, 0); }
+    if (!strcmp(tok, "ip"))
+    { return sr_filter_leaf(p, SR_FOP_IP, 0, 0); }
+    if (!strcmp(tok, "tcp"))
+    { return sr_filter_leaf(p, SR_FOP_PROTO, 6, 0); }
+    if (!strcmp(tok, "udp"))
+    { return sr_filter_leaf(p, SR_FOP_PROTO, 17, 0); }
+
+    if (!strcmp(tok, "proto"))
+    {
+        if (sr_filter_number(p, 255, &k))
+        { return 0; }
+        return sr_filter_leaf(p, SR_FOP_PROTO, k, 0);
+    }
+
+    if (!strcmp(tok, "icmp"))
+    {
+        if (!sr_filter_accept(p, "type"))
+        { return sr_filter_leaf(p, SR_FOP_PROTO, ip_protocol_icmp, 0); }
+        if (sr_filter_number(p, 255, &k))
+        { return 0; }
+        node = sr_filter_leaf(p, SR_FOP_ICMP_TYPE, k, 0);
+        if (!sr_filter_accept(p, "code"))
+        { return node; }
+        if (sr_filter_number(p, 255, &k))
+        { return 0; }
+        return sr_filter_node(p, SR_FOP_AND, node,
+                sr_filter_leaf(p, SR_FOP_ICMP_CODE, k, 0));
+    }
+
+    if (!strcmp(tok, "len"))
+    {
+        tok = sr_filter_next(p);
+        if (!tok || (strcmp(tok, "<") && strcmp(tok, ">")))
+        {
+            sr_filter_error(p, "expected < or > after len", tok);
+            return 0;
+        }
+        if (sr_filter_number(p, 0xffffffffu, &k))
+        { return 0; }
+        return sr_filter_leaf(p, *tok == '<' ? SR_FOP_LEN_LT : SR_FOP_LEN_GT, k, 0);
+    }
+
+    if (!strcmp(tok, "src") || !strcmp(tok, "dst"))
+    {
+        dir = (*tok == 's') ? 1 : 2;
+        if (!(tok = sr_filter_next(p)))
+        {
+            sr_filter_error(p, "expected host or net at end of expression", 0);
+            return 0;
+        }
+    }
+
+    if (!strcmp(tok, "host") || !strcmp(tok, "net"))
+    {
+        if (sr_filter_address(p, *tok == 'n', &k, &mask))
+        { return 0; }
+        if (dir == 1)
+        { return sr_filter_leaf(p, SR_FOP_SRC, k, mask); }
+        if (dir == 2)
+        { return sr_filter_leaf(p, SR_FOP_DST, k, mask); }
+        return sr_filter_node(p, SR_FOP_OR,
+                sr_filter_leaf(p, SR_FOP_SRC, k, mask),
+                sr_filter_leaf(p, SR_FOP_DST, k, mask));
+    }
+
+    sr_filter_error(p, "unknown primitive", tok);
+    return 0;
+} /* -- sr_filter_primitive -- */
+
+static struct sr_filter_node* sr_filter_factor(struct sr_filter_parser* p)
+{
+    struct sr_filter_node* node;
+
+    if (sr_filter_accept(p, "not"))
+    {
+        node = sr_filter_factor(p);
+        return node ? sr_filter_node(p, SR_FOP_NOT, node, 0) : 0;
+    }
+
+    if (sr_filter_accept(p, "("))
+    {
+        node = sr_filter_expr(p);
+        if (node && !sr_filter_accept(p, ")"))
+        {
+            sr_filter_error(p, "expected )", sr_filter_peek(p));
+            return 0;
+        }
+        return node;
+    }
+
+    return sr_filter_primitive(p);
+} /* -- sr_filter_factor -- */
+
+static struct sr_filter_node* sr_filter_term(struct sr_filter_parser* p)
+{
+    struct sr_filter_node* node = sr_filter_factor(p);
+
+    while (node && sr_filter_accept(p, "and"))
+    { node = sr_filter_node(p, SR_FOP_AND, node, sr_filter_factor(p)); }
+    return node;
+} /* -- sr_filter_term -- */
+
+static struct sr_filter_node* sr_filter_expr(struct sr_filter_parser* p)
+{
+    struct sr_filter_node* node = sr_filter_term(p);
+
+    while (node && sr_filter_accept(p, "or"))
+    { node = sr_filter_node(p, SR_FOP_OR, node, sr_filter_term(p)); }
+    return node;
+} /* -- sr_filter_expr -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_filter_gen(..)
+ * Scope:  Local
+ *
+ * Emit node in front of *next, jumping to t when it holds and to f when
+ * it doesn't. Returns the index of its first instruction.
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned int sr_filter_gen(struct sr_filter* filter, unsigned int* next,
+        const struct sr_filter_node* node, unsigned int t, unsigned int f)
+{
+    struct sr_filter_insn* insn;
+
+    switch (node->op)
+    {
+        case SR_FOP_AND:
+            return sr_filter_gen(filter, next, node->a,
+                    sr_filter_gen(filter, next, node->b, t, f), f);
+        case SR_FOP_OR:
+            return sr_filter_gen(filter, next, node->a,
+                    t, sr_filter_gen(filter, next, node->b, t, f));
+        case SR_FOP_NOT:
+            return sr_filter_gen(filter, next, node->a, f, t);
+        default:
+            insn = &filter->insns[--(*next)];
+            insn->op = node->op;
+            insn->k = node->k;
+            insn->mask = node->mask;
+            insn->jt = t;
+            insn->jf = f;
+            return *next;
+    }
+} /* -- sr_filter_gen -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_filter_compile(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_filter* sr_filter_compile(const char* expr, char* err, size_t errlen)
+{
+    struct sr_filter_parser* p;
+    struct sr_filter_node* root = 0;
+    struct sr_filter* filter = 0;
+    unsigned int next, n;
+
+    if ((p = (struct sr_filter_parser*)calloc(1, sizeof(*p))) == 0)
+    {
+        snprintf(err, errlen, "out of memory");
+        return 0;
+    }
+    p->err = err;
+    p->errlen = errlen;
+
+    if (sr_filter_tokenize(p, expr) == 0)
+    {
+        root = sr_filter_expr(p);
+        if (root && p->pos < p->ntok)
+        { sr_filter_error(p, "unexpected", sr_filter_peek(p)); }
+    }
+
+    if (!p->failed)
+    {
+        /* -- at most one instruction per node, plus accept and reject -- */
+        n = p->nnodes + 2;
+        filter = (struct sr_filter*)malloc(sizeof(*filter) +
+                n * sizeof(struct sr_filter_insn));
+        if (filter)
+        {
+            filter->len = n;
+            filter->insns[n - 1].op = SR_FOP_REJECT;
+            filter->insns[n - 2].op = SR_FOP_ACCEPT;
+            next = n - 2;
+            filter->entry = sr_filter_gen(filter, &next, root, n - 2, n - 1);
+        }
+        else
+        { snprintf(err, errlen, "out of memory"); }
+    }
+
+    free(p);
+    return filter;
+} /* -- sr_filter_compile -- */
+
+void sr_filter_free(struct sr_filter* filter)
+{
+    free(filter);
+} /* -- sr_filter_free -- */
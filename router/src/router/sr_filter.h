@@ -0,0 +1,46 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_filter.h
+ * Description:
+ *
+ * Capture filter for the packet log (-F). An expression such as
+ *
+ *     icmp type 3 or icmp type 11 or dst net 10.0.0.0/8
+ *
+ * is compiled once into a short program of test instructions, each with
+ * a true and a false jump target, ending in accept or reject. Jumps only
+ * go forward, so a match runs at most one test per primitive. Frames that
+ * do not match are never copied into the capture ring.
+ *
+ * Grammar, lowest precedence first:
+ *
+ *     expr      := term { "or" term }
+ *     term      := factor { "and" factor }
+ *     factor    := "not" factor | "(" expr ")" | primitive
+ *     primitive := "arp" | "ip" | "icmp" | "tcp" | "udp"
+ *                | "proto" N | "icmp" "type" N [ "code" N ]
+ *                | [ "src" | "dst" ] "host" A.B.C.D
+ *                | [ "src" | "dst" ] "net" A.B.C.D/LEN
+ *                | "len" ( "<" | ">" ) N
+ *
+ * "host" and "net" without a direction match either address.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_FILTER_H
+#define sr_FILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct sr_filter;
+
+/* Compiles expr. On error returns NULL and describes the problem in err. */
+struct sr_filter* sr_filter_compile(const char* expr, char* err, size_t errlen);
+
+/* Returns 1 if the ethernet frame matches the filter, 0 otherwise. */
+int sr_filter_match(const struct sr_filter* filter, const uint8_t* frame,
+                    unsigned int len);
+
+void sr_filter_free(struct sr_filter* filter);
+
+#endif  /* --  sr_FILTER_H -- */
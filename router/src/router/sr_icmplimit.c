@@ -0,0 +1,246 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_icmplimit.c
+ *
+ * Description:
+ *
+ * ICMP error rate limits, see sr_icmplimit.h.
+ *
+ * A bucket holding up to burst tokens that refill at rate a second is kept
+ * as the single time full_at by which it would be full again. Taking a
+ * token moves full_at one interval (1/rate) later, starting from now if it
+ * is in the past; that is allowed while full_at stays within burst
+ * intervals of now.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sr_icmplimit.h"
+#include "sr_stats.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_icmplimit_take(..)
+ * Scope:  Local
+ *
+ * Take a token from the bucket whose full time is *full_at, if it has
+ * one. Returns 1 if it did.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_icmplimit_take(const struct sr_icmplimit_bucket* limits,
+                             uint64_t* full_at, uint64_t now)
+{
+    uint64_t old, next;
+
+    if (limits->interval == 0)
+    { return 1; }
+
+    old = __atomic_load_n(full_at, __ATOMIC_RELAXED);
+    do
+    {
+        next = (old > now ? old : now) + limits->interval;
+        if (next - now > limits->depth)
+        { return 0; }
+    } while (!__atomic_compare_exchange_n(full_at, &old, next, 1,
+                                          __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+    return 1;
+} /* -- sr_icmplimit_take -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_icmplimit_check(..)
+ * Scope:  Global
+ *
+ * The source is checked first, so that a single noisy source spends
+ * only its own tokens and not those its type shares with everyone; its
+ * token is handed back if the type then says no.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_icmplimit_check(struct sr_icmplimit* limit,
+                       enum sr_icmplimit_type type, uint32_t dst)
+{
+    struct sr_icmplimit_source* slot = 0;
+    uint64_t now;
+
+    if (!limit)
+    { return SR_ICMPLIMIT_OK; }
+
+    now = sr_stats_now();
+
+    if (limit->source.interval)
+    {
+        slot = &limit->sources[(dst * 2654435761u) >>
+                               (32 - __builtin_ctz(SR_ICMPLIMIT_SOURCES))];
+        if (__atomic_load_n(&slot->ip, __ATOMIC_RELAXED) != dst)
+        {
+            if (__atomic_load_n(&slot->full_at, __ATOMIC_RELAXED) > now)
+            {
+                /* -- held, and in use: dst goes by its type alone -- */
+                slot = 0;
+            }
+            else
+            {
+                /* -- idle: a full bucket, less the token taken now -- */
+                __atomic_store_n(&slot->ip, dst, __ATOMIC_RELAXED);
+                __atomic_store_n(&slot->full_at,
+                                 now + limit->source.interval,
+                                 __ATOMIC_RELAXED);
+            }
+        }
+        else if (!sr_icmplimit_take(&limit->source, &slot->full_at, now))
+        { return SR_ICMPLIMIT_SOURCE; }
+    }
+
+    if (!sr_icmplimit_take(&limit->type[type], &limit->type[type].full_at,
+                           now))
+    {
+        if (slot)
+        {
+            __atomic_fetch_sub(&slot->full_at, limit->source.interval,
+                               __ATOMIC_RELAXED);
+        }
+        return SR_ICMPLIMIT_TYPE;
+    }
+
+    return SR_ICMPLIMIT_OK;
+} /* -- sr_icmplimit_check -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_icmplimit_set(..)
+ * Scope:  Local
+ *
+ * Parse "rate[/burst]" into bucket limits. Returns 0 on success.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_icmplimit_set(struct sr_icmplimit_bucket* bucket,
+                            const char* value)
+{
+    char* end;
+    double rate, burst;
+
+    rate = strtod(value, &end);
+    if (end == value || rate < 0)
+    { return -1; }
+    burst = rate < 1 ? 1 : rate;
+    if (*end == '/')
+    {
+        value = end + 1;
+        burst = strtod(value, &end);
+        if (end == value || burst < 1)
+        { return -1; }
+    }
+    if (*end != 0 && *end != ',')
+    { return -1; }
+
+    if (rate == 0)
+    {
+        bucket->interval = bucket->depth = 0;
+        return 0;
+    }
+    bucket->interval = (uint64_t)(1e9 / rate);
+    if (bucket->interval == 0)
+    { bucket->interval = 1; }
+    bucket->depth = (uint64_t)burst * bucket->interval;
+    return 0;
+} /* -- sr_icmplimit_set -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_icmplimit_parse(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_icmplimit_parse(struct sr_icmplimit* limit, const char* spec,
+                              char* err, unsigned int err_len)
+{
+    static const char* kinds[SR_ICMPLIMIT_TYPES] =
+    { "time", "net", "host", "port" };
+    const char* item = spec;
+    const char* eq;
+    size_t key_len;
+    int i, ok;
+
+    while (*item)
+    {
+        eq = strchr(item, '=');
+        if (eq && (!strchr(item, ',') || eq < strchr(item, ',')))
+        {
+            key_len = eq - item;
+            ok = 0;
+            if (key_len == 6 && strncmp(item, "source", 6) == 0)
+            { ok = sr_icmplimit_set(&limit->source, eq + 1) == 0; }
+            for (i = 0; i < SR_ICMPLIMIT_TYPES; i++)
+            {
+                if (key_len == strlen(kinds[i]) &&
+                    strncmp(item, kinds[i], key_len) == 0)
+                { ok = sr_icmplimit_set(&limit->type[i], eq + 1) == 0; }
+            }
+        }
+        else
+        {
+            ok = 1;
+            for (i = 0; i < SR_ICMPLIMIT_TYPES; i++)
+            { ok = ok && sr_icmplimit_set(&limit->type[i], item) == 0; }
+        }
+
+        if (!ok)
+        {
+            snprintf(err, err_len, "bad ICMP limit \"%.*s\"",
+                     (int)strcspn(item, ","), item);
+            return -1;
+        }
+
+        item += strcspn(item, ",");
+        if (*item == ',')
+        { item++; }
+    }
+    return 0;
+} /* -- sr_icmplimit_parse -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_icmplimit_create(..)
+ * Scope:  Global
+ *
+ * The defaults are applied first, so spec need only name what differs.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_icmplimit* sr_icmplimit_create(const char* spec,
+                                         char* err, unsigned int err_len)
+{
+    struct sr_icmplimit* limit;
+
+    limit = (struct sr_icmplimit*)calloc(1, sizeof(struct sr_icmplimit));
+    if (limit)
+    {
+        limit->sources = (struct sr_icmplimit_source*)
+            calloc(SR_ICMPLIMIT_SOURCES, sizeof(struct sr_icmplimit_source));
+    }
+    if (!limit || !limit->sources)
+    {
+        snprintf(err, err_len, "out of memory");
+        sr_icmplimit_destroy(limit);
+        return 0;
+    }
+
+    if (sr_icmplimit_parse(limit, SR_ICMPLIMIT_DEFAULT, err, err_len) != 0 ||
+        (spec && sr_icmplimit_parse(limit, spec, err, err_len) != 0))
+    {
+        sr_icmplimit_destroy(limit);
+        return 0;
+    }
+    return limit;
+} /* -- sr_icmplimit_create -- */
+
+void sr_icmplimit_destroy(struct sr_icmplimit* limit)
+{
+    if (limit)
+    {
+        free(limit->sources);
+        free(limit);
+    }
+} /* -- sr_icmplimit_destroy -- */
@@ -0,0 +1,87 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_icmplimit.h
+ * Description:
+ *
+ * Rate limits for the ICMP errors the router generates (time exceeded,
+ * net, host and port unreachable), checked before any work is spent on
+ * building one. An error is sent only if both of these have a token:
+ *
+ *  - the bucket of its type, shared by all sources, and
+ *  - the bucket of the address it would be sent to, in a direct-mapped
+ *    table of SR_ICMPLIMIT_SOURCES buckets shared by all types. An
+ *    address that lands on a slot held by another takes the slot over,
+ *    with a full bucket, only once the holder's bucket has refilled;
+ *    until then it goes by the type buckets alone, as does a flood from
+ *    more sources than there are slots.
+ *
+ * Buckets are kept as the time they will next be full (GCRA), one 64 bit
+ * word each updated with compare-and-swap, so checking takes no lock.
+ * Slot takeovers race benignly: at worst an extra error goes out. A
+ * token taken from a source is handed back if the type bucket refuses,
+ * so a source is charged only for errors it was sent.
+ *
+ * Limits are given as a comma separated list of
+ *
+ *   [kind=]rate[/burst]
+ *
+ * where kind is time, net, host, port or source and a bare rate sets all
+ * four types; rate is per second, burst defaults to rate (at least 1),
+ * and a rate of 0 removes the limit. The defaults are SR_ICMPLIMIT_DEFAULT.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_ICMPLIMIT_H
+#define sr_ICMPLIMIT_H
+
+#include <stdint.h>
+
+#define SR_ICMPLIMIT_SOURCES  4096  /* per-source buckets, 2^n */
+#define SR_ICMPLIMIT_DEFAULT  "1000/50,source=10/20"
+
+/* In the order of the matching sr_stats counters. */
+enum sr_icmplimit_type
+{
+    SR_ICMPLIMIT_TIME_EXCEEDED,
+    SR_ICMPLIMIT_NET_UNREACH,
+    SR_ICMPLIMIT_HOST_UNREACH,
+    SR_ICMPLIMIT_PORT_UNREACH,
+    SR_ICMPLIMIT_TYPES
+};
+
+/* What sr_icmplimit_check decided. */
+#define SR_ICMPLIMIT_OK      0
+#define SR_ICMPLIMIT_TYPE    1  /* over the limit of its type */
+#define SR_ICMPLIMIT_SOURCE  2  /* over the limit of its destination */
+
+struct sr_icmplimit_bucket
+{
+    uint64_t interval;   /* ns per token, 0 for no limit */
+    uint64_t depth;      /* ns of credit a full bucket holds */
+    uint64_t full_at;    /* ns, when the bucket is next full */
+};
+
+struct sr_icmplimit_source
+{
+    uint32_t ip;         /* nbo, 0 if free */
+    uint64_t full_at;
+};
+
+struct sr_icmplimit
+{
+    struct sr_icmplimit_bucket type[SR_ICMPLIMIT_TYPES];
+    struct sr_icmplimit_bucket source;  /* limits for every source slot */
+    struct sr_icmplimit_source* sources;
+};
+
+/* Returns a limiter configured from spec (NULL for the defaults), or
+   NULL with a message in err if spec does not parse. */
+struct sr_icmplimit* sr_icmplimit_create(const char* spec,
+                                         char* err, unsigned int err_len);
+void sr_icmplimit_destroy(struct sr_icmplimit* limit);
+
+/* Takes a token for an error of type to dst (nbo) if one is due.
+   Returns SR_ICMPLIMIT_OK if the error may be sent. */
+int sr_icmplimit_check(struct sr_icmplimit* limit,
+                       enum sr_icmplimit_type type, uint32_t dst);
+
+#endif  /* --  sr_ICMPLIMIT_H -- */
@@ -23,6 +23,76 @@
 #include "sr_if.h"
 #include "sr_router.h"
 
+/*---------------------------------------------------------------------
+ * Method: sr_if_name_hash
+ * Scope: Local
+ *
+ * FNV-1a of an interface name, up to sr_IFACE_NAMELEN characters.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint32_t sr_if_name_hash(const char* name)
+{
+    uint32_t h = 2166136261u;
+    int i;
+
+    for(i = 0; i < sr_IFACE_NAMELEN && name[i]; i++)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+
+    return h;
+} /* -- sr_if_name_hash -- */
+
+static uint32_t sr_if_ip_hash(uint32_t ip)
+{
+    return (ip * 0x9e3779b1u) >> 8;
+} /* -- sr_if_ip_hash -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_if_rehash
+ * Scope: Local
+ *
+ * Rebuild the open addressed name and address tables over if_table,
+ * keeping them at most half full. Interfaces without an address yet are
+ * left out of the address table.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_if_rehash(struct sr_instance* sr)
+{
+    unsigned int size = 8;
+    unsigned int i, slot;
+
+    while(size < 2 * sr->if_count)
+    { size <<= 1; }
+
+    free(sr->if_hash);
+    free(sr->if_ip_hash);
+    sr->if_hash = (unsigned int*)malloc(size * sizeof(unsigned int));
+    sr->if_ip_hash = (unsigned int*)malloc(size * sizeof(unsigned int));
+    assert(sr->if_hash && sr->if_ip_hash);
+    memset(sr->if_hash, 0xff, size * sizeof(unsigned int));
+    memset(sr->if_ip_hash, 0xff, size * sizeof(unsigned int));
+    sr->if_hash_mask = size - 1;
+
+    for(i = 0; i < sr->if_count; i++)
+    {
+        slot = sr_if_name_hash(sr->if_table[i]->name) & sr->if_hash_mask;
+        while(sr->if_hash[slot] != SR_IF_NONE)
+        { slot = (slot + 1) & sr->if_hash_mask; }
+        sr->if_hash[slot] = i;
+
+        if(sr->if_table[i]->ip == 0)
+        { continue; }
+        slot = sr_if_ip_hash(sr->if_table[i]->ip) & sr->if_hash_mask;
+        while(sr->if_ip_hash[slot] != SR_IF_NONE)
+        { slot = (slot + 1) & sr->if_hash_mask; }
+        sr->if_ip_hash[slot] = i;
+    }
+} /* -- sr_if_rehash -- */
+
 /*---------------------------------------------------------------------
  * Method: sr_get_interface
  * Scope: Global
@@ -34,24 +104,48 @@
 
 struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name)
 {
-    struct sr_if* if_walker = 0;
+    struct sr_if* iface = 0;
+    unsigned int slot;
 
     /* -- REQUIRES -- */
     assert(name);
     assert(sr);
 
-    if_walker = sr->if_list;
+    if(!sr->if_hash)
+    { return 0; }
 
-    while(if_walker)
+    slot = sr_if_name_hash(name) & sr->if_hash_mask;
+    while(sr->if_hash[slot] != SR_IF_NONE)
     {
-       if(!strncmp(if_walker->name,name,sr_IFACE_NAMELEN))
-        { return if_walker; }
-        if_walker = if_walker->next;
+        iface = sr->if_table[sr->if_hash[slot]];
+        if(!strncmp(iface->name,name,sr_IFACE_NAMELEN))
+        { return iface; }
+        slot = (slot + 1) & sr->if_hash_mask;
     }
 
     return 0;
 } /* -- sr_get_interface -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_get_interface_by_index
+ * Scope: Global
+ *
+ * Given an interface index return the interface record or 0 if it doesn't
+ * exist.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_if* sr_get_interface_by_index(struct sr_instance* sr, unsigned int index)
+{
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    if(index >= sr->if_count)
+    { return 0; }
+
+    return sr->if_table[index];
+} /* -- sr_get_interface_by_index -- */
+
 /*---------------------------------------------------------------------
  * Method: sr_get_interface_from_ip
  * Scope: Global
@@ -63,18 +157,21 @@ struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name)
 
 struct sr_if *get_interface_from_ip(struct sr_instance *sr, uint32_t ip_address)
 {
-  struct sr_if *cur_iface = sr->if_list;
-  struct sr_if *dest_iface = NULL;
-  while (cur_iface)
+  struct sr_if *cur_iface = NULL;
+  unsigned int slot;
+
+  if (!sr->if_ip_hash || ip_address == 0)
+    return NULL;
+
+  slot = sr_if_ip_hash(ip_address) & sr->if_hash_mask;
+  while (sr->if_ip_hash[slot] != SR_IF_NONE)
   {
+    cur_iface = sr->if_table[sr->if_ip_hash[slot]];
     if (ip_address == cur_iface->ip)
-    {
-      dest_iface = cur_iface;
-      break;
-    }
-    cur_iface = cur_iface->next;
+      return cur_iface;
+    slot = (slot + 1) & sr->if_hash_mask;
   }
-  return dest_iface;
+  return NULL;
 } /* -- sr_get_interface_from_ip -- */
 
 /*---------------------------------------------------------------------
@@ -123,11 +220,18 @@ struct sr_if *get_interface_from_eth(struct sr_instance *sr, uint8_t *eth_addres
 void sr_add_interface(struct sr_instance* sr, const char* name)
 {
     struct sr_if* if_walker = 0;
+    struct sr_if** if_table = 0;
 
     /* -- REQUIRES -- */
     assert(name);
     assert(sr);
 
+    /* -- grow the index table -- */
+    if_table = (struct sr_if**)realloc(sr->if_table,
+            (sr->if_count + 1) * sizeof(struct sr_if*));
+    assert(if_table);
+    sr->if_table = if_table;
+
     /* -- empty list special case -- */
     if(sr->if_list == 0)
     {
@@ -135,6 +239,9 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
         assert(sr->if_list);
         sr->if_list->next = 0;
         strncpy(sr->if_list->name,name,sr_IFACE_NAMELEN);
+        sr->if_list->index = sr->if_count;
+        sr->if_table[sr->if_count++] = sr->if_list;
+        sr_if_rehash(sr);
         return;
     }
 
@@ -148,6 +255,9 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
     if_walker = if_walker->next;
     strncpy(if_walker->name,name,sr_IFACE_NAMELEN);
     if_walker->next = 0;
+    if_walker->index = sr->if_count;
+    sr->if_table[sr->if_count++] = if_walker;
+    sr_if_rehash(sr);
 } /* -- sr_add_interface -- */
 
 /*---------------------------------------------------------------------
@@ -189,12 +299,11 @@ void sr_set_ether_ip(struct sr_instance* sr, uint32_t ip_nbo)
     /* -- REQUIRES -- */
     assert(sr->if_list);
 
-    if_walker = sr->if_list;
-    while(if_walker->next)
-    {if_walker = if_walker->next; }
+    if_walker = sr->if_table[sr->if_count - 1];
 
     /* -- copy address -- */
     if_walker->ip = ip_nbo;
+    sr_if_rehash(sr);
 
 } /* -- sr_set_ether_ip -- */
 
@@ -39,10 +39,14 @@ struct sr_if
   unsigned char addr[ETHER_ADDR_LEN];
   uint32_t ip;
   uint32_t speed;
+  unsigned int index;   /* dense, in order of sr_add_interface */
   struct sr_if* next;
 };
 
+#define SR_IF_NONE 0xffffffff  /* no such interface index */
+
 struct sr_if *sr_get_interface(struct sr_instance* sr, const char* name);
+struct sr_if *sr_get_interface_by_index(struct sr_instance* sr, unsigned int index);
 struct sr_if *get_interface_from_ip(struct sr_instance *, uint32_t);
 struct sr_if *get_interface_from_eth(struct sr_instance *, uint8_t *);
 void sr_add_interface(struct sr_instance*, const char*);
@@ -20,6 +20,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <pwd.h>
+#include <signal.h>
+#include <pthread.h>
 #include <sys/types.h>
 
 #ifdef _LINUX_
@@ -29,6 +31,15 @@
 #include "sr_dumper.h"
 #include "sr_router.h"
 #include "sr_rt.h"
+#include "sr_fib.h"
+#include "sr_pktbuf.h"
+#include "sr_pipeline.h"
+#include "sr_pcap.h"
+#include "sr_filter.h"
+#include "sr_snapshot.h"
+#include "sr_afpacket.h"
+#include "sr_stats.h"
+#include "sr_icmplimit.h"
 
 extern char* optarg;
 
@@ -41,12 +52,18 @@ extern char* optarg;
 #define DEFAULT_SERVER "localhost"
 #define DEFAULT_RTABLE "rtable"
 #define DEFAULT_TOPO 0
+#define RTABLE_PRINT_MAX 256 /* larger tables are only counted */
 
 static void usage(char* );
 static void sr_init_instance(struct sr_instance* );
 static void sr_destroy_instance(struct sr_instance* );
 static void sr_set_user(struct sr_instance* );
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable);
+static void sr_start_reloader(struct sr_instance* sr);
+static void sr_catch_stop(struct sr_instance* sr);
+
+static const char* sr_rt_file = 0; /* last routing table loaded */
+static struct sr_instance* sr_running = 0; /* for the stop handler */
 
 /*-----------------------------------------------------------------------------
  *---------------------------------------------------------------------------*/
@@ -62,11 +79,35 @@ int main(int argc, char **argv)
     unsigned int port = DEFAULT_PORT;
     unsigned int topo = DEFAULT_TOPO;
     char *logfile = 0;
+    unsigned long arpcache_size = 0;
+    unsigned int workers = 0;
+    unsigned int snaplen = 0; /* PACKET_DUMP_SIZE unless -S */
+    char *filter = 0;
+    char *snapshot = 0;
+    char *control = 0;
+    char *end;
+    long value;
+    char *icmp_limit = 0;
+    char filter_err[128];
+    int afpacket = 0;
     struct sr_instance sr;
 
     printf("Using %s\n", VERSION_INFO);
 
-    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:")) != EOF)
+    /* -- SIGHUP and SIGUSR1 are taken by the reloader thread alone, block
+          them in every other thread (they inherit this mask) -- */
+    {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGHUP);
+        sigaddset(&set, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &set, NULL);
+    }
+
+    /* -- zero out sr instance -- */
+    sr_init_instance(&sr);
+
+    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:a:w:S:F:W:i:C:E:")) != EOF)
     {
         switch (c)
         {
@@ -98,11 +139,79 @@ int main(int argc, char **argv)
             case 'T':
                 template = optarg;
                 break;
+            case 'a':
+                arpcache_size = strtoul(optarg, &end, 10);
+                if(*optarg == '-' || *end != 0 || arpcache_size == 0 ||
+                   arpcache_size > SR_ARPCACHE_MAX)
+                {
+                    fprintf(stderr,"Error: -a takes 1 to %u entries\n",
+                            SR_ARPCACHE_MAX);
+                    exit(1);
+                }
+                break;
+            case 'w':
+                value = strtol(optarg, &end, 10);
+                if(end == optarg || *end != 0 || value < 0 ||
+                   value > SR_PIPELINE_MAX_WORKERS)
+                {
+                    fprintf(stderr,"Error: -w takes 0 (inline) to %d workers\n",
+                            SR_PIPELINE_MAX_WORKERS);
+                    usage(argv[0]);
+                    exit(1);
+                }
+                workers = value;
+                break;
+            case 'S':
+                value = strtol(optarg, &end, 10);
+                if(end == optarg || *end != 0 || value < 1 ||
+                   value > SR_PCAP_MAX_SNAPLEN)
+                {
+                    fprintf(stderr,"Error: -S takes 1 to %d bytes\n",
+                            SR_PCAP_MAX_SNAPLEN);
+                    exit(1);
+                }
+                snaplen = value;
+                break;
+            case 'F':
+                filter = optarg;
+                break;
+            case 'W':
+                snapshot = optarg;
+                break;
+            case 'i':
+                if(sr_afpacket_add(&sr, optarg) != 0)
+                { exit(1); }
+                afpacket = 1;
+                break;
+            case 'C':
+                control = optarg;
+                break;
+            case 'E':
+                icmp_limit = optarg;
+                break;
         } /* switch */
     } /* -- while -- */
 
-    /* -- zero out sr instance -- */
-    sr_init_instance(&sr);
+    if((filter || snaplen) && !logfile)
+    {
+        fprintf(stderr,"Error: -S and -F need a log file (-l)\n");
+        exit(1);
+    }
+
+    if(afpacket && template)
+    {
+        fprintf(stderr,"Error: -T needs a VNS server, not -i devices\n");
+        exit(1);
+    }
+
+    /* -- ICMP error rate limits, sr_init sets up the defaults if not
+          given -- */
+    if(icmp_limit && !(sr.icmp_limit =
+                sr_icmplimit_create(icmp_limit, filter_err, sizeof(filter_err))))
+    {
+        fprintf(stderr,"Error in ICMP limits: %s\n", filter_err);
+        exit(1);
+    }
 
     /* -- set up routing table from file -- */
     if(template == NULL) {
@@ -113,6 +222,7 @@ int main(int argc, char **argv)
         strncpy(sr.template, template, 30);
 
     sr.topo_id = topo;
+    sr.arpcache_size = arpcache_size;
     strncpy(sr.host,host,32);
 
     if(! user )
@@ -123,8 +233,17 @@ int main(int argc, char **argv)
     /* -- set up file pointer for logging of raw packets -- */
     if(logfile != 0)
     {
-        sr.logfile = sr_dump_open(logfile,0,PACKET_DUMP_SIZE);
-        if(!sr.logfile)
+        if(filter && !(sr.capture_filter =
+                    sr_filter_compile(filter, filter_err, sizeof(filter_err))))
+        {
+            fprintf(stderr,"Error in capture filter: %s\n", filter_err);
+            exit(1);
+        }
+
+        if(snaplen == 0)
+        { snaplen = PACKET_DUMP_SIZE; }
+        sr.logfile = sr_dump_open(logfile,0,snaplen);
+        if(!sr.logfile || !(sr.pcap = sr_pcap_start(sr.logfile, snaplen)))
         {
             fprintf(stderr,"Error opening up dump file %s\n",
                     logfile);
@@ -132,32 +251,77 @@ int main(int argc, char **argv)
         }
     }
 
-    Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
-    if(template)
-        Debug("Requesting topology template %s\n", template);
-    else
-        Debug("Requesting topology %d\n", topo);
-
-    /* connect to server and negotiate session */
-    if(sr_connect_to_server(&sr,port,server) == -1)
+    if(afpacket)
     {
-        return 1;
+        /* -- local devices stand in for the server's hardware info -- */
+        if(sr_afpacket_open(&sr) != 0)
+        { return 1; }
+        if(sr_verify_routing_table(&sr) != 0)
+        {
+            fprintf(stderr,"Routing table not consistent with hardware\n");
+            return 1;
+        }
     }
+    else
+    {
+        Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
+        if(template)
+            Debug("Requesting topology template %s\n", template);
+        else
+            Debug("Requesting topology %d\n", topo);
+
+        /* connect to server and negotiate session */
+        if(sr_connect_to_server(&sr,port,server) == -1)
+        {
+            return 1;
+        }
 
-    if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
-        Debug("Connected to new instantiation of topology template %s\n", template);
-        sr_load_rt_wrap(&sr, "rtable.vrhost");
+        if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
+            Debug("Connected to new instantiation of topology template %s\n", template);
+            sr_load_rt_wrap(&sr, "rtable.vrhost");
+        }
+        else {
+          /* Read from specified routing table */
+          sr_load_rt_wrap(&sr, rtable);
+        }
     }
-    else {
-      /* Read from specified routing table */
-      sr_load_rt_wrap(&sr, rtable);
+
+    /* -- save the table for a fast restart with -r snapshot -- */
+    if(snapshot && sr_snapshot_write(&sr, snapshot) == 0)
+    {
+        printf("Wrote FIB snapshot of %u routes to %s\n",
+               sr.fib->n_routes, snapshot);
     }
 
     /* call router init (for arp subsystem etc.) */
     sr_init(&sr);
 
+    /* -- hand packets off to worker threads if asked to -- */
+    if(workers > 0 && sr_pipeline_start(&sr, workers) != 0)
+    {
+        return 1;
+    }
+
+    /* -- kill -HUP reloads the routing table, kill -USR1 prints the
+          counters -- */
+    sr_start_reloader(&sr);
+
+    if(control && sr_stats_serve(&sr, control) != 0)
+    {
+        return 1;
+    }
+
     /* -- whizbang main loop ;-) */
-    while( sr_read_from_server(&sr) == 1);
+    if(afpacket)
+    {
+        sr_catch_stop(&sr);
+        printf(" <-- Ready to process packets --> \n");
+        sr_afpacket_run(&sr);
+    }
+    else
+    { while( sr_read_from_server(&sr) == 1); }
+
+    sr_pipeline_stop(&sr);
 
     sr_destroy_instance(&sr);
 
@@ -175,7 +339,12 @@ static void usage(char* argv0)
     printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
     printf("           [-T template_name] [-u username] \n");
     printf("           [-t topo id] [-r routing table] \n");
-    printf("           [-l log file] \n");
+    printf("           [-l log file] [-a arp cache entries] \n");
+    printf("           [-w worker threads] [-S log snaplen] \n");
+    printf("           [-F log filter expression] [-W write FIB snapshot] \n");
+    printf("           [-i device[:ip] ...] (AF_PACKET devices instead of VNS) \n");
+    printf("           [-C control socket] \n");
+    printf("           [-E ICMP error limits, [kind=]rate[/burst],...] \n");
     printf("   defaults server=%s port=%d host=%s  \n",
             DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST );
 } /* -- usage -- */
@@ -219,9 +388,30 @@ static void sr_destroy_instance(struct sr_instance* sr)
 
     if(sr->logfile)
     {
+        sr_pcap_stop(sr->pcap);
+        sr->pcap = 0;
         sr_dump_close(sr->logfile);
     }
 
+    if(sr->capture_filter)
+    {
+        sr_filter_free(sr->capture_filter);
+        sr->capture_filter = 0;
+    }
+
+    sr_stats_print(sr, stderr, SR_STATS_COUNTERS | SR_STATS_LATENCY);
+    sr_pktbuf_print_stats();
+    if(sr->afpacket)
+    { sr_afpacket_close(sr); }
+    else
+    {
+        fprintf(stderr, "server: %lu commands in %lu reads\n",
+                sr->rx_msgs, sr->rx_reads);
+    }
+
+    free(sr->rx_buf);
+    sr->rx_buf = 0;
+
     /*
     fprintf(stderr,"sr_destroy_instance leaking memory\n");
     */
@@ -244,8 +434,26 @@ static void sr_init_instance(struct sr_instance* sr)
     sr->host[0] = 0;
     sr->topo_id = 0;
     sr->if_list = 0;
+    sr->if_table = 0;
+    sr->if_count = 0;
+    sr->if_hash = 0;
+    sr->if_ip_hash = 0;
+    sr->if_hash_mask = 0;
     sr->routing_table = 0;
+    sr->fib = 0;
+    sr->rt_block = 0;
+    sr->fib_gen = 0;
+    sr->arpcache_size = 0;
     sr->logfile = 0;
+    sr->rx_buf = 0;
+    sr->rx_start = sr->rx_end = 0;
+    sr->rx_reads = sr->rx_msgs = 0;
+    sr->pipeline = 0;
+    pthread_mutex_init(&(sr->send_lock), NULL);
+    sr->pcap = 0;
+    sr->capture_filter = 0;
+    sr->afpacket = 0;
+    sr->icmp_limit = 0;
 } /* -- sr_init_instance -- */
 
 /*-----------------------------------------------------------------------------
@@ -266,7 +474,6 @@ static void sr_init_instance(struct sr_instance* sr)
 int sr_verify_routing_table(struct sr_instance* sr)
 {
     struct sr_rt* rt_walker = 0;
-    struct sr_if* if_walker = 0;
     int ret = 0;
 
     /* -- REQUIRES --*/
@@ -281,16 +488,9 @@ int sr_verify_routing_table(struct sr_instance* sr)
 
     while(rt_walker)
     {
-        /* -- check to see if interface exists -- */
-        if_walker = sr->if_list;
-        while(if_walker)
-        {
-            if( strncmp(if_walker->name,rt_walker->interface,sr_IFACE_NAMELEN)
-                    == 0)
-            { break; }
-            if_walker = if_walker->next;
-        }
-        if(if_walker == 0)
+        /* -- check to see if interface exists, entries are bound to
+              their interface by index once the hardware is known -- */
+        if(rt_walker->ifindex == SR_IF_NONE)
         { ret++; } /* -- interface not found! -- */
 
         rt_walker = rt_walker->next;
@@ -300,6 +500,7 @@ int sr_verify_routing_table(struct sr_instance* sr)
 } /* -- sr_verify_routing_table -- */
 
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
+    sr_rt_file = rtable;
     if(sr_load_rt(sr, rtable) != 0) {
         fprintf(stderr,"Error setting up routing table from file %s\n",
                 rtable);
@@ -309,6 +510,91 @@ static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
 
     printf("Loading routing table\n");
     printf("---------------------------------------------\n");
-    sr_print_routing_table(sr);
+    if(sr->fib->n_routes <= RTABLE_PRINT_MAX)
+    { sr_print_routing_table(sr); }
+    else
+    { printf("%u routes\n", sr->fib->n_routes); }
     printf("---------------------------------------------\n");
 }
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_reloader(..)
+ * Scope: Local
+ *
+ * Waits for SIGHUP and reloads the routing table file on this thread, so
+ * parsing and building the new FIB never stall packet handling. SIGUSR1
+ * prints the counters.
+ *
+ *----------------------------------------------------------------------------*/
+
+static void* sr_reloader(void* arg)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    sigset_t set;
+    int sig;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    sigaddset(&set, SIGUSR1);
+
+    while(1)
+    {
+        if(sigwait(&set, &sig) != 0)
+        { continue; }
+
+        if(sig == SIGUSR1)
+        {
+            sr_stats_print(sr, stderr, SR_STATS_COUNTERS | SR_STATS_LATENCY);
+            continue;
+        }
+
+        if(sr_load_rt(sr, sr_rt_file) == 0)
+        {
+            fprintf(stderr, "Reloaded routing table from %s (%u routes)\n",
+                    sr_rt_file, sr->fib->n_routes);
+        }
+        else
+        {
+            fprintf(stderr, "Error reloading routing table from %s, "
+                    "keeping the current one\n", sr_rt_file);
+        }
+    }
+
+    return NULL;
+} /* -- sr_reloader -- */
+
+static void sr_start_reloader(struct sr_instance* sr)
+{
+    pthread_t thread;
+
+    if(pthread_create(&thread, NULL, sr_reloader, sr) != 0)
+    { perror("pthread_create(..):sr_start_reloader"); }
+    else
+    { pthread_detach(thread); }
+} /* -- sr_start_reloader -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_catch_stop(..)
+ * Scope: Local
+ *
+ * Without a server to close the session, SIGINT and SIGTERM end the
+ * AF_PACKET loop so the instance is torn down and its counters printed.
+ *
+ *----------------------------------------------------------------------------*/
+
+static void sr_stop_handler(int sig)
+{
+    sr_afpacket_stop(sr_running);
+} /* -- sr_stop_handler -- */
+
+static void sr_catch_stop(struct sr_instance* sr)
+{
+    struct sigaction sa;
+
+    sr_running = sr;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sr_stop_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+} /* -- sr_catch_stop -- */
@@ -0,0 +1,104 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_nexthop.c
+ *
+ * Description:
+ *
+ * Per-thread next-hop cache, see sr_nexthop.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_arpcache.h"
+#include "sr_epoch.h"
+#include "sr_nexthop.h"
+
+struct sr_nexthop_slot
+{
+    uint32_t dst;           /* key, 0 when empty */
+    uint32_t fib_gen;
+    uint32_t arp_gen;
+    uint16_t npaths;        /* in dst's ECMP group */
+    uint16_t valid;         /* bit k set when nh[k] is */
+    struct sr_nexthop nh[SR_NEXTHOP_PATHS];
+};
+
+static __thread struct sr_nexthop_slot sr_nexthop_cache[SR_NEXTHOP_SLOTS];
+
+/*---------------------------------------------------------------------
+ * Method: sr_nexthop_resolve(..)
+ * Scope:  Global
+ *
+ * Resolve dst (nbo) to its next hop for a packet with flow hash flow.
+ * Only complete resolutions are cached: unresolved next hops must go
+ * through the ARP request queue every time. The route is only used
+ * inside an epoch section, so a concurrent reload cannot free it from
+ * under us.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_nexthop_resolve(struct sr_instance* sr, uint32_t dst, uint32_t flow,
+                       struct sr_nexthop* nh)
+{
+    struct sr_nexthop_slot* slot =
+        &sr_nexthop_cache[((dst * 0x9e3779b1u) >> 16) & (SR_NEXTHOP_SLOTS - 1)];
+    uint32_t fib_gen = __atomic_load_n(&(sr->fib_gen), __ATOMIC_ACQUIRE);
+    uint32_t arp_gen = sr_arpcache_generation(&(sr->cache));
+    struct sr_rt* rt;
+    struct sr_if* iface = 0;
+    unsigned int npaths = 0, k = 0;
+
+    if (slot->dst == dst && dst != 0 &&
+        slot->fib_gen == fib_gen && slot->arp_gen == arp_gen)
+    {
+        k = sr_rt_ecmp_index(flow, slot->npaths);
+        if (slot->valid & (1u << k))
+        {
+            *nh = slot->nh[k];
+            return SR_NEXTHOP_OK;
+        }
+    }
+
+    sr_epoch_enter();
+    if ((rt = sr_get_longest_prefix_match(sr, dst)) != 0)
+    {
+        npaths = rt->ecmp_n;
+        k = sr_rt_ecmp_index(flow, npaths);
+        rt = sr_rt_ecmp_path(rt, flow);
+        iface = sr_get_interface_by_index(sr, rt->ifindex);
+        nh->gw = rt->gw.s_addr;
+    }
+    sr_epoch_exit();
+
+    if (!rt)
+    { return SR_NEXTHOP_NOROUTE; }
+    if (!iface)
+    { return SR_NEXTHOP_NOIFACE; }
+
+    nh->ifindex = iface->index;
+    memcpy(nh->smac, iface->addr, ETHER_ADDR_LEN);
+
+    if (!sr_arpcache_lookup_mac(&(sr->cache), nh->gw, nh->dmac))
+    { return SR_NEXTHOP_UNRESOLVED; }
+
+    /* -- a write in progress when we started: don't trust the stamp -- */
+    if (!(arp_gen & 1) && npaths <= SR_NEXTHOP_PATHS)
+    {
+        if (slot->dst != dst || slot->fib_gen != fib_gen ||
+            slot->arp_gen != arp_gen || slot->npaths != npaths)
+        {
+            slot->dst = dst;
+            slot->fib_gen = fib_gen;
+            slot->arp_gen = arp_gen;
+            slot->npaths = npaths;
+            slot->valid = 0;
+        }
+        slot->nh[k] = *nh;
+        slot->valid |= 1u << k;
+    }
+
+    return SR_NEXTHOP_OK;
+} /* -- sr_nexthop_resolve -- */
@@ -0,0 +1,52 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_nexthop.h
+ * Description:
+ *
+ * Next-hop resolution with a per-thread cache. Resolving a destination
+ * takes a FIB lookup, an interface lookup and an ARP lookup; the result
+ * (egress interface and both MAC addresses) is remembered in a small
+ * direct mapped table keyed by destination, so repeat packets to a hot
+ * destination cost one hashed probe.
+ *
+ * For an ECMP route the path is picked by the flow hash of the packet
+ * (see flow_hash in sr_utils.h), and each of the first SR_NEXTHOP_PATHS
+ * paths is cached separately under the destination's entry.
+ *
+ * Entries are stamped with the routing table generation (sr->fib_gen) and
+ * the ARP cache generation (sr_arpcache_generation) they were resolved
+ * under, and are ignored once either has moved on. Invalidation is thus
+ * coarse, any change to either table drops every cached next hop, but
+ * needs no coordination with the threads holding caches.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_NEXTHOP_H
+#define sr_NEXTHOP_H
+
+#include <stdint.h>
+
+#include "sr_protocol.h"
+
+#define SR_NEXTHOP_SLOTS  256   /* per thread, power of 2 */
+#define SR_NEXTHOP_PATHS  4     /* ECMP paths cached per destination */
+
+/* sr_nexthop_resolve results */
+#define SR_NEXTHOP_OK          0   /* all fields valid */
+#define SR_NEXTHOP_NOROUTE     1   /* no matching route */
+#define SR_NEXTHOP_NOIFACE     2   /* route names an unknown interface */
+#define SR_NEXTHOP_UNRESOLVED  3   /* gw and ifindex valid, no ARP entry */
+
+struct sr_instance;
+
+struct sr_nexthop
+{
+    uint32_t gw;                          /* next hop IP, nbo */
+    unsigned int ifindex;                 /* egress interface */
+    unsigned char smac[ETHER_ADDR_LEN];   /* egress interface's MAC */
+    unsigned char dmac[ETHER_ADDR_LEN];   /* next hop's MAC */
+};
+
+int sr_nexthop_resolve(struct sr_instance* sr, uint32_t dst, uint32_t flow,
+                       struct sr_nexthop* nh);
+
+#endif  /* --  sr_NEXTHOP_H -- */
@@ -0,0 +1,248 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pcap.c
+ *
+ * Description:
+ *
+ * Capture ring and writer thread, see sr_pcap.h.
+ *
+ * Slot i of the ring starts with seq == i. A producer claims position pos
+ * when the slot there has seq == pos, fills it and publishes it with
+ * seq = pos + 1; the writer consumes it and hands it back for the next lap
+ * with seq = pos + SR_PCAP_SLOTS. A slot still holding an older lap means
+ * the ring is full.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "sr_dumper.h"
+#include "sr_pcap.h"
+
+struct sr_pcap_slot
+{
+    uint32_t seq;
+    uint32_t len;           /* on the wire */
+    uint32_t caplen;        /* stored in data */
+    struct timeval ts;
+    uint8_t data[];
+};
+
+struct sr_pcap
+{
+    uint32_t enqueue_pos __attribute__ ((aligned (64)));
+    uint32_t dequeue_pos __attribute__ ((aligned (64)));
+    unsigned long drops __attribute__ ((aligned (64)));
+    unsigned long written;
+    int stop;
+
+    unsigned int snaplen;
+    size_t stride;
+    uint8_t* slots;
+    FILE* fp;
+    char* fbuf;             /* records waiting to be written */
+    size_t fused;
+    pthread_t thread;
+};
+
+static struct sr_pcap_slot* sr_pcap_slot(struct sr_pcap* pcap, uint32_t pos)
+{
+    return (struct sr_pcap_slot*)
+        (pcap->slots + (pos & (SR_PCAP_SLOTS - 1)) * pcap->stride);
+} /* -- sr_pcap_slot -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pcap_flush(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_pcap_flush(struct sr_pcap* pcap)
+{
+    if (pcap->fused == 0)
+    { return; }
+
+    if (fwrite(pcap->fbuf, pcap->fused, 1, pcap->fp) != 1)
+    { perror("fwrite(..):sr_pcap_flush"); }
+    fflush(pcap->fp);
+    pcap->fused = 0;
+} /* -- sr_pcap_flush -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pcap_drain(..)
+ * Scope:  Local
+ *
+ * Append every published slot to the write buffer, in the format
+ * sr_dump uses, writing the buffer out whenever it fills. Returns the
+ * number of frames taken.
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned int sr_pcap_drain(struct sr_pcap* pcap)
+{
+    struct sr_pcap_slot* slot;
+    struct pcap_sf_pkthdr h;
+    unsigned int n = 0;
+
+    while (1)
+    {
+        slot = sr_pcap_slot(pcap, pcap->dequeue_pos);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pcap->dequeue_pos + 1)
+        { break; }
+
+        if (pcap->fused + sizeof(h) + slot->caplen > SR_PCAP_BUFSIZE)
+        { sr_pcap_flush(pcap); }
+
+        h.ts.tv_sec  = slot->ts.tv_sec;
+        h.ts.tv_usec = slot->ts.tv_usec;
+        h.caplen     = slot->caplen;
+        h.len        = slot->len;
+        memcpy(pcap->fbuf + pcap->fused, &h, sizeof(h));
+        memcpy(pcap->fbuf + pcap->fused + sizeof(h), slot->data, slot->caplen);
+        pcap->fused += sizeof(h) + slot->caplen;
+
+        __atomic_store_n(&slot->seq, pcap->dequeue_pos + SR_PCAP_SLOTS,
+                __ATOMIC_RELEASE);
+        pcap->dequeue_pos++;
+        n++;
+    }
+
+    pcap->written += n;
+    return n;
+} /* -- sr_pcap_drain -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pcap_writer(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_pcap_writer(void* arg)
+{
+    struct sr_pcap* pcap = (struct sr_pcap*)arg;
+
+    while (!__atomic_load_n(&pcap->stop, __ATOMIC_ACQUIRE))
+    {
+        if (sr_pcap_drain(pcap))
+        { continue; }
+
+        /* -- idle: push what we have to the file, then wait a bit -- */
+        sr_pcap_flush(pcap);
+        usleep(SR_PCAP_IDLE_US);
+    }
+
+    sr_pcap_drain(pcap);
+    sr_pcap_flush(pcap);
+    return NULL;
+} /* -- sr_pcap_writer -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pcap_start(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_pcap* sr_pcap_start(FILE* fp, unsigned int snaplen)
+{
+    struct sr_pcap* pcap;
+    uint32_t i;
+
+    if (snaplen == 0 || snaplen > SR_PCAP_MAX_SNAPLEN)
+    { snaplen = SR_PCAP_MAX_SNAPLEN; }
+
+    if ((pcap = (struct sr_pcap*)calloc(1, sizeof(*pcap))) == 0)
+    { return 0; }
+
+    pcap->snaplen = snaplen;
+    pcap->stride = (sizeof(struct sr_pcap_slot) + snaplen + 15) & ~(size_t)15;
+    pcap->slots = (uint8_t*)malloc(SR_PCAP_SLOTS * pcap->stride);
+    pcap->fbuf = (char*)malloc(SR_PCAP_BUFSIZE);
+    pcap->fp = fp;
+    if (!pcap->slots || !pcap->fbuf)
+    { goto fail; }
+
+    for (i = 0; i < SR_PCAP_SLOTS; i++)
+    { sr_pcap_slot(pcap, i)->seq = i; }
+
+    fflush(fp);
+
+    if (pthread_create(&pcap->thread, NULL, sr_pcap_writer, pcap))
+    {
+        perror("pthread_create(..):sr_pcap_start");
+        goto fail;
+    }
+
+    return pcap;
+
+fail:
+    free(pcap->slots);
+    free(pcap->fbuf);
+    free(pcap);
+    return 0;
+} /* -- sr_pcap_start -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pcap_log(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pcap_log(struct sr_pcap* pcap, const uint8_t* buf, unsigned int len)
+{
+    struct sr_pcap_slot* slot;
+    uint32_t pos = __atomic_load_n(&pcap->enqueue_pos, __ATOMIC_RELAXED);
+    int32_t diff;
+
+    while (1)
+    {
+        slot = sr_pcap_slot(pcap, pos);
+        diff = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&pcap->enqueue_pos, &pos, pos + 1,
+                        1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            { break; }
+        }
+        else if (diff < 0)
+        {
+            __atomic_fetch_add(&pcap->drops, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+        { pos = __atomic_load_n(&pcap->enqueue_pos, __ATOMIC_RELAXED); }
+    }
+
+    gettimeofday(&slot->ts, 0);
+    slot->len = len;
+    slot->caplen = min(len, pcap->snaplen);
+    memcpy(slot->data, buf, slot->caplen);
+
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+} /* -- sr_pcap_log -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pcap_stop(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pcap_stop(struct sr_pcap* pcap)
+{
+    if (!pcap)
+    { return; }
+
+    __atomic_store_n(&pcap->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(pcap->thread, NULL);
+
+    fprintf(stderr, "packet log: %lu frames written, %lu dropped\n",
+            pcap->written, pcap->drops);
+
+    free(pcap->slots);
+    free(pcap->fbuf);
+    free(pcap);
+} /* -- sr_pcap_stop -- */
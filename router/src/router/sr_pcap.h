@@ -0,0 +1,38 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pcap.h
+ * Description:
+ *
+ * Asynchronous packet capture for the -l log file. Threads logging a frame
+ * only copy its first snaplen bytes into a slot of a bounded lock-free ring
+ * (a multi-producer queue with per-slot sequence numbers); a writer thread
+ * drains the ring into a large buffer, writes it out when full and flushes
+ * the file whenever it runs idle. If the ring is full the frame is not logged
+ * and a drop counter is bumped instead: capture never stalls forwarding.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_PCAP_H
+#define sr_PCAP_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define SR_PCAP_SLOTS       4096        /* frames in flight, power of 2 */
+#define SR_PCAP_BUFSIZE     (1 << 20)   /* bytes per write to the dump file */
+#define SR_PCAP_IDLE_US     1000        /* writer poll interval when idle */
+#define SR_PCAP_MAX_SNAPLEN 65535
+
+struct sr_pcap;
+
+/* Starts a writer for fp, which must have been opened with sr_dump_open
+   for the same snaplen. Returns NULL on failure. */
+struct sr_pcap* sr_pcap_start(FILE* fp, unsigned int snaplen);
+
+/* Queues a frame for logging. Safe to call from any thread. */
+void sr_pcap_log(struct sr_pcap* pcap, const uint8_t* buf, unsigned int len);
+
+/* Writes out what is queued, stops the writer and prints its counters.
+   fp is left open. */
+void sr_pcap_stop(struct sr_pcap* pcap);
+
+#endif  /* --  sr_PCAP_H -- */
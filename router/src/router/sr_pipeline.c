@@ -0,0 +1,284 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pipeline.c
+ *
+ * Description:
+ *
+ * Reader to worker hand-off, see sr_pipeline.h.
+ *
+ * Each ring has one producer (the reader) and one consumer (its worker).
+ * head and tail are free running counters on separate cache lines; the
+ * producer also keeps its own copy of tail so it only touches the
+ * consumer's line when the ring looks full. An idle worker spins briefly,
+ * then publishes sleeping and waits on its condition variable. Both sides
+ * use sequentially consistent accesses for head and sleeping, so either
+ * the producer sees sleeping and signals, or the worker sees the new head
+ * and does not wait.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_pktbuf.h"
+#include "sr_pipeline.h"
+#include "sr_stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SR_CPU_RELAX() __builtin_ia32_pause()
+#else
+#define SR_CPU_RELAX() do{}while(0)
+#endif
+
+/* Header of a queued frame, at the start of a packet buffer */
+struct sr_pipeline_item
+{
+    unsigned int len;
+    char iface[sr_IFACE_NAMELEN];
+} __attribute__ ((aligned (16)));
+
+struct sr_pipeline_worker
+{
+    /* -- consumer side -- */
+    uint32_t tail __attribute__ ((aligned (64)));
+    int sleeping;
+    unsigned long handled;
+
+    /* -- producer side -- */
+    uint32_t head __attribute__ ((aligned (64)));
+    uint32_t cached_tail;
+    unsigned long stalls;
+    unsigned long drops;
+
+    struct sr_pipeline_item* ring[SR_PIPELINE_RING_SIZE]
+        __attribute__ ((aligned (64)));
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    struct sr_instance* sr;
+};
+
+struct sr_pipeline
+{
+    unsigned int nworkers;
+    int stop;
+    struct sr_pipeline_worker* workers;
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_pop(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_pipeline_item* sr_pipeline_pop(struct sr_pipeline_worker* w)
+{
+    uint32_t tail = w->tail;
+    struct sr_pipeline_item* item;
+
+    if (__atomic_load_n(&w->head, __ATOMIC_ACQUIRE) == tail)
+    { return 0; }
+
+    item = w->ring[tail & (SR_PIPELINE_RING_SIZE - 1)];
+    __atomic_store_n(&w->tail, tail + 1, __ATOMIC_RELEASE);
+    return item;
+} /* -- sr_pipeline_pop -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_worker(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_pipeline_worker(void* arg)
+{
+    struct sr_pipeline_worker* w = (struct sr_pipeline_worker*)arg;
+    struct sr_pipeline* pl = w->sr->pipeline;
+    struct sr_pipeline_item* item;
+    unsigned int spins = 0;
+
+    while (1)
+    {
+        if ((item = sr_pipeline_pop(w)) != 0)
+        {
+            sr_handlepacket(w->sr, (uint8_t*)(item + 1), item->len, item->iface);
+            sr_pktbuf_free(item);
+            w->handled++;
+            spins = 0;
+            continue;
+        }
+
+        /* -- on stop, drain what the reader queued before quitting -- */
+        if (__atomic_load_n(&pl->stop, __ATOMIC_ACQUIRE))
+        {
+            if (__atomic_load_n(&w->head, __ATOMIC_ACQUIRE) == w->tail)
+            { break; }
+            continue;
+        }
+
+        if (++spins < SR_PIPELINE_SPIN)
+        {
+            SR_CPU_RELAX();
+            continue;
+        }
+
+        pthread_mutex_lock(&w->lock);
+        __atomic_store_n(&w->sleeping, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&w->head, __ATOMIC_SEQ_CST) == w->tail &&
+               !__atomic_load_n(&pl->stop, __ATOMIC_SEQ_CST))
+        { pthread_cond_wait(&w->wake, &w->lock); }
+        __atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&w->lock);
+        spins = 0;
+    }
+
+    return NULL;
+} /* -- sr_pipeline_worker -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_start(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_pipeline_start(struct sr_instance* sr, unsigned int nworkers)
+{
+    struct sr_pipeline* pl;
+    void* mem;
+    unsigned int i;
+
+    if (nworkers == 0 || nworkers > SR_PIPELINE_MAX_WORKERS)
+    {
+        fprintf(stderr, "Error: worker count must be 1..%d\n",
+                SR_PIPELINE_MAX_WORKERS);
+        return -1;
+    }
+
+    if ((pl = (struct sr_pipeline*)calloc(1, sizeof(*pl))) == 0)
+    { return -1; }
+    if (posix_memalign(&mem, 64, nworkers * sizeof(struct sr_pipeline_worker)))
+    {
+        free(pl);
+        return -1;
+    }
+    memset(mem, 0, nworkers * sizeof(struct sr_pipeline_worker));
+    pl->workers = (struct sr_pipeline_worker*)mem;
+    pl->nworkers = nworkers;
+    sr->pipeline = pl;
+
+    for (i = 0; i < nworkers; i++)
+    {
+        struct sr_pipeline_worker* w = &pl->workers[i];
+
+        w->sr = sr;
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->wake, NULL);
+        if (pthread_create(&w->thread, &(sr->attr), sr_pipeline_worker, w))
+        {
+            perror("pthread_create(..):sr_pipeline_start");
+            pl->nworkers = i;
+            sr_pipeline_stop(sr);
+            return -1;
+        }
+    }
+
+    return 0;
+} /* -- sr_pipeline_start -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_dispatch(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pipeline_dispatch(struct sr_instance* sr,
+                          uint8_t* packet /* lent */,
+                          unsigned int len,
+                          const char* interface /* lent */)
+{
+    struct sr_pipeline* pl = sr->pipeline;
+    struct sr_pipeline_worker* w;
+    struct sr_pipeline_item* item;
+    uint32_t head;
+
+    w = &pl->workers[flow_hash(packet, len) % pl->nworkers];
+    head = w->head;
+
+    /* -- ring full: wait for the worker, which in turn stops us reading
+          the socket and pushes back on the server through TCP -- */
+    while (head - w->cached_tail == SR_PIPELINE_RING_SIZE)
+    {
+        w->cached_tail = __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE);
+        if (head - w->cached_tail == SR_PIPELINE_RING_SIZE)
+        {
+            w->stalls++;
+            sched_yield();
+        }
+    }
+
+    item = (struct sr_pipeline_item*)sr_pktbuf_alloc(sizeof(*item) + len);
+    if (!item)
+    {
+        w->drops++;
+        sr_stats_count(SR_STATS_DROP_NOMEM);
+        return;
+    }
+    item->len = len;
+    strncpy(item->iface, interface, sr_IFACE_NAMELEN - 1);
+    item->iface[sr_IFACE_NAMELEN - 1] = 0;
+    memcpy(item + 1, packet, len);
+
+    w->ring[head & (SR_PIPELINE_RING_SIZE - 1)] = item;
+    __atomic_store_n(&w->head, head + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&w->sleeping, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->wake);
+        pthread_mutex_unlock(&w->lock);
+    }
+} /* -- sr_pipeline_dispatch -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_stop(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pipeline_stop(struct sr_instance* sr)
+{
+    struct sr_pipeline* pl = sr->pipeline;
+    unsigned int i;
+
+    if (!pl)
+    { return; }
+
+    __atomic_store_n(&pl->stop, 1, __ATOMIC_SEQ_CST);
+
+    for (i = 0; i < pl->nworkers; i++)
+    {
+        struct sr_pipeline_worker* w = &pl->workers[i];
+
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->wake);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, NULL);
+
+        fprintf(stderr, "worker %u: %lu packets handled, %lu dropped, "
+                "%lu reader stalls\n", i, w->handled, w->drops, w->stalls);
+
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->wake);
+    }
+
+    free(pl->workers);
+    free(pl);
+    sr->pipeline = 0;
+} /* -- sr_pipeline_stop -- */
@@ -0,0 +1,48 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pipeline.h
+ * Description:
+ *
+ * Multi-core forwarding. With -w N the thread reading from the server no
+ * longer handles packets itself: it copies each frame into a packet buffer
+ * and pushes it onto the single-producer/single-consumer ring of one of N
+ * worker threads, which run sr_handlepacket. The worker is picked by a hash
+ * of the IPv4 5-tuple (3-tuple for fragments) so the packets of a flow are
+ * handled in order by the same thread. Non-IP frames go to worker 0.
+ *
+ * Workers share the routing state read-mostly: the FIB is immutable once
+ * built (a reload swaps in a new one) and ARP lookups are lock-free.
+ * Sends to the server are serialized by sr->send_lock.
+ *
+ * When a worker's ring is full the reader waits for it rather than drop:
+ * the server connection is a TCP stream, so the stall pushes back on the
+ * sender. Packets are only dropped if no buffer can be allocated.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_PIPELINE_H
+#define sr_PIPELINE_H
+
+#include <stdint.h>
+
+#define SR_PIPELINE_MAX_WORKERS  64
+#define SR_PIPELINE_RING_SIZE    1024  /* frames per worker, power of 2 */
+#define SR_PIPELINE_SPIN         256   /* empty polls before sleeping */
+
+struct sr_instance;
+struct sr_pipeline;
+
+/* Starts nworkers worker threads. Returns 0 on success. */
+int  sr_pipeline_start(struct sr_instance* sr, unsigned int nworkers);
+
+/* Hands a received frame to its worker. The frame is copied, so the
+   caller keeps ownership of packet and interface. */
+void sr_pipeline_dispatch(struct sr_instance* sr,
+                          uint8_t* packet /* lent */,
+                          unsigned int len,
+                          const char* interface /* lent */);
+
+/* Lets the workers drain their rings, joins them and prints their
+   counters. */
+void sr_pipeline_stop(struct sr_instance* sr);
+
+#endif  /* --  sr_PIPELINE_H -- */
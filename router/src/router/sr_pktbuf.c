@@ -0,0 +1,232 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pktbuf.c
+ *
+ * Description:
+ *
+ * Packet buffer pool, see sr_pktbuf.h. Every buffer is preceded by a small
+ * header recording whether it came from the pool, which is what lets
+ * sr_pktbuf_free take any buffer sr_pktbuf_alloc handed out.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "sr_pktbuf.h"
+
+struct sr_pktbuf_hdr
+{
+    struct sr_pktbuf_hdr* next;    /* freelist link while free */
+    uint32_t pooled;               /* 0 if this buffer came from malloc */
+} __attribute__ ((aligned (16)));
+
+/* Per thread state. Counters are only written by the owning thread and
+   read racily when stats are summed. */
+struct sr_pktbuf_local
+{
+    struct sr_pktbuf_hdr* head;
+    unsigned int count;
+    struct sr_pktbuf_stats stats;
+    struct sr_pktbuf_local* next_local;  /* registry of all threads */
+};
+
+static pthread_mutex_t sr_pktbuf_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sr_pktbuf_hdr* sr_pktbuf_shared = 0;
+static struct sr_pktbuf_local* sr_pktbuf_locals = 0;
+
+static __thread struct sr_pktbuf_local* sr_pktbuf_self = 0;
+
+#define SR_PKTBUF_STRIDE (sizeof(struct sr_pktbuf_hdr) + SR_PKTBUF_SIZE)
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktbuf_local(..)
+ * Scope:  Local
+ *
+ * The calling thread's freelist, registered on first use.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_pktbuf_local* sr_pktbuf_local(void)
+{
+    struct sr_pktbuf_local* local = sr_pktbuf_self;
+
+    if (local)
+    { return local; }
+
+    if ((local = (struct sr_pktbuf_local*)calloc(1, sizeof(*local))) == 0)
+    { return 0; }
+
+    pthread_mutex_lock(&sr_pktbuf_lock);
+    local->next_local = sr_pktbuf_locals;
+    sr_pktbuf_locals = local;
+    pthread_mutex_unlock(&sr_pktbuf_lock);
+
+    sr_pktbuf_self = local;
+    return local;
+} /* -- sr_pktbuf_local -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktbuf_refill(..)
+ * Scope:  Local
+ *
+ * Move up to SR_PKTBUF_BATCH buffers from the shared list to the local
+ * one, carving a new slab if the shared list is empty.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_pktbuf_refill(struct sr_pktbuf_local* local)
+{
+    struct sr_pktbuf_hdr* hdr;
+    int i;
+
+    pthread_mutex_lock(&sr_pktbuf_lock);
+
+    if (!sr_pktbuf_shared)
+    {
+        uint8_t* slab = (uint8_t*)malloc(SR_PKTBUF_SLAB * SR_PKTBUF_STRIDE);
+        if (slab)
+        {
+            for (i = 0; i < SR_PKTBUF_SLAB; i++)
+            {
+                hdr = (struct sr_pktbuf_hdr*)(slab + i * SR_PKTBUF_STRIDE);
+                hdr->pooled = 1;
+                hdr->next = sr_pktbuf_shared;
+                sr_pktbuf_shared = hdr;
+            }
+            local->stats.slabs++;
+        }
+    }
+
+    for (i = 0; i < SR_PKTBUF_BATCH && sr_pktbuf_shared; i++)
+    {
+        hdr = sr_pktbuf_shared;
+        sr_pktbuf_shared = hdr->next;
+        hdr->next = local->head;
+        local->head = hdr;
+        local->count++;
+    }
+
+    pthread_mutex_unlock(&sr_pktbuf_lock);
+} /* -- sr_pktbuf_refill -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktbuf_alloc(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+uint8_t* sr_pktbuf_alloc(unsigned int len)
+{
+    struct sr_pktbuf_local* local = sr_pktbuf_local();
+    struct sr_pktbuf_hdr* hdr;
+
+    if (local && len <= SR_PKTBUF_SIZE)
+    {
+        if (!local->head)
+        { sr_pktbuf_refill(local); }
+
+        if ((hdr = local->head) != 0)
+        {
+            local->head = hdr->next;
+            local->count--;
+            local->stats.hits++;
+            return (uint8_t*)(hdr + 1);
+        }
+    }
+
+    /* -- oversized, or no memory for a new slab -- */
+    if ((hdr = (struct sr_pktbuf_hdr*)malloc(sizeof(*hdr) + len)) == 0)
+    { return 0; }
+    hdr->pooled = 0;
+    if (local)
+    { local->stats.misses++; }
+
+    return (uint8_t*)(hdr + 1);
+} /* -- sr_pktbuf_alloc -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktbuf_free(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pktbuf_free(void* buf)
+{
+    struct sr_pktbuf_local* local;
+    struct sr_pktbuf_hdr* hdr;
+    struct sr_pktbuf_hdr* batch;
+    struct sr_pktbuf_hdr* tail;
+    int i;
+
+    if (!buf)
+    { return; }
+
+    hdr = ((struct sr_pktbuf_hdr*)buf) - 1;
+    if (!hdr->pooled || (local = sr_pktbuf_local()) == 0)
+    {
+        if (hdr->pooled)
+        { /* -- no thread state: hand it straight back -- */
+            pthread_mutex_lock(&sr_pktbuf_lock);
+            hdr->next = sr_pktbuf_shared;
+            sr_pktbuf_shared = hdr;
+            pthread_mutex_unlock(&sr_pktbuf_lock);
+        }
+        else
+        { free(hdr); }
+        return;
+    }
+
+    hdr->next = local->head;
+    local->head = hdr;
+    local->count++;
+    local->stats.frees++;
+
+    if (local->count <= SR_PKTBUF_LOCAL_MAX)
+    { return; }
+
+    /* -- overflow: return a batch to the shared list -- */
+    batch = tail = local->head;
+    for (i = 1; i < SR_PKTBUF_BATCH; i++)
+    { tail = tail->next; }
+    local->head = tail->next;
+    local->count -= SR_PKTBUF_BATCH;
+
+    pthread_mutex_lock(&sr_pktbuf_lock);
+    tail->next = sr_pktbuf_shared;
+    sr_pktbuf_shared = batch;
+    pthread_mutex_unlock(&sr_pktbuf_lock);
+} /* -- sr_pktbuf_free -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktbuf_get_stats(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pktbuf_get_stats(struct sr_pktbuf_stats* stats)
+{
+    struct sr_pktbuf_local* local;
+
+    stats->hits = stats->misses = stats->slabs = stats->frees = 0;
+
+    pthread_mutex_lock(&sr_pktbuf_lock);
+    for (local = sr_pktbuf_locals; local; local = local->next_local)
+    {
+        stats->hits   += local->stats.hits;
+        stats->misses += local->stats.misses;
+        stats->slabs  += local->stats.slabs;
+        stats->frees  += local->stats.frees;
+    }
+    pthread_mutex_unlock(&sr_pktbuf_lock);
+} /* -- sr_pktbuf_get_stats -- */
+
+void sr_pktbuf_print_stats(void)
+{
+    struct sr_pktbuf_stats stats;
+
+    sr_pktbuf_get_stats(&stats);
+    fprintf(stderr, "packet buffers: %lu pool hits, %lu heap misses, "
+            "%lu slabs (%d buffers each)\n",
+            stats.hits, stats.misses, stats.slabs, SR_PKTBUF_SLAB);
+} /* -- sr_pktbuf_print_stats -- */
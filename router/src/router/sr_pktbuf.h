@@ -0,0 +1,45 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pktbuf.h
+ * Description:
+ *
+ * Pool of MTU sized packet buffers for frames the router builds or holds on
+ * to (ICMP replies and errors, ARP requests and replies, packets queued on
+ * an ARP request). Each thread keeps a private freelist of up to
+ * SR_PKTBUF_LOCAL_MAX buffers and trades batches with a shared freelist
+ * only when it runs dry or overflows, so the common alloc/free pair takes
+ * no lock. Buffers may be freed by a different thread than allocated them.
+ *
+ * Requests larger than SR_PKTBUF_SIZE are served from the heap and counted
+ * as misses.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_PKTBUF_H
+#define sr_PKTBUF_H
+
+#include <stdint.h>
+
+#define SR_PKTBUF_SIZE       2048  /* usable bytes in a pooled buffer */
+#define SR_PKTBUF_SLAB       64    /* buffers carved from one allocation */
+#define SR_PKTBUF_LOCAL_MAX  128   /* buffers cached per thread */
+#define SR_PKTBUF_BATCH      32    /* buffers moved to/from the shared list */
+
+struct sr_pktbuf_stats
+{
+    unsigned long hits;     /* allocations served from the pool */
+    unsigned long misses;   /* oversized allocations served by malloc */
+    unsigned long slabs;    /* slabs carved since start */
+    unsigned long frees;
+};
+
+/* Returns a buffer of at least len bytes, or NULL if out of memory. */
+uint8_t* sr_pktbuf_alloc(unsigned int len);
+
+/* Returns buf (from sr_pktbuf_alloc, or NULL) to the pool. */
+void sr_pktbuf_free(void* buf);
+
+/* Sums the per-thread counters. */
+void sr_pktbuf_get_stats(struct sr_pktbuf_stats* stats);
+void sr_pktbuf_print_stats(void);
+
+#endif  /* --  sr_PKTBUF_H -- */
@@ -17,10 +17,15 @@
  
  #include "sr_if.h"
  #include "sr_rt.h"
+ #include "sr_fib.h"
  #include "sr_router.h"
  #include "sr_protocol.h"
  #include "sr_arpcache.h"
  #include "sr_utils.h"
+ #include "sr_pktbuf.h"
+ #include "sr_nexthop.h"
+ #include "sr_stats.h"
+ #include "sr_icmplimit.h"
  
  /*---------------------------------------------------------------------
   * Method: sr_init(void)
@@ -36,7 +41,11 @@
      assert(sr);
  
      /* Initialize cache and cache cleanup thread */
-     sr_arpcache_init(&(sr->cache));
+     if (sr_arpcache_init(&(sr->cache), sr->arpcache_size) != 0) {
+         fprintf(stderr, "Error: cannot allocate an ARP cache of %u entries\n",
+                 sr->arpcache_size ? sr->arpcache_size : SR_ARPCACHE_SZ);
+         exit(1);
+     }
  
      pthread_attr_init(&(sr->attr));
      pthread_attr_setdetachstate(&(sr->attr), PTHREAD_CREATE_JOINABLE);
@@ -46,6 +55,15 @@
  
      pthread_create(&thread, &(sr->attr), sr_arpcache_timeout, sr);
  
+     /* Rate limit ICMP errors, with the defaults unless set up already */
+     if (!sr->icmp_limit) {
+         char err[128];
+         if (!(sr->icmp_limit = sr_icmplimit_create(0, err, sizeof(err)))) {
+             fprintf(stderr, "Error in ICMP limits: %s\n", err);
+             exit(1);
+         }
+     }
+
      /* Add initialization code here! */
  
  } /* -- sr_init -- */
@@ -76,19 +94,25 @@
    assert(packet);
    assert(interface);
  
-  //  printf("*** -> Received packet of length %d \n",len);
-  
-   if (ethertype(packet) == ethertype_arp) {
-    //  printf("ARP packet\n");
+   uint64_t start = sr_stats_sample() ? sr_stats_now() : 0;
+   struct sr_if* iface = sr_get_interface(sr, interface);
+   if (iface) {
+     sr_stats_count_if(iface->index, SR_STATS_RX_PACKETS, len);
+   }
+
+   if (len < sizeof(struct sr_ethernet_hdr)) {
+     sr_stats_count(SR_STATS_DROP_SHORT);
+   } else if (ethertype(packet) == ethertype_arp) {
      sr_handle_arp_packet(sr, packet, len, interface);
    } else if (ethertype(packet) == ethertype_ip) {
-    //  printf("IP packet\n");
      sr_handle_ip_packet(sr, packet, len, interface);
    } else {
-    //  printf("Unknown packet\n");
+     sr_stats_count(SR_STATS_DROP_ETHERTYPE);
    }
  
- 
+   if (start) {
+     sr_stats_record_latency(sr_stats_now() - start);
+   }
  } /* end sr_handlepacket */
  
  
@@ -105,6 +129,7 @@
    char* interface/* lent */) {
  
   if (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr)) {
+    sr_stats_count(SR_STATS_DROP_SHORT);
     return;
   }
 
@@ -114,29 +139,17 @@
   uint16_t calculated_sum = cksum(ip_hdr, sizeof(struct sr_ip_hdr));
   ip_hdr->ip_sum = old_sum;
   if (old_sum != calculated_sum) {
+    sr_stats_count(SR_STATS_DROP_CHECKSUM);
     return;
   }
 
-  int for_us = 0;
-  struct sr_if* iface = sr->if_list;
-  while (iface) { // search through interfaces list
-    if (iface->ip == ip_hdr->ip_dst) {
-        for_us = 1;
-        break;
-    }
-    iface = iface->next;
-  }
-
-  if (for_us) {
+  if (get_interface_from_ip(sr, ip_hdr->ip_dst)) { // one of our addresses
     if (ip_hdr->ip_p == ip_protocol_icmp) {
-        // printf("ICMP packet for us\n");
         sr_handle_icmp_packet(sr, packet, len, interface);
-    } else {
-        // printf("TCP/UDP packet for us - generating port unreachable\n");
+    } else { // TCP/UDP for us
         sr_send_icmp_port_unreachable(sr, packet, interface);
     }
   } else {
-    // printf("Forwarding IP packet\n");
     sr_forward_packet(sr, packet, len, interface);
   }
 }
@@ -148,49 +161,46 @@ void sr_handle_icmp_packet(struct sr_instance* sr,
 
  struct sr_icmp_hdr *icmp_hdr = (struct sr_icmp_hdr *)(packet + sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr));
 
- uint8_t *new_packet = (uint8_t *)malloc(len);
+ uint8_t *new_packet = sr_pktbuf_alloc(len);
+ if (!new_packet) {
+   sr_stats_count(SR_STATS_DROP_NOMEM);
+   return;
+ }
  memcpy(new_packet, packet, len);
 
  if (icmp_hdr->icmp_type == 8) {
-  //  printf("ICMP echo request\n");
    sr_handle_icmp_echo_request(sr, packet, new_packet, len, interface);
    
    struct sr_ip_hdr *ip_hdr = (struct sr_ip_hdr *)(packet + sizeof(struct sr_ethernet_hdr));
-   struct sr_rt *rt = sr_get_longest_prefix_match(sr, ip_hdr->ip_src);
-   
-   if (!rt) {
-    //  printf("No route to host for ICMP echo reply\n");
-     free(new_packet);
-     return;
-   }
-   
-   struct sr_if *out_iface = sr_get_interface(sr, rt->interface);
-   if (!out_iface) {
-    //  printf("Interface not found\n");
-     free(new_packet);
+   struct sr_nexthop nh;
+   int res = sr_nexthop_resolve(sr, ip_hdr->ip_src, flow_hash(packet, len), &nh);
+
+   if (res == SR_NEXTHOP_NOROUTE || res == SR_NEXTHOP_NOIFACE) {
+     sr_stats_count(res == SR_NEXTHOP_NOROUTE ? SR_STATS_DROP_NO_ROUTE
+                                              : SR_STATS_DROP_NO_IFACE);
+     sr_pktbuf_free(new_packet);
      return;
    }
    
-   struct sr_arpentry* arp_entry = sr_arpcache_lookup(&(sr->cache), rt->gw.s_addr);
+   struct sr_ethernet_hdr *eth_hdr = (struct sr_ethernet_hdr *)new_packet;
    
-   if (arp_entry) {
-     struct sr_ethernet_hdr *eth_hdr = (struct sr_ethernet_hdr *)new_packet;
-     memcpy(eth_hdr->ether_shost, out_iface->addr, ETHER_ADDR_LEN);
-     memcpy(eth_hdr->ether_dhost, arp_entry->mac, ETHER_ADDR_LEN);
+   if (res == SR_NEXTHOP_OK) {
+     memcpy(eth_hdr->ether_shost, nh.smac, ETHER_ADDR_LEN);
+     memcpy(eth_hdr->ether_dhost, nh.dmac, ETHER_ADDR_LEN);
      
-     sr_send_packet(sr, new_packet, len, out_iface->name);
-     free(arp_entry);
-     free(new_packet);
+     sr_send_packet(sr, new_packet, len, sr_get_interface_by_index(sr, nh.ifindex)->name);
+     sr_pktbuf_free(new_packet);
    } else {
-    //  printf("ARP cache miss for ICMP reply, queueing packet\n");
+     sr_stats_count(SR_STATS_ARP_MISS);
      struct sr_arpreq *req = sr_arpcache_queuereq(
-         &(sr->cache), rt->gw.s_addr, new_packet, len, out_iface->name);
+         &(sr->cache), nh.gw, new_packet, len, nh.ifindex);
+     sr_pktbuf_free(new_packet); // the queue keeps its own copy
      handle_arpreq(sr, req);
-     // don't free new_packet here - it's now owned by the queue
    }
+   sr_stats_count(SR_STATS_ECHO_REPLIED);
  } else {
-  //  printf("Unknown ICMP packet\n");
-   free(new_packet);
+   sr_stats_count(SR_STATS_DROP_ICMP_OTHER);
+   sr_pktbuf_free(new_packet);
  }
 }
  
@@ -236,41 +246,42 @@ void sr_forward_packet(struct sr_instance* sr,
 
   struct sr_ethernet_hdr *eth_hdr = (struct sr_ethernet_hdr *)packet;
   struct sr_ip_hdr *ip_hdr = (struct sr_ip_hdr *)(packet + sizeof(struct sr_ethernet_hdr));
+  uint16_t old_word, new_word;
 
+  memcpy(&old_word, &ip_hdr->ip_ttl, 2); // TTL shares a word with protocol
   ip_hdr->ip_ttl--;
 
   if (ip_hdr->ip_ttl <= 0) {
-    // printf("TTL expired, sending ICMP time exceeded\n");
+    sr_stats_count(SR_STATS_TTL_EXPIRED);
     sr_send_icmp_time_exceeded(sr, packet, interface);
     return;
   }
 
-  ip_hdr->ip_sum = 0;
-  ip_hdr->ip_sum = cksum(ip_hdr, sizeof(struct sr_ip_hdr));
+  memcpy(&new_word, &ip_hdr->ip_ttl, 2);
+  ip_hdr->ip_sum = cksum_update16(ip_hdr->ip_sum, old_word, new_word);
+
+  struct sr_nexthop nh;
+  int res = sr_nexthop_resolve(sr, ip_hdr->ip_dst, flow_hash(packet, len), &nh);
 
-  struct sr_rt *rt = sr_get_longest_prefix_match(sr, ip_hdr->ip_dst);
-  if (!rt) {
-    // printf("Destination net unreachable\n");
+  if (res == SR_NEXTHOP_NOROUTE) {
+    sr_stats_count(SR_STATS_DROP_NO_ROUTE);
     sr_send_icmp_net_unreachable(sr, packet, interface);
     return;
   }
 
-  struct sr_if *out_iface = sr_get_interface(sr, rt->interface);
-  if (!out_iface) {
-    // printf("Interface not found\n");
+  if (res == SR_NEXTHOP_NOIFACE) {
+    sr_stats_count(SR_STATS_DROP_NO_IFACE);
     return;
   }
 
-  struct sr_arpentry* arp_entry = sr_arpcache_lookup(&(sr->cache), rt->gw.s_addr);
-
-  if (arp_entry) {
-    memcpy(eth_hdr->ether_shost, out_iface->addr, ETHER_ADDR_LEN);
-    memcpy(eth_hdr->ether_dhost, arp_entry->mac, ETHER_ADDR_LEN);
-    sr_send_packet(sr, packet, len, out_iface->name);
-    free(arp_entry);
+  if (res == SR_NEXTHOP_OK) {
+    memcpy(eth_hdr->ether_shost, nh.smac, ETHER_ADDR_LEN);
+    memcpy(eth_hdr->ether_dhost, nh.dmac, ETHER_ADDR_LEN);
+    sr_send_packet(sr, packet, len, sr_get_interface_by_index(sr, nh.ifindex)->name);
+    sr_stats_count(SR_STATS_FORWARDED);
   } else {
-    // printf("ARP cache miss, queueing packet and sending ARP request\n");
-    struct sr_arpreq *req = sr_arpcache_queuereq(&(sr->cache), rt->gw.s_addr, packet, len, out_iface->name);
+    sr_stats_count(SR_STATS_ARP_MISS);
+    struct sr_arpreq *req = sr_arpcache_queuereq(&(sr->cache), nh.gw, packet, len, nh.ifindex);
     handle_arpreq(sr, req);
   }
 }
@@ -278,7 +289,11 @@ void sr_forward_packet(struct sr_instance* sr,
 void sr_send_arp_request(struct sr_instance* sr, uint32_t tip, struct sr_if* iface) {
   // Create and send ARP request packet
   unsigned int len = sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr);
-  uint8_t* arp_packet = (uint8_t*)malloc(len);
+  uint8_t* arp_packet = sr_pktbuf_alloc(len);
+  if (!arp_packet) {
+    sr_stats_count(SR_STATS_DROP_NOMEM);
+    return;
+  }
   
   struct sr_ethernet_hdr* eth_hdr = (struct sr_ethernet_hdr*)arp_packet;
   memset(eth_hdr->ether_dhost, 0xff, ETHER_ADDR_LEN); // Broadcast
@@ -297,7 +312,8 @@ void sr_send_arp_request(struct sr_instance* sr, uint32_t tip, struct sr_if* ifa
   arp_hdr->ar_tip = tip; // Target IP
   
   sr_send_packet(sr, arp_packet, len, iface->name);
-  free(arp_packet);
+  sr_pktbuf_free(arp_packet);
+  sr_stats_count(SR_STATS_ARP_REQUESTED);
 }
 
 void sr_send_arp_reply(struct sr_instance* sr, uint8_t* req_packet, unsigned int len, char* interface) {
@@ -305,7 +321,11 @@ void sr_send_arp_reply(struct sr_instance* sr, uint8_t* req_packet, unsigned int
   struct sr_arp_hdr* req_arp_hdr = (struct sr_arp_hdr*)(req_packet + sizeof(struct sr_ethernet_hdr));
   struct sr_if* iface = sr_get_interface(sr, interface);
   
-  uint8_t* reply_packet = (uint8_t*)malloc(len);
+  uint8_t* reply_packet = sr_pktbuf_alloc(len);
+  if (!reply_packet) {
+    sr_stats_count(SR_STATS_DROP_NOMEM);
+    return;
+  }
   
   struct sr_ethernet_hdr* reply_eth_hdr = (struct sr_ethernet_hdr*)reply_packet;
   memcpy(reply_eth_hdr->ether_dhost, req_eth_hdr->ether_shost, ETHER_ADDR_LEN);
@@ -324,7 +344,8 @@ void sr_send_arp_reply(struct sr_instance* sr, uint8_t* req_packet, unsigned int
   reply_arp_hdr->ar_tip = req_arp_hdr->ar_sip; // Target IP
   
   sr_send_packet(sr, reply_packet, len, interface);
-  free(reply_packet);
+  sr_pktbuf_free(reply_packet);
+  sr_stats_count(SR_STATS_ARP_REPLIED);
 }
 
 void sr_handle_arp_packet(struct sr_instance* sr,
@@ -333,7 +354,7 @@ void sr_handle_arp_packet(struct sr_instance* sr,
   char* interface/* lent */) {
 
   if (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr)) {
-    // printf("ARP packet too short, ignoring\n");
+    sr_stats_count(SR_STATS_DROP_SHORT);
     return;
   }
 
@@ -341,21 +362,20 @@ void sr_handle_arp_packet(struct sr_instance* sr,
   struct sr_if* iface = sr_get_interface(sr, interface);
 
   if (!iface) {
-    // printf("Interface not found\n");
+    sr_stats_count(SR_STATS_DROP_NO_IFACE);
     return;
   }
 
   if (ntohs(arp_hdr->ar_op) == arp_op_request) {
     if (arp_hdr->ar_tip == iface->ip) {
-        // printf("ARP request for our IP, sending reply\n");
         sr_send_arp_reply(sr, packet, len, interface);
     } else {
-        // printf("ARP request not for us, ignoring\n");
+        sr_stats_count(SR_STATS_DROP_ARP_OTHER);
     }
   }
   else if (ntohs(arp_hdr->ar_op) == arp_op_reply) {
     if (arp_hdr->ar_tip == iface->ip) {
-        // printf("ARP reply received for our request\n");
+        sr_stats_count(SR_STATS_ARP_LEARNED);
         
         struct sr_arpreq* req = sr_arpcache_insert(&(sr->cache), 
                                                 arp_hdr->ar_sha, 
@@ -365,67 +385,85 @@ void sr_handle_arp_packet(struct sr_instance* sr,
             struct sr_packet* pkt = req->packets;
             while (pkt) {
                 struct sr_ethernet_hdr* eth_hdr = (struct sr_ethernet_hdr*)(pkt->buf);
-                struct sr_if* out_iface = sr_get_interface(sr, pkt->iface);
+                struct sr_if* out_iface = sr_get_interface_by_index(sr, pkt->ifindex);
                 
                 memcpy(eth_hdr->ether_dhost, arp_hdr->ar_sha, ETHER_ADDR_LEN);
                 memcpy(eth_hdr->ether_shost, out_iface->addr, ETHER_ADDR_LEN);
                 
-                sr_send_packet(sr, pkt->buf, pkt->len, pkt->iface);
+                sr_send_packet(sr, pkt->buf, pkt->len, out_iface->name);
                 pkt = pkt->next;
             }
             
             sr_arpreq_destroy(&(sr->cache), req);
         }
     } else {
-        // printf("ARP reply not for us, ignoring\n");
+        sr_stats_count(SR_STATS_DROP_ARP_OTHER);
     }
   } else {
-    // printf("Unknown ARP operation\n");
+    sr_stats_count(SR_STATS_DROP_ARP_OTHER);
   }
 }
 
+// The entry is only valid inside an sr_epoch_enter/exit section, a reload
+// may free it as soon as the section ends.
 struct sr_rt *sr_get_longest_prefix_match(struct sr_instance *sr, uint32_t ip) {
-  struct sr_rt *rt_walker = sr->routing_table;
-  struct sr_rt *longest_match = NULL;
-  uint32_t longest_mask = 0; // mask counter
-
-  while (rt_walker) {
-    uint32_t mask = rt_walker->mask.s_addr;
-    uint32_t dest = rt_walker->dest.s_addr;
-    
-    if ((ip & mask) == (dest & mask)) {
-      if (mask >= longest_mask) {
-        longest_match = rt_walker;
-        longest_mask = mask;
-      }
-    }
-    rt_walker = rt_walker->next;
+  struct sr_fib *fib = __atomic_load_n(&sr->fib, __ATOMIC_ACQUIRE);
+  if (!fib) { // no routing table loaded
+    return NULL;
   }
+  return sr_fib_lookup(fib, ip);
+}
 
-  return longest_match;
+// checks an error about packet against sr->icmp_limit, counting it if it is
+// not to be sent
+static int sr_icmp_limited(struct sr_instance* sr, uint8_t* packet,
+  enum sr_icmplimit_type type) {
+  struct sr_ip_hdr *orig_ip_hdr = (struct sr_ip_hdr *)(packet + sizeof(struct sr_ethernet_hdr));
+  switch (sr_icmplimit_check(sr->icmp_limit, type, orig_ip_hdr->ip_src)) {
+  case SR_ICMPLIMIT_OK:
+    return 0;
+  case SR_ICMPLIMIT_SOURCE:
+    sr_stats_count(SR_STATS_ICMP_SOURCE_LIMITED);
+    return 1;
+  default:
+    sr_stats_count(SR_STATS_ICMP_TIME_EXCEEDED_LIMITED + type);
+    return 1;
+  }
 }
 
 void sr_send_icmp_port_unreachable(struct sr_instance* sr,
   uint8_t* packet/* lent */,
   char* interface/* lent */) {
+    if (sr_icmp_limited(sr, packet, SR_ICMPLIMIT_PORT_UNREACH)) {
+      return;
+    }
     sr_send_error(sr, packet, interface, 3, 3);
 }
 
 void sr_send_icmp_time_exceeded(struct sr_instance* sr,
   uint8_t* packet/* lent */,
   char* interface/* lent */) {
+    if (sr_icmp_limited(sr, packet, SR_ICMPLIMIT_TIME_EXCEEDED)) {
+      return;
+    }
     sr_send_error(sr, packet, interface, 11, 0);
 }
 
 void sr_send_icmp_host_unreachable(struct sr_instance* sr,
   uint8_t* packet/* lent */,
   char* interface/* lent */) {
+    if (sr_icmp_limited(sr, packet, SR_ICMPLIMIT_HOST_UNREACH)) {
+      return;
+    }
     sr_send_error(sr, packet, interface, 3, 1);
 }
 
 void sr_send_icmp_net_unreachable(struct sr_instance* sr,
   uint8_t* packet/* lent */,
   char* interface/* lent */) {
+    if (sr_icmp_limited(sr, packet, SR_ICMPLIMIT_NET_UNREACH)) {
+      return;
+    }
     sr_send_error(sr, packet, interface, 3, 0);
 }
 
@@ -440,7 +478,11 @@ void sr_send_error(struct sr_instance* sr,
   
   unsigned int icmp_len = sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr) + 
                         sizeof(struct sr_icmp_t3_hdr);
-  uint8_t *icmp_packet = (uint8_t *)malloc(icmp_len);
+  uint8_t *icmp_packet = sr_pktbuf_alloc(icmp_len);
+  if (!icmp_packet) {
+    sr_stats_count(SR_STATS_DROP_NOMEM);
+    return;
+  }
   
   struct sr_ethernet_hdr *eth_hdr = (struct sr_ethernet_hdr *)icmp_packet;
   struct sr_ip_hdr *ip_hdr = (struct sr_ip_hdr *)(icmp_packet + sizeof(struct sr_ethernet_hdr));
@@ -449,16 +491,13 @@ void sr_send_error(struct sr_instance* sr,
   
   struct sr_if* iface = sr_get_interface(sr, interface);
   
-  struct sr_rt *rt = sr_get_longest_prefix_match(sr, orig_ip_hdr->ip_src);
-  if (!rt) {
-    // printf("No route to host for ICMP error message\n");
-    free(icmp_packet);
-    return;
-  }
-  struct sr_if *out_iface = sr_get_interface(sr, rt->interface);
-  if (!out_iface) {
-    // printf("Interface not found\n");
-    free(icmp_packet);
+  struct sr_nexthop nh;
+  // the original's length is not known here, so errors are spread over ECMP
+  // paths by addresses and protocol only
+  int res = sr_nexthop_resolve(sr, orig_ip_hdr->ip_src,
+      flow_hash(packet, sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr)), &nh);
+  if (res == SR_NEXTHOP_NOROUTE || res == SR_NEXTHOP_NOIFACE) { // no way back
+    sr_pktbuf_free(icmp_packet);
     return;
   }
   
@@ -485,22 +524,28 @@ void sr_send_error(struct sr_instance* sr,
   icmp_hdr->icmp_sum = 0;
   icmp_hdr->icmp_sum = cksum(icmp_hdr, sizeof(struct sr_icmp_t3_hdr));
   
-  struct sr_arpentry *arp_entry = sr_arpcache_lookup(&sr->cache, rt->gw.s_addr);
-  if (arp_entry) {
-    memcpy(eth_hdr->ether_dhost, arp_entry->mac, ETHER_ADDR_LEN);
-    memcpy(eth_hdr->ether_shost, out_iface->addr, ETHER_ADDR_LEN);
-    eth_hdr->ether_type = htons(ethertype_ip);
+  eth_hdr->ether_type = htons(ethertype_ip);
+  memcpy(eth_hdr->ether_shost, nh.smac, ETHER_ADDR_LEN);
+
+  if (res == SR_NEXTHOP_OK) {
+    memcpy(eth_hdr->ether_dhost, nh.dmac, ETHER_ADDR_LEN);
     
-    sr_send_packet(sr, icmp_packet, icmp_len, out_iface->name);
-    free(arp_entry);
-    free(icmp_packet);
+    sr_send_packet(sr, icmp_packet, icmp_len, sr_get_interface_by_index(sr, nh.ifindex)->name);
+    sr_pktbuf_free(icmp_packet);
   } else {
-    eth_hdr->ether_type = htons(ethertype_ip);
-    memcpy(eth_hdr->ether_shost, out_iface->addr, ETHER_ADDR_LEN);
-    
-    struct sr_arpreq *req = sr_arpcache_queuereq(&sr->cache, rt->gw.s_addr, 
-                                               icmp_packet, icmp_len, out_iface->name);
+    struct sr_arpreq *req = sr_arpcache_queuereq(&sr->cache, nh.gw, 
+                                               icmp_packet, icmp_len, nh.ifindex);
+    sr_pktbuf_free(icmp_packet); // the queue keeps its own copy
     handle_arpreq(sr, req);
-    // don't free icmp_packet here - it's now owned by the queue
+  }
+
+  if (type == 11) {
+    sr_stats_count(SR_STATS_ICMP_TIME_EXCEEDED);
+  } else if (code == 0) {
+    sr_stats_count(SR_STATS_ICMP_NET_UNREACH);
+  } else if (code == 1) {
+    sr_stats_count(SR_STATS_ICMP_HOST_UNREACH);
+  } else {
+    sr_stats_count(SR_STATS_ICMP_PORT_UNREACH);
   }
 }
\ No newline at end of file
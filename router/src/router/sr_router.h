@@ -31,6 +31,13 @@
 /* forward declare */
 struct sr_if;
 struct sr_rt;
+struct sr_rt_block;
+struct sr_fib;
+struct sr_pipeline;
+struct sr_pcap;
+struct sr_filter;
+struct sr_afpacket;
+struct sr_icmplimit;
 
 /* ----------------------------------------------------------------------------
  * struct sr_instance
@@ -48,10 +55,28 @@ struct sr_instance
     unsigned short topo_id;
     struct sockaddr_in sr_addr; /* address to server */
     struct sr_if* if_list; /* list of interfaces */
+    struct sr_if** if_table; /* if_list indexed by sr_if.index */
+    unsigned int if_count;
+    unsigned int* if_hash; /* if_table indices by name, SR_IF_NONE if free */
+    unsigned int* if_ip_hash; /* and by IP address, for the "for us" check */
+    unsigned int if_hash_mask; /* of both tables */
     struct sr_rt* routing_table; /* routing table */
+    struct sr_fib* fib; /* lookup structure built from routing_table */
+    struct sr_rt_block* rt_block; /* storage of routing_table entries */
+    uint32_t fib_gen; /* bumped whenever routes or their interfaces change */
     struct sr_arpcache cache;   /* ARP cache */
+    unsigned int arpcache_size; /* ARP cache capacity, 0 for default */
     pthread_attr_t attr;
     FILE* logfile;
+    uint8_t* rx_buf; /* commands received from the server */
+    unsigned int rx_start, rx_end; /* unhandled bytes in rx_buf */
+    unsigned long rx_reads, rx_msgs; /* recv(..) calls, commands handled */
+    struct sr_pipeline* pipeline; /* worker threads, 0 to handle inline */
+    pthread_mutex_t send_lock; /* one writer on sockfd at a time */
+    struct sr_pcap* pcap; /* writer for logfile, if logging */
+    struct sr_filter* capture_filter; /* frames to log, 0 for all */
+    struct sr_afpacket* afpacket; /* device rings, 0 when using VNS */
+    struct sr_icmplimit* icmp_limit; /* ICMP error rate limits, 0 for none */
 };
 
 /* -- sr_main.c -- */
@@ -61,6 +86,7 @@ int sr_verify_routing_table(struct sr_instance* sr);
 int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , const char*);
 int sr_connect_to_server(struct sr_instance* ,unsigned short , char* );
 int sr_read_from_server(struct sr_instance* );
+void sr_receive_packet(struct sr_instance* , uint8_t* , unsigned int , char* );
 
 /* -- sr_router.c -- */
 void sr_init(struct sr_instance* );
@@ -102,6 +128,7 @@ void sr_handle_arp_packet(struct sr_instance* sr,
 
 /* -- sr_if.c -- */
 struct sr_if *sr_get_interface(struct sr_instance*, const char* );
+struct sr_if *sr_get_interface_by_index(struct sr_instance*, unsigned int );
 struct sr_if *get_interface_from_ip(struct sr_instance*, uint32_t );
 struct sr_if *get_interface_from_eth(struct sr_instance *, uint8_t *);
 void sr_add_interface(struct sr_instance* , const char* );
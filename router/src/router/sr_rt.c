@@ -16,116 +16,332 @@
 #include <arpa/inet.h>
 
 #include "sr_rt.h"
+#include "sr_fib.h"
 #include "sr_router.h"
+#include "sr_epoch.h"
+#include "sr_snapshot.h"
+
+static pthread_mutex_t sr_rt_reload_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /*---------------------------------------------------------------------
- * Method:
+ * Method: sr_rt_parse_ip(..)
+ * Scope:  Local
+ *
+ * Parse the token [tok, end) into *addr. Plain A.B.C.D is handled
+ * inline; anything else is handed to inet_aton, so the forms it accepts
+ * (hex, octal, fewer parts) still work.
  *
  *---------------------------------------------------------------------*/
 
-int sr_load_rt(struct sr_instance* sr,const char* filename)
+static int sr_rt_parse_ip(const char* tok, const char* end, struct in_addr* addr)
 {
-    FILE* fp;
-    char  line[BUFSIZ];
-    char  dest[32];
-    char  gw[32];
-    char  mask[32];
-    char  iface[32];
-    struct in_addr dest_addr;
-    struct in_addr gw_addr;
-    struct in_addr mask_addr;
-    int clear_routing_table = 0;
+    const char* p = tok;
+    char buf[32];
+    uint32_t ip = 0;
+    unsigned int octet, digits;
+    int part;
 
-    /* -- REQUIRES -- */
-    assert(filename);
-    if( access(filename,R_OK) != 0)
+    for(part = 0; part < 4; part++)
+    {
+        octet = digits = 0;
+        while(p < end && *p >= '0' && *p <= '9' && digits < 4)
+        {
+            octet = octet * 10 + (*p++ - '0');
+            digits++;
+        }
+        /* -- a leading 0 means octal to inet_aton -- */
+        if(digits == 0 || digits > 3 || octet > 255 ||
+           (digits > 1 && p[-(int)digits] == '0'))
+        { break; }
+        ip = (ip << 8) | octet;
+        if(part < 3 && (p == end || *p++ != '.'))
+        { break; }
+    }
+    if(part == 4 && p == end)
+    {
+        addr->s_addr = htonl(ip);
+        return 1;
+    }
+
+    if((size_t)(end - tok) >= sizeof(buf))
+    { return 0; }
+    memcpy(buf, tok, end - tok);
+    buf[end - tok] = 0;
+    return inet_aton(buf, addr);
+} /* -- sr_rt_parse_ip -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_read(..)
+ * Scope:  Local
+ *
+ * Parse filename into a new list, leaving the live table alone. The
+ * file is read in one go and its entries are carved from one block
+ * sized by the line count, linked in file order. Blank lines are
+ * skipped; fields past the fourth are ignored.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_rt_read(struct sr_instance* sr, const char* filename,
+                      struct sr_rt** list, struct sr_rt_block** blockp)
+{
+    FILE* fp = 0;
+    char* text = 0;
+    const char* p;
+    const char* end;
+    const char* tok[4];
+    const char* tok_end[4];
+    const char* bad = 0;
+    long size;
+    size_t lines = 1, n = 0, len;
+    unsigned long lineno = 0;
+    struct sr_rt_block* block = 0;
+    struct sr_rt* entry;
+    struct sr_if* iface = 0;
+    char last_name[sr_IFACE_NAMELEN] = "";
+    unsigned int last_index = SR_IF_NONE;
+    int i;
+
+    *list = 0;
+    *blockp = 0;
+
+    if( access(filename,R_OK) != 0 || (fp = fopen(filename,"r")) == 0)
     {
         perror("access");
         return -1;
     }
 
-    fp = fopen(filename,"r");
+    /* -- slurp -- */
+    if(fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 ||
+       fseek(fp, 0, SEEK_SET) != 0 ||
+       (text = (char*)malloc(size + 1)) == 0 ||
+       fread(text, 1, size, fp) != (size_t)size)
+    {
+        fprintf(stderr,"Error reading routing table %s\n", filename);
+        fclose(fp);
+        free(text);
+        return -1;
+    }
+    fclose(fp);
+    text[size] = 0;
+    end = text + size;
 
-    while( fgets(line,BUFSIZ,fp) != 0)
+    for(p = text; (p = memchr(p, '\n', end - p)) != 0; p++)
+    { lines++; }
+
+    block = (struct sr_rt_block*)malloc(sizeof(struct sr_rt_block) +
+            lines * sizeof(struct sr_rt));
+    if(!block)
     {
-        sscanf(line,"%s %s %s %s",dest,gw,mask,iface);
-        if(inet_aton(dest,&dest_addr) == 0)
-        { 
-            fprintf(stderr,
-                    "Error loading routing table, cannot convert %s to valid IP\n",
-                    dest);
-            return -1; 
+        fprintf(stderr,"Error: out of memory loading routing table\n");
+        free(text);
+        return -1;
+    }
+
+    for(p = text; p < end && !bad; )
+    {
+        /* -- split the line into its first four fields -- */
+        lineno++;
+        for(i = 0; ; )
+        {
+            while(p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+            { p++; }
+            if(p == end || *p == '\n')
+            { break; }
+            if(i < 4)
+            { tok[i] = p; }
+            while(p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+            { p++; }
+            if(i < 4)
+            { tok_end[i] = p; }
+            i++;
         }
-        if(inet_aton(gw,&gw_addr) == 0)
-        { 
+        if(p < end)
+        { p++; } /* -- newline -- */
+
+        if(i == 0)
+        { continue; }
+        if(i < 4)
+        {
             fprintf(stderr,
-                    "Error loading routing table, cannot convert %s to valid IP\n",
-                    gw);
-            return -1; 
+                    "Error loading routing table, line %lu has %d fields\n",
+                    lineno, i);
+            bad = "";
+            break;
         }
-        if(inet_aton(mask,&mask_addr) == 0)
-        { 
+
+        entry = &block->entries[n];
+        if(!sr_rt_parse_ip(tok[0], tok_end[0], &entry->dest))
+        { bad = tok[0]; }
+        else if(!sr_rt_parse_ip(tok[1], tok_end[1], &entry->gw))
+        { bad = tok[1]; }
+        else if(!sr_rt_parse_ip(tok[2], tok_end[2], &entry->mask))
+        { bad = tok[2]; }
+        if(bad)
+        {
+            len = strcspn(bad, " \t\r\n");
             fprintf(stderr,
-                    "Error loading routing table, cannot convert %s to valid IP\n",
-                    mask);
-            return -1; 
+                    "Error loading routing table, cannot convert %.*s to valid IP\n",
+                    (int)len, bad);
+            break;
         }
-        if( clear_routing_table == 0 ){
-            printf("Loading routing table from server, clear local routing table.\n");
-            sr->routing_table = 0;
-            clear_routing_table = 1;
+
+        /* -- consecutive routes mostly share an interface -- */
+        len = tok_end[3] - tok[3];
+        if(len >= sr_IFACE_NAMELEN)
+        { len = sr_IFACE_NAMELEN - 1; }
+        memset(entry->interface, 0, sr_IFACE_NAMELEN);
+        memcpy(entry->interface, tok[3], len);
+        if(strcmp(entry->interface, last_name) != 0)
+        {
+            memcpy(last_name, entry->interface, sr_IFACE_NAMELEN);
+            iface = sr_get_interface(sr, last_name);
+            last_index = iface ? iface->index : SR_IF_NONE;
         }
-        sr_add_rt_entry(sr,dest_addr,gw_addr,mask_addr,iface);
-    } /* -- while -- */
+        entry->ifindex = last_index;
+        entry->ecmp = entry;
+        entry->ecmp_n = 1;
+        entry->next = 0;
+        if(n > 0)
+        { block->entries[n - 1].next = entry; }
+        n++;
+    }
+
+    free(text);
+    block->n = n;
+
+    if(bad)
+    {
+        free(block);
+        return -1;
+    }
+
+    *list = n ? block->entries : 0;
+    *blockp = block;
+    return 0;
+} /* -- sr_rt_read -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_load_rt(..)
+ *
+ * Load filename, a text routing table or a binary snapshot (see
+ * sr_snapshot.h), as the routing table, replacing the current one. The new
+ * FIB is built beside the old and published with a single pointer store,
+ * so forwarding threads see either table, never a mix. The old table is
+ * freed once no thread can still be reading it (see sr_epoch.h). On
+ * error the current table stays in place.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_load_rt(struct sr_instance* sr,const char* filename)
+{
+    struct sr_rt* list = 0;
+    struct sr_rt_block* block = 0;
+    struct sr_rt_block* old_block = 0;
+    struct sr_fib* fib = 0;
+    struct sr_fib* old_fib = 0;
+
+    /* -- REQUIRES -- */
+    assert(filename);
+
+    /* -- parse and build off to the side -- */
+    if(sr_snapshot_probe(filename))
+    {
+        if(sr_snapshot_read(sr, filename, &list, &block, &fib) != 0)
+        { return -1; }
+    }
+    else
+    {
+        if(sr_rt_read(sr, filename, &list, &block) != 0)
+        { return -1; }
+        if((fib = sr_fib_build(list)) == 0)
+        {
+            free(block); /* -- holds every entry -- */
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&sr_rt_reload_lock);
+
+    printf("Loading routing table from %s, replacing the local one.\n",
+           filename);
+    old_fib = __atomic_exchange_n(&(sr->fib), fib, __ATOMIC_SEQ_CST);
+    old_block = sr->rt_block;
+    sr->routing_table = list;
+    sr->rt_block = block;
+    __atomic_add_fetch(&(sr->fib_gen), 1, __ATOMIC_RELEASE);
+
+    /* -- wait out readers of the old table, then reclaim it -- */
+    sr_epoch_synchronize();
+    sr_fib_destroy(old_fib);
+    free(old_block);
+
+    pthread_mutex_unlock(&sr_rt_reload_lock);
 
     return 0; /* -- success -- */
 } /* -- sr_load_rt -- */
 
 /*---------------------------------------------------------------------
- * Method:
+ * Method: sr_rt_bind_interfaces(..)
+ *
+ * Resolve every entry's interface name to its index. Entries are bound
+ * as they are added, this catches those loaded before the hardware
+ * information arrived.
  *
  *---------------------------------------------------------------------*/
 
-void sr_add_rt_entry(struct sr_instance* sr, struct in_addr dest,
-struct in_addr gw, struct in_addr mask,char* if_name)
+void sr_rt_bind_interfaces(struct sr_instance* sr)
 {
     struct sr_rt* rt_walker = 0;
+    struct sr_if* iface = 0;
 
     /* -- REQUIRES -- */
-    assert(if_name);
     assert(sr);
 
-    /* -- empty list special case -- */
-    if(sr->routing_table == 0)
+    for(rt_walker = sr->routing_table; rt_walker; rt_walker = rt_walker->next)
     {
-        sr->routing_table = (struct sr_rt*)malloc(sizeof(struct sr_rt));
-        assert(sr->routing_table);
-        sr->routing_table->next = 0;
-        sr->routing_table->dest = dest;
-        sr->routing_table->gw   = gw;
-        sr->routing_table->mask = mask;
-        strncpy(sr->routing_table->interface,if_name,sr_IFACE_NAMELEN);
-
-        return;
+        iface = sr_get_interface(sr, rt_walker->interface);
+        rt_walker->ifindex = iface ? iface->index : SR_IF_NONE;
     }
+    __atomic_add_fetch(&(sr->fib_gen), 1, __ATOMIC_RELEASE);
+} /* -- sr_rt_bind_interfaces -- */
 
-    /* -- find the end of the list -- */
-    rt_walker = sr->routing_table;
-    while(rt_walker->next){
-      rt_walker = rt_walker->next; 
-    }
+/*---------------------------------------------------------------------
+ * Method: sr_rt_ecmp_index(..)
+ * Scope:  Global
+ *
+ * Map a flow hash onto [0, n) by multiplying rather than taking a
+ * remainder: no division, and every path gets an equal share of the
+ * hash range to within one part in 2^32.
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned int sr_rt_ecmp_index(uint32_t flow, unsigned int n)
+{
+    return (unsigned int)(((uint64_t)flow * n) >> 32);
+} /* -- sr_rt_ecmp_index -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_ecmp_path(..)
+ * Scope:  Global
+ *
+ * rt is an entry returned by a FIB lookup, the last route of its group
+ * in table order. Path k is the k'th route of the group in table order.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_rt_ecmp_path(struct sr_rt* rt, uint32_t flow)
+{
+    struct sr_rt* path = rt->ecmp;
+    unsigned int k;
 
-    rt_walker->next = (struct sr_rt*)malloc(sizeof(struct sr_rt));
-    assert(rt_walker->next);
-    rt_walker = rt_walker->next;
+    if(rt->ecmp_n < 2)
+    { return rt; }
 
-    rt_walker->next = 0;
-    rt_walker->dest = dest;
-    rt_walker->gw   = gw;
-    rt_walker->mask = mask;
-    strncpy(rt_walker->interface,if_name,sr_IFACE_NAMELEN);
+    for(k = sr_rt_ecmp_index(flow, rt->ecmp_n); k > 0; k--)
+    { path = path->ecmp; }
 
-} /* -- sr_add_entry -- */
+    return path;
+} /* -- sr_rt_ecmp_path -- */
 
 /*---------------------------------------------------------------------
  * Method:
@@ -30,14 +30,30 @@ struct sr_rt
     struct in_addr gw;
     struct in_addr mask;
     char   interface[sr_IFACE_NAMELEN];
+    unsigned int ifindex; /* of interface, SR_IF_NONE until known */
+    struct sr_rt* ecmp;   /* next path to the same prefix, circular */
+    unsigned int ecmp_n;  /* paths in the group, see sr_fib_build */
     struct sr_rt* next;
 };
 
+/* Storage for the entries of a routing table loaded from a file */
+struct sr_rt_block
+{
+    size_t n;
+    struct sr_rt entries[];
+};
 
+
+/* Replaces the routing table with the contents of a file. Safe to call
+   while other threads forward; see sr_load_rt in sr_rt.c. */
 int sr_load_rt(struct sr_instance*,const char*);
-void sr_add_rt_entry(struct sr_instance*, struct in_addr,struct in_addr,
-                  struct in_addr, char*);
+void sr_rt_bind_interfaces(struct sr_instance*);
 void sr_print_routing_table(struct sr_instance* sr);
+
+/* Picks one of the paths of rt's ECMP group for a flow hash. Packets of
+   the same flow always take the same path. */
+struct sr_rt* sr_rt_ecmp_path(struct sr_rt* rt, uint32_t flow);
+unsigned int sr_rt_ecmp_index(uint32_t flow, unsigned int n);
 void sr_print_routing_entry(struct sr_rt* entry);
 
 
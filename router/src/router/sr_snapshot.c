@@ -0,0 +1,499 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_snapshot.c
+ *
+ * Description:
+ *
+ * Binary FIB snapshots, see sr_snapshot.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_fib.h"
+#include "sr_snapshot.h"
+
+#define SR_SNAPSHOT_BYTE_ORDER  0x01020304u
+#define SR_SNAPSHOT_ALIGN(x)    (((x) + 63) & ~(uint64_t)63)
+
+struct sr_snapshot_hdr
+{
+    char     magic[8];
+    uint32_t byte_order;
+    uint32_t n_ifaces;
+    uint32_t n_routes;
+    uint32_t n_chunks;
+    uint64_t ifaces_off;
+    uint64_t routes_off;
+    uint64_t tbl16_off;
+    uint64_t chunks_off;
+    uint64_t len;             /* of the whole file */
+};
+
+struct sr_snapshot_route
+{
+    uint32_t dest;            /* network byte order */
+    uint32_t gw;
+    uint32_t mask;
+    uint32_t iface;           /* slot in the interface name table */
+    uint32_t ecmp;            /* record of the next path to the prefix */
+    uint32_t ecmp_n;
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_layout(..)
+ * Scope:  Local
+ *
+ * Fill in the section offsets implied by the counts in hdr.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_snapshot_layout(struct sr_snapshot_hdr* hdr)
+{
+    hdr->ifaces_off = SR_SNAPSHOT_ALIGN(sizeof(struct sr_snapshot_hdr));
+    hdr->routes_off = SR_SNAPSHOT_ALIGN(hdr->ifaces_off +
+            (uint64_t)hdr->n_ifaces * sr_IFACE_NAMELEN);
+    hdr->tbl16_off = SR_SNAPSHOT_ALIGN(hdr->routes_off +
+            (uint64_t)hdr->n_routes * sizeof(struct sr_snapshot_route));
+    hdr->chunks_off = SR_SNAPSHOT_ALIGN(hdr->tbl16_off +
+            (uint64_t)SR_FIB_TBL16_SZ * sizeof(uint32_t));
+    hdr->len = hdr->chunks_off +
+            (uint64_t)hdr->n_chunks * SR_FIB_CHUNK_SZ * sizeof(uint32_t);
+} /* -- sr_snapshot_layout -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_probe(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_snapshot_probe(const char* filename)
+{
+    char magic[8];
+    FILE* fp;
+    int ret = 0;
+
+    if ((fp = fopen(filename, "r")) == 0)
+    { return 0; }
+    if (fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+        memcmp(magic, SR_SNAPSHOT_MAGIC, sizeof(magic)) == 0)
+    { ret = 1; }
+    fclose(fp);
+
+    return ret;
+} /* -- sr_snapshot_probe -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_check_fib(..)
+ * Scope:  Local
+ *
+ * The lookup follows entries without checking them, so every leaf must
+ * name a route, every chunk reference a chunk, and a chunk referred to
+ * from a chunk, being the last level, must hold only leaves. Returns 0
+ * if the tables are safe to look up in.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_snapshot_check_fib(const struct sr_fib* fib)
+{
+    size_t n = (size_t)fib->n_chunks * SR_FIB_CHUNK_SZ;
+    uint8_t* last;            /* chunks referred to from a chunk */
+    size_t i;
+    uint32_t e;
+    int ret = 0;
+
+    for (i = 0; i < SR_FIB_TBL16_SZ; i++)
+    {
+        e = fib->tbl16[i];
+        if ((e & SR_FIB_CHUNK_FLAG) ? (e & ~SR_FIB_CHUNK_FLAG) >= fib->n_chunks
+                                    : e > fib->n_routes)
+        { return -1; }
+    }
+
+    if ((last = (uint8_t*)calloc((size_t)fib->n_chunks + 1, 1)) == 0)
+    { return -1; }
+    for (i = 0; i < n && ret == 0; i++)
+    {
+        e = fib->chunks[i];
+        if ((e & SR_FIB_CHUNK_FLAG) ? (e & ~SR_FIB_CHUNK_FLAG) >= fib->n_chunks
+                                    : e > fib->n_routes)
+        { ret = -1; }
+        else if (e & SR_FIB_CHUNK_FLAG)
+        { last[e & ~SR_FIB_CHUNK_FLAG] = 1; }
+    }
+    for (i = 0; i < n && ret == 0; i++)
+    {
+        if (last[i / SR_FIB_CHUNK_SZ] && (fib->chunks[i] & SR_FIB_CHUNK_FLAG))
+        { ret = -1; }
+    }
+    free(last);
+
+    return ret;
+} /* -- sr_snapshot_check_fib -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_cap_ecmp(..)
+ * Scope:  Local
+ *
+ * sr_rt_ecmp_path steps up to ecmp_n - 1 links around an entry's ring,
+ * so hold ecmp_n to the length of the ring. ring is scratch space, one
+ * word per entry.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_snapshot_cap_ecmp(struct sr_rt_block* block, uint32_t* ring)
+{
+    struct sr_rt* entry;
+    uint32_t i, len;
+
+    memset(ring, 0, (size_t)block->n * sizeof(uint32_t));
+    for (i = 0; i < block->n; i++)
+    {
+        if (ring[i])
+        { continue; }
+        len = 0;
+        entry = &block->entries[i];
+        do
+        {
+            len++;
+            entry = entry->ecmp;
+        } while (entry != &block->entries[i]);
+        do
+        {
+            ring[entry - block->entries] = len;
+            if (entry->ecmp_n > len)
+            { entry->ecmp_n = len; }
+            entry = entry->ecmp;
+        } while (entry != &block->entries[i]);
+    }
+} /* -- sr_snapshot_cap_ecmp -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_read(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_snapshot_read(struct sr_instance* sr, const char* filename,
+                     struct sr_rt** list, struct sr_rt_block** blockp,
+                     struct sr_fib** fibp)
+{
+    struct sr_snapshot_hdr hdr;
+    const struct sr_snapshot_hdr* file_hdr;
+    const struct sr_snapshot_route* rec;
+    const char* names;
+    struct sr_rt_block* block = 0;
+    struct sr_fib* fib = 0;
+    struct sr_rt* entry;
+    struct sr_if* iface;
+    unsigned int* ifindex = 0;
+    uint32_t* ring = 0;
+    struct stat st;
+    uint8_t* map = MAP_FAILED;
+    uint32_t i;
+    int fd;
+
+    *list = 0;
+    *blockp = 0;
+    *fibp = 0;
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+    {
+        perror("open(..):sr_snapshot_read");
+        return -1;
+    }
+    if (fstat(fd, &st) == 0 &&
+        (size_t)st.st_size >= sizeof(struct sr_snapshot_hdr))
+    { map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0); }
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "Error mapping FIB snapshot %s\n", filename);
+        return -1;
+    }
+
+    /* -- the counts must imply exactly the offsets and size found -- */
+    file_hdr = (const struct sr_snapshot_hdr*)map;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, file_hdr->magic, sizeof(hdr.magic));
+    hdr.byte_order = file_hdr->byte_order;
+    hdr.n_ifaces = file_hdr->n_ifaces;
+    hdr.n_routes = file_hdr->n_routes;
+    hdr.n_chunks = file_hdr->n_chunks;
+    sr_snapshot_layout(&hdr);
+
+    if (memcmp(hdr.magic, SR_SNAPSHOT_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.byte_order != SR_SNAPSHOT_BYTE_ORDER ||
+        hdr.n_routes >= SR_FIB_CHUNK_FLAG || hdr.n_chunks >= SR_FIB_CHUNK_FLAG ||
+        hdr.ifaces_off != file_hdr->ifaces_off ||
+        hdr.routes_off != file_hdr->routes_off ||
+        hdr.tbl16_off != file_hdr->tbl16_off ||
+        hdr.chunks_off != file_hdr->chunks_off ||
+        hdr.len != file_hdr->len || hdr.len != (uint64_t)st.st_size)
+    {
+        fprintf(stderr, "Error: %s is not a valid FIB snapshot\n", filename);
+        goto fail;
+    }
+
+    fib = (struct sr_fib*)calloc(1, sizeof(struct sr_fib));
+    block = (struct sr_rt_block*)malloc(sizeof(struct sr_rt_block) +
+            (size_t)hdr.n_routes * sizeof(struct sr_rt));
+    ifindex = (unsigned int*)malloc((hdr.n_ifaces + 1) * sizeof(unsigned int));
+    ring = (uint32_t*)calloc((size_t)hdr.n_routes + 1, sizeof(uint32_t));
+    if (!fib || !block || !ifindex || !ring ||
+        !(fib->routes = (struct sr_rt**)malloc(
+                ((size_t)hdr.n_routes + 1) * sizeof(struct sr_rt*))))
+    {
+        fprintf(stderr, "Error: out of memory loading FIB snapshot\n");
+        goto fail;
+    }
+
+    fib->map = map;
+    fib->map_len = st.st_size;
+    fib->tbl16 = (uint32_t*)(map + hdr.tbl16_off);
+    fib->chunks = (uint32_t*)(map + hdr.chunks_off);
+    fib->n_chunks = hdr.n_chunks;
+    fib->n_routes = hdr.n_routes;
+
+    if (sr_snapshot_check_fib(fib) != 0)
+    {
+        fprintf(stderr, "Error: FIB snapshot %s is corrupt\n", filename);
+        goto fail;
+    }
+
+    /* -- bind each interface name once, as sr_rt_bind_interfaces would -- */
+    names = (const char*)(map + hdr.ifaces_off);
+    for (i = 0; i < hdr.n_ifaces; i++)
+    {
+        char name[sr_IFACE_NAMELEN];
+
+        memcpy(name, names + (size_t)i * sr_IFACE_NAMELEN, sr_IFACE_NAMELEN);
+        name[sr_IFACE_NAMELEN - 1] = 0;
+        iface = sr_get_interface(sr, name);
+        ifindex[i] = iface ? iface->index : SR_IF_NONE;
+    }
+
+    /* -- expand the route records into routing table entries -- */
+    rec = (const struct sr_snapshot_route*)(map + hdr.routes_off);
+    for (i = 0; i < hdr.n_routes; i++, rec++)
+    {
+        if (rec->iface >= hdr.n_ifaces || rec->ecmp >= hdr.n_routes ||
+            rec->ecmp_n == 0 || ring[rec->ecmp]++ != 0)
+        {
+            fprintf(stderr, "Error: FIB snapshot %s is corrupt\n", filename);
+            goto fail;
+        }
+        entry = &block->entries[i];
+        entry->dest.s_addr = rec->dest;
+        entry->gw.s_addr = rec->gw;
+        entry->mask.s_addr = rec->mask;
+        memcpy(entry->interface, names + (size_t)rec->iface * sr_IFACE_NAMELEN,
+               sr_IFACE_NAMELEN);
+        entry->interface[sr_IFACE_NAMELEN - 1] = 0;
+        entry->ifindex = ifindex[rec->iface];
+        entry->ecmp = &block->entries[rec->ecmp];
+        entry->ecmp_n = rec->ecmp_n;
+        entry->next = (i + 1 < hdr.n_routes) ? entry + 1 : 0;
+        fib->routes[i] = entry;
+    }
+    block->n = hdr.n_routes;
+
+    /* -- every record is the next path of exactly one, so the ecmp links
+          form rings; a group is no larger than its ring -- */
+    sr_snapshot_cap_ecmp(block, ring);
+
+    /* -- the first level is hit by every lookup, fault it in now -- */
+    madvise(fib->tbl16, SR_FIB_TBL16_SZ * sizeof(uint32_t), MADV_WILLNEED);
+
+    free(ifindex);
+    free(ring);
+    *list = hdr.n_routes ? block->entries : 0;
+    *blockp = block;
+    *fibp = fib;
+    return 0;
+
+fail:
+    if (fib && fib->map)
+    { sr_fib_destroy(fib); }
+    else
+    {
+        if (fib)
+        { free(fib->routes); }
+        free(fib);
+        munmap(map, st.st_size);
+    }
+    free(block);
+    free(ifindex);
+    free(ring);
+    return -1;
+} /* -- sr_snapshot_read -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_pad(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_snapshot_pad(FILE* fp, uint64_t off)
+{
+    static const char zero[64];
+    long at = ftell(fp);
+
+    if (at < 0 || (uint64_t)at > off)
+    { return -1; }
+    return fwrite(zero, 1, off - at, fp) == off - at ? 0 : -1;
+} /* -- sr_snapshot_pad -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_route_index(..)
+ * Scope:  Local
+ *
+ * Position of rt in fib->routes. Tables loaded by sr_load_rt are carved
+ * from one block in list order, so this is an offset into it; returns
+ * n_routes for an entry outside the block.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint32_t sr_snapshot_route_index(const struct sr_fib* fib,
+                                        const struct sr_rt* rt)
+{
+    uintptr_t off;
+
+    if (fib->n_routes == 0)
+    { return 0; }
+
+    off = ((uintptr_t)rt - (uintptr_t)fib->routes[0]) / sizeof(struct sr_rt);
+    if (off < fib->n_routes && fib->routes[off] == rt)
+    { return (uint32_t)off; }
+    return fib->n_routes;
+} /* -- sr_snapshot_route_index -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_write(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_snapshot_write(struct sr_instance* sr, const char* filename)
+{
+    struct sr_fib* fib = __atomic_load_n(&(sr->fib), __ATOMIC_ACQUIRE);
+    struct sr_snapshot_hdr hdr;
+    struct sr_snapshot_route rec;
+    char (*names)[sr_IFACE_NAMELEN] = 0;
+    uint32_t* slot = 0;
+    uint32_t cap = 0, i, j;
+    struct sr_rt* rt;
+    char tmp[PATH_MAX];
+    FILE* fp = 0;
+    int ok = 0;
+
+    if (!fib)
+    { return -1; }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SR_SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.byte_order = SR_SNAPSHOT_BYTE_ORDER;
+    hdr.n_routes = fib->n_routes;
+    hdr.n_chunks = fib->n_chunks;
+
+    /* -- intern the interface names, routes mostly repeat the last one -- */
+    if (!(slot = (uint32_t*)malloc(((size_t)fib->n_routes + 1) * sizeof(uint32_t))))
+    { goto done; }
+    for (i = 0; i < fib->n_routes; i++)
+    {
+        rt = fib->routes[i];
+        if (i > 0 && strncmp(names[slot[i - 1]], rt->interface,
+                    sr_IFACE_NAMELEN) == 0)
+        {
+            slot[i] = slot[i - 1];
+            continue;
+        }
+
+        for (j = 0; j < hdr.n_ifaces; j++)
+        {
+            if (strncmp(names[j], rt->interface, sr_IFACE_NAMELEN) == 0)
+            { break; }
+        }
+        if (j == hdr.n_ifaces)
+        {
+            if (hdr.n_ifaces == cap)
+            {
+                char (*grown)[sr_IFACE_NAMELEN];
+
+                cap = cap ? cap * 2 : 16;
+                grown = realloc(names, (size_t)cap * sr_IFACE_NAMELEN);
+                if (!grown)
+                { goto done; }
+                names = grown;
+            }
+            memset(names[j], 0, sr_IFACE_NAMELEN);
+            strncpy(names[j], rt->interface, sr_IFACE_NAMELEN - 1);
+            hdr.n_ifaces++;
+        }
+        slot[i] = j;
+    }
+    sr_snapshot_layout(&hdr);
+
+    /* -- write beside the target and rename over it -- */
+    snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+    if ((fp = fopen(tmp, "w")) == 0)
+    {
+        perror("fopen(..):sr_snapshot_write");
+        goto done;
+    }
+
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        sr_snapshot_pad(fp, hdr.ifaces_off) ||
+        fwrite(names, sr_IFACE_NAMELEN, hdr.n_ifaces, fp) != hdr.n_ifaces ||
+        sr_snapshot_pad(fp, hdr.routes_off))
+    { goto done; }
+
+    for (i = 0; i < fib->n_routes; i++)
+    {
+        rt = fib->routes[i];
+        rec.dest = rt->dest.s_addr;
+        rec.gw = rt->gw.s_addr;
+        rec.mask = rt->mask.s_addr;
+        rec.iface = slot[i];
+        rec.ecmp = sr_snapshot_route_index(fib, rt->ecmp);
+        rec.ecmp_n = rt->ecmp_n;
+        if (rec.ecmp >= fib->n_routes ||
+            fwrite(&rec, sizeof(rec), 1, fp) != 1)
+        { goto done; }
+    }
+
+    if (sr_snapshot_pad(fp, hdr.tbl16_off) ||
+        fwrite(fib->tbl16, sizeof(uint32_t), SR_FIB_TBL16_SZ, fp) != SR_FIB_TBL16_SZ ||
+        sr_snapshot_pad(fp, hdr.chunks_off) ||
+        fwrite(fib->chunks, SR_FIB_CHUNK_SZ * sizeof(uint32_t), fib->n_chunks, fp)
+            != fib->n_chunks)
+    { goto done; }
+
+    ok = 1;
+
+done:
+    if (fp && fclose(fp) != 0)
+    { ok = 0; }
+    if (fp && ok && rename(tmp, filename) != 0)
+    {
+        perror("rename(..):sr_snapshot_write");
+        ok = 0;
+    }
+    if (fp && !ok)
+    { unlink(tmp); }
+    if (!ok)
+    { fprintf(stderr, "Error writing FIB snapshot %s\n", filename); }
+
+    free(names);
+    free(slot);
+    return ok ? 0 : -1;
+} /* -- sr_snapshot_write -- */
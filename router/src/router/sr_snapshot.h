@@ -0,0 +1,52 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_snapshot.h
+ * Description:
+ *
+ * Binary FIB snapshots. A snapshot holds the routing table and the FIB
+ * built from it in the form the lookup path uses, so loading one is a
+ * mmap(2) rather than a parse and a build:
+ *
+ *     header | interface names | route records | tbl16 | chunks
+ *
+ * Route records are 24 bytes (destination, gateway and mask in network
+ * byte order, a slot in the interface name table, and the route's ECMP
+ * group link and size) and are expanded into routing table entries on
+ * load; tbl16 and the chunks are used in place. Sections are 64 byte
+ * aligned and integers are in host byte order; a snapshot from a machine
+ * of the other byte order is rejected.
+ *
+ * sr_load_rt recognises a snapshot by its magic, so -r and a SIGHUP
+ * reload accept either format. Snapshots are written to a temporary file
+ * and renamed over the target, which leaves the pages of a running
+ * router's mapping intact. Before a snapshot is used, its header and
+ * section bounds are checked, and so is every table entry and ECMP link
+ * the lookup path would follow; the addresses and masks are not.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_SNAPSHOT_H
+#define sr_SNAPSHOT_H
+
+#include <stdint.h>
+
+#define SR_SNAPSHOT_MAGIC  "SRFIB02\n"
+
+struct sr_instance;
+struct sr_rt;
+struct sr_rt_block;
+struct sr_fib;
+
+/* Returns 1 if filename starts with the snapshot magic. */
+int sr_snapshot_probe(const char* filename);
+
+/* Maps filename and builds the routing table list and FIB from it,
+   binding routes to sr's interfaces by name. Returns 0 on success. */
+int sr_snapshot_read(struct sr_instance* sr, const char* filename,
+                     struct sr_rt** list, struct sr_rt_block** block,
+                     struct sr_fib** fib);
+
+/* Writes sr's current routing table and FIB to filename. Returns 0 on
+   success. */
+int sr_snapshot_write(struct sr_instance* sr, const char* filename);
+
+#endif  /* --  sr_SNAPSHOT_H -- */
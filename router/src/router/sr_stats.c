@@ -0,0 +1,427 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.c
+ *
+ * Description:
+ *
+ * Forwarding counters and latency histogram, see sr_stats.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+#include "sr_stats.h"
+#include "sr_router.h"
+#include "sr_if.h"
+
+#define SR_STATS_CMD_MAX     64
+#define SR_STATS_CMD_TMO     1000   /* ms a client has to send its command */
+
+static const char* sr_stats_names[SR_STATS_REASONS] =
+{
+    "forwarded",
+    "echo replied",
+    "ARP requests answered",
+    "ARP replies learned",
+    "ARP requests sent",
+    "ARP misses",
+    "ARP requests timed out",
+    "TTL expired",
+    "ICMP time exceeded sent",
+    "ICMP net unreachable sent",
+    "ICMP host unreachable sent",
+    "ICMP port unreachable sent",
+    "ICMP time exceeded limited",
+    "ICMP net unreachable limited",
+    "ICMP host unreachable limited",
+    "ICMP port unreachable limited",
+    "ICMP limited by destination",
+    "dropped, too short",
+    "dropped, bad checksum",
+    "dropped, no route",
+    "dropped, no interface",
+    "dropped, not IP or ARP",
+    "dropped, ARP not for us",
+    "dropped, ICMP not echo",
+    "dropped, out of memory",
+    "dropped on send"
+};
+
+static pthread_mutex_t sr_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sr_stats_shard* sr_stats_shards = 0;
+static struct sr_stats_shard sr_stats_base;   /* totals at the last reset */
+
+__thread struct sr_stats_shard* sr_stats_self = 0;
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_shard(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_stats_shard* sr_stats_shard(void)
+{
+    struct sr_stats_shard* shard = sr_stats_self;
+
+    if (shard)
+    { return shard; }
+
+    if (posix_memalign((void**)&shard, 64, sizeof(*shard)) != 0)
+    { return 0; }
+    memset(shard, 0, sizeof(*shard));
+
+    pthread_mutex_lock(&sr_stats_lock);
+    shard->next_shard = sr_stats_shards;
+    sr_stats_shards = shard;
+    pthread_mutex_unlock(&sr_stats_lock);
+
+    sr_stats_self = shard;
+    return shard;
+} /* -- sr_stats_shard -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_bucket(..)
+ * Scope:  Local
+ *
+ * Values below SR_STATS_SUB_BUCKETS have a bucket each; above that the
+ * top SR_STATS_SUB_BITS bits after the leading one pick the bucket
+ * within the value's power of two.
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned int sr_stats_bucket(uint64_t ns)
+{
+    unsigned int shift;
+
+    if (ns < SR_STATS_SUB_BUCKETS)
+    { return ns; }
+    if (ns >= (1ull << SR_STATS_MAX_BITS))
+    { return SR_STATS_BUCKETS - 1; }
+
+    shift = 63 - __builtin_clzll(ns) - SR_STATS_SUB_BITS;
+    return (shift + 1) * SR_STATS_SUB_BUCKETS +
+           ((ns >> shift) & (SR_STATS_SUB_BUCKETS - 1));
+} /* -- sr_stats_bucket -- */
+
+/* -- smallest value of bucket i, and of bucket i + 1 -- */
+static uint64_t sr_stats_bucket_low(unsigned int i)
+{
+    unsigned int shift;
+
+    if (i < SR_STATS_SUB_BUCKETS)
+    { return i; }
+    shift = i / SR_STATS_SUB_BUCKETS - 1;
+    return (uint64_t)(SR_STATS_SUB_BUCKETS + i % SR_STATS_SUB_BUCKETS)
+           << shift;
+}
+
+static uint64_t sr_stats_bucket_high(unsigned int i)
+{
+    return sr_stats_bucket_low(i + 1);
+}
+
+void sr_stats_record_latency(uint64_t ns)
+{
+    struct sr_stats_shard* shard = sr_stats_self ? sr_stats_self
+                                                 : sr_stats_shard();
+    if (!shard)
+    { return; }
+    sr_stats_add(&shard->bucket[sr_stats_bucket(ns)], 1);
+    sr_stats_add(&shard->latency_sum, ns);
+} /* -- sr_stats_record_latency -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_sum(..)
+ * Scope:  Local
+ *
+ * Add up every shard. Called with sr_stats_lock held.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_stats_sum(struct sr_stats_shard* total)
+{
+    const uint64_t* from;
+    uint64_t* to = (uint64_t*)total;
+    struct sr_stats_shard* shard;
+    unsigned int i, n;
+
+    n = offsetof(struct sr_stats_shard, next_shard) / sizeof(uint64_t);
+    memset(total, 0, sizeof(*total));
+    for (shard = sr_stats_shards; shard; shard = shard->next_shard)
+    {
+        from = (const uint64_t*)shard;
+        for (i = 0; i < n; i++)
+        { to[i] += __atomic_load_n(&from[i], __ATOMIC_RELAXED); }
+    }
+} /* -- sr_stats_sum -- */
+
+void sr_stats_reset(void)
+{
+    pthread_mutex_lock(&sr_stats_lock);
+    sr_stats_sum(&sr_stats_base);
+    pthread_mutex_unlock(&sr_stats_lock);
+} /* -- sr_stats_reset -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_print(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_print(struct sr_instance* sr, FILE* fp, int what)
+{
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    struct sr_stats_shard total;
+    uint64_t* t = (uint64_t*)&total;
+    const uint64_t* b = (const uint64_t*)&sr_stats_base;
+    uint64_t count = 0, seen = 0, *c;
+    struct sr_if* iface;
+    unsigned int i, q, n, top = 0;
+
+    pthread_mutex_lock(&sr_stats_lock);
+    sr_stats_sum(&total);
+    n = offsetof(struct sr_stats_shard, next_shard) / sizeof(uint64_t);
+    for (i = 0; i < n; i++)
+    { t[i] -= b[i]; }
+    pthread_mutex_unlock(&sr_stats_lock);
+
+    if (what & SR_STATS_COUNTERS)
+    {
+        for (i = 0; i < SR_STATS_REASONS; i++)
+        {
+            fprintf(fp, "%-30s %llu\n", sr_stats_names[i],
+                    (unsigned long long)total.reason[i]);
+        }
+        for (iface = sr ? sr->if_list : 0; iface; iface = iface->next)
+        {
+            if (iface->index >= SR_STATS_MAX_IFACES)
+            { continue; }
+            c = total.iface[iface->index];
+            fprintf(fp, "%-8s rx %llu packets %llu bytes, "
+                    "tx %llu packets %llu bytes\n", iface->name,
+                    (unsigned long long)c[SR_STATS_RX_PACKETS],
+                    (unsigned long long)c[SR_STATS_RX_BYTES],
+                    (unsigned long long)c[SR_STATS_TX_PACKETS],
+                    (unsigned long long)c[SR_STATS_TX_BYTES]);
+        }
+        if (sr && sr->if_count > SR_STATS_MAX_IFACES)
+        {
+            fprintf(fp, "(interfaces from %s on are counted together "
+                    "with it)\n",
+                    sr_get_interface_by_index(sr, SR_STATS_MAX_IFACES - 1)
+                        ->name);
+        }
+    }
+
+    if (!(what & SR_STATS_LATENCY))
+    { return; }
+
+    for (i = 0; i < SR_STATS_BUCKETS; i++)
+    {
+        count += total.bucket[i];
+        if (total.bucket[i])
+        { top = i; }
+    }
+    if (count == 0)
+    {
+        fprintf(fp, "sr_handlepacket latency: no packets\n");
+        return;
+    }
+
+    /* -- a quantile is reported as the top of its bucket -- */
+    fprintf(fp, "sr_handlepacket latency ns: %llu packets sampled, mean %.0f",
+            (unsigned long long)count, (double)total.latency_sum / count);
+    for (i = 0, q = 0; i < SR_STATS_BUCKETS && q < 4; i++)
+    {
+        seen += total.bucket[i];
+        while (q < 4 && seen >= quantiles[q] * count)
+        {
+            fprintf(fp, ", p%g %llu", quantiles[q] * 100,
+                    (unsigned long long)sr_stats_bucket_high(i));
+            q++;
+        }
+    }
+    fprintf(fp, ", max %llu\n",
+            (unsigned long long)sr_stats_bucket_high(top));
+
+    if (!(what & SR_STATS_HISTOGRAM))
+    { return; }
+    for (i = 0; i <= top; i++)
+    {
+        if (total.bucket[i])
+        {
+            fprintf(fp, "%12llu - %-12llu %llu\n",
+                    (unsigned long long)sr_stats_bucket_low(i),
+                    (unsigned long long)sr_stats_bucket_high(i),
+                    (unsigned long long)total.bucket[i]);
+        }
+    }
+} /* -- sr_stats_print -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_command(..)
+ * Scope:  Local
+ *
+ * Read one command from a control connection and answer it.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_stats_command(struct sr_instance* sr, int fd)
+{
+    char cmd[SR_STATS_CMD_MAX];
+    unsigned int len = 0;
+    struct pollfd pfd;
+    FILE* fp;
+    ssize_t n;
+
+    /* -- up to a newline, end of input or the timeout -- */
+    while (len < sizeof(cmd) - 1)
+    {
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, SR_STATS_CMD_TMO) <= 0)
+        { break; }
+        if ((n = read(fd, cmd + len, sizeof(cmd) - 1 - len)) <= 0)
+        { break; }
+        len += n;
+        if (memchr(cmd, '\n', len))
+        { break; }
+    }
+    cmd[len] = 0;
+    cmd[strcspn(cmd, " \t\r\n")] = 0;
+
+    if ((fp = fdopen(fd, "w")) == 0)
+    {
+        close(fd);
+        return;
+    }
+
+    if (strcmp(cmd, "stats") == 0)
+    { sr_stats_print(sr, fp, SR_STATS_COUNTERS); }
+    else if (strcmp(cmd, "latency") == 0)
+    { sr_stats_print(sr, fp, SR_STATS_LATENCY | SR_STATS_HISTOGRAM); }
+    else if (strcmp(cmd, "all") == 0 || cmd[0] == 0)
+    {
+        sr_stats_print(sr, fp, SR_STATS_COUNTERS | SR_STATS_LATENCY |
+                       SR_STATS_HISTOGRAM);
+    }
+    else if (strcmp(cmd, "reset") == 0)
+    {
+        sr_stats_reset();
+        fprintf(fp, "counters reset\n");
+    }
+    else
+    { fprintf(fp, "unknown command \"%s\", try stats, latency, all or "
+              "reset\n", cmd); }
+
+    fclose(fp);
+} /* -- sr_stats_command -- */
+
+struct sr_stats_server
+{
+    struct sr_instance* sr;
+    int fd;
+};
+
+static void* sr_stats_server(void* arg)
+{
+    struct sr_stats_server* server = (struct sr_stats_server*)arg;
+    sigset_t set;
+    int fd;
+
+    /* -- a client that hangs up before reading its answer must not take
+          the router down with it: writes get EPIPE instead -- */
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    while (1)
+    {
+        if ((fd = accept(server->fd, 0, 0)) < 0)
+        {
+            if (errno != EINTR)
+            { perror("accept(..):sr_stats_server"); }
+            continue;
+        }
+        sr_stats_command(server->sr, fd);
+    }
+
+    return NULL;
+} /* -- sr_stats_server -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_serve(..)
+ * Scope:  Global
+ *
+ * A socket left behind by an earlier run at the same path is replaced;
+ * anything else there is left alone and is an error.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_stats_serve(struct sr_instance* sr, const char* path)
+{
+    struct sr_stats_server* server;
+    struct sockaddr_un addr;
+    struct stat st;
+    pthread_t thread;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Error: control socket path %s too long\n", path);
+        return -1;
+    }
+
+    if (lstat(path, &st) == 0)
+    {
+        if (!S_ISSOCK(st.st_mode))
+        {
+            fprintf(stderr, "Error: %s exists and is not a socket\n", path);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        perror("socket(..):sr_stats_serve");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(fd, 8) < 0)
+    {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    if ((server = (struct sr_stats_server*)malloc(sizeof(*server))) == 0)
+    {
+        close(fd);
+        return -1;
+    }
+    server->sr = sr;
+    server->fd = fd;
+    if (pthread_create(&thread, NULL, sr_stats_server, server) != 0)
+    {
+        perror("pthread_create(..):sr_stats_serve");
+        free(server);
+        close(fd);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+} /* -- sr_stats_serve -- */
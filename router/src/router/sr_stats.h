@@ -0,0 +1,172 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.h
+ * Description:
+ *
+ * Forwarding counters and a latency histogram of sr_handlepacket.
+ *
+ * Every thread that counts gets a private shard, registered on first use,
+ * holding the per-reason counters, the per-interface counters and the
+ * histogram. A shard is written only by its thread, with relaxed atomic
+ * stores, so counting costs no lock and no shared cache line; readers sum
+ * the shards with relaxed loads and may see a packet counted in one
+ * counter and not yet in another.
+ *
+ * Reading the clock twice costs about as much as forwarding a packet, so
+ * only one call of sr_handlepacket in SR_STATS_SAMPLE per thread is timed;
+ * the counters are exact.
+ *
+ * The histogram is log-linear, like an HDR histogram: each power of two
+ * is split into SR_STATS_SUB_BUCKETS equal buckets, so any value is
+ * recorded to within 1/SR_STATS_SUB_BUCKETS of itself, from 1 ns to 2^36 ns
+ * (about 68 s). Larger values land in the last bucket.
+ *
+ * The totals can be read through a UNIX-domain control socket (-C path),
+ * one command per connection:
+ *
+ *   stats      counters by reason and by interface
+ *   latency    latency quantiles and the non-empty histogram buckets
+ *   all        both (also what an empty command gets)
+ *   reset      start counting from zero again
+ *
+ * e.g. "echo stats | nc -U path", and are printed to stderr on SIGUSR1
+ * and on exit.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_STATS_H
+#define sr_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#define SR_STATS_MAX_IFACES   32    /* higher indices share the last slot */
+#define SR_STATS_SAMPLE       16    /* packets per latency sample, 2^n */
+#define SR_STATS_SUB_BITS     4
+#define SR_STATS_SUB_BUCKETS  (1 << SR_STATS_SUB_BITS)
+#define SR_STATS_MAX_BITS     36    /* values up to 2^36 ns kept apart */
+#define SR_STATS_BUCKETS      ((SR_STATS_MAX_BITS - SR_STATS_SUB_BITS + 1) * \
+                               SR_STATS_SUB_BUCKETS)
+
+/* What happened to a packet, or what the router sent. Keep in step with
+   the names in sr_stats.c. */
+enum sr_stats_reason
+{
+    SR_STATS_FORWARDED,
+    SR_STATS_ECHO_REPLIED,
+    SR_STATS_ARP_REPLIED,         /* requests for our address answered */
+    SR_STATS_ARP_LEARNED,         /* replies entered in the cache */
+    SR_STATS_ARP_REQUESTED,       /* requests sent, resends included */
+    SR_STATS_ARP_MISS,            /* packets queued to wait for ARP */
+    SR_STATS_ARP_TIMEOUT,         /* requests given up on */
+    SR_STATS_TTL_EXPIRED,
+    SR_STATS_ICMP_TIME_EXCEEDED,  /* ICMP errors sent, by type */
+    SR_STATS_ICMP_NET_UNREACH,
+    SR_STATS_ICMP_HOST_UNREACH,
+    SR_STATS_ICMP_PORT_UNREACH,
+    SR_STATS_ICMP_TIME_EXCEEDED_LIMITED,  /* ICMP errors not sent, over */
+    SR_STATS_ICMP_NET_UNREACH_LIMITED,    /* the limit of their type    */
+    SR_STATS_ICMP_HOST_UNREACH_LIMITED,   /* (sr_icmplimit.h) ...       */
+    SR_STATS_ICMP_PORT_UNREACH_LIMITED,
+    SR_STATS_ICMP_SOURCE_LIMITED,         /* ... or of their destination */
+    SR_STATS_DROP_SHORT,          /* drops, by reason */
+    SR_STATS_DROP_CHECKSUM,
+    SR_STATS_DROP_NO_ROUTE,
+    SR_STATS_DROP_NO_IFACE,
+    SR_STATS_DROP_ETHERTYPE,
+    SR_STATS_DROP_ARP_OTHER,      /* ARP not for us or not understood */
+    SR_STATS_DROP_ICMP_OTHER,     /* ICMP for us other than echo */
+    SR_STATS_DROP_NOMEM,
+    SR_STATS_DROP_TX,             /* could not be sent */
+    SR_STATS_REASONS
+};
+
+enum sr_stats_if_counter
+{
+    SR_STATS_RX_PACKETS,
+    SR_STATS_RX_BYTES,
+    SR_STATS_TX_PACKETS,
+    SR_STATS_TX_BYTES,
+    SR_STATS_IF_COUNTERS
+};
+
+struct sr_stats_shard
+{
+    uint64_t reason[SR_STATS_REASONS];
+    uint64_t iface[SR_STATS_MAX_IFACES][SR_STATS_IF_COUNTERS];
+    uint64_t bucket[SR_STATS_BUCKETS];
+    uint64_t latency_sum;         /* ns */
+    struct sr_stats_shard* next_shard;  /* registry of all threads */
+    unsigned int tick;            /* packets since the last sample */
+} __attribute__ ((aligned (64)));
+
+struct sr_instance;
+
+extern __thread struct sr_stats_shard* sr_stats_self;
+
+/* The calling thread's shard, registered on first use. NULL only if it
+   could not be allocated, in which case nothing is counted. */
+struct sr_stats_shard* sr_stats_shard(void);
+
+static inline void sr_stats_add(uint64_t* counter, uint64_t n)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+
+static inline void sr_stats_count(enum sr_stats_reason reason)
+{
+    struct sr_stats_shard* shard = sr_stats_self ? sr_stats_self
+                                                 : sr_stats_shard();
+    if (shard)
+    { sr_stats_add(&shard->reason[reason], 1); }
+}
+
+static inline void sr_stats_count_if(unsigned int ifindex,
+                                     enum sr_stats_if_counter packets,
+                                     unsigned int len)
+{
+    struct sr_stats_shard* shard = sr_stats_self ? sr_stats_self
+                                                 : sr_stats_shard();
+    if (!shard)
+    { return; }
+    if (ifindex >= SR_STATS_MAX_IFACES)
+    { ifindex = SR_STATS_MAX_IFACES - 1; }
+    sr_stats_add(&shard->iface[ifindex][packets], 1);
+    sr_stats_add(&shard->iface[ifindex][packets + 1], len);
+}
+
+static inline uint64_t sr_stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Whether to time this call of sr_handlepacket. */
+static inline int sr_stats_sample(void)
+{
+    struct sr_stats_shard* shard = sr_stats_self ? sr_stats_self
+                                                 : sr_stats_shard();
+    return shard && (shard->tick++ & (SR_STATS_SAMPLE - 1)) == 0;
+}
+
+/* Records the time one call of sr_handlepacket took. */
+void sr_stats_record_latency(uint64_t ns);
+
+/* Writes the totals of the section(s) asked for to fp. */
+#define SR_STATS_COUNTERS   1
+#define SR_STATS_LATENCY    2  /* mean and quantiles */
+#define SR_STATS_HISTOGRAM  4  /* the non-empty buckets */
+void sr_stats_print(struct sr_instance* sr, FILE* fp, int what);
+
+/* Counts from zero again. Done by remembering the totals, the shards are
+   never written by other threads. */
+void sr_stats_reset(void);
+
+/* Serves the control socket at path from a thread of its own. Returns 0
+   on success. */
+int sr_stats_serve(struct sr_instance* sr, const char* path);
+
+#endif  /* --  sr_STATS_H -- */
@@ -0,0 +1,200 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_timer.c
+ *
+ * Description:
+ *
+ * Hierarchical timer wheel, see sr_timer.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <time.h>
+
+#include "sr_timer.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_now(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+uint64_t sr_timer_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000) /
+        SR_TIMER_TICK_MS;
+} /* -- sr_timer_now -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_wheel_init(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_timer_wheel_init(struct sr_timer_wheel* wheel, uint64_t now)
+{
+    memset(wheel->slots, 0, sizeof(wheel->slots));
+    wheel->now = now;
+} /* -- sr_timer_wheel_init -- */
+
+void sr_timer_init(struct sr_timer* timer)
+{
+    timer->expires = 0;
+    timer->next = 0;
+    timer->pprev = 0;
+} /* -- sr_timer_init -- */
+
+int sr_timer_pending(const struct sr_timer* timer)
+{
+    return timer->pprev != 0;
+} /* -- sr_timer_pending -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_link(..)
+ * Scope:  Local
+ *
+ * Put timer in the slot for its expiry relative to the wheel's current
+ * tick: the lowest level whose span still covers the delay. A cascade
+ * runs before the current tick's slot is emptied, so it may put timers
+ * there; anyone else must not, the tick has already fired.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_timer_link(struct sr_timer_wheel* wheel, struct sr_timer* timer,
+                          int cascading)
+{
+    uint64_t expires = timer->expires;
+    uint64_t earliest = cascading ? wheel->now : wheel->now + 1;
+    uint64_t delta;
+    struct sr_timer** slot;
+    int level;
+
+    /* -- overdue timers fire on the earliest tick still to be run -- */
+    if (expires < earliest)
+    { expires = earliest; }
+    delta = expires - wheel->now;
+
+    for (level = 0; level < SR_TIMER_LEVELS - 1; level++)
+    {
+        if (delta < ((uint64_t)1 << (SR_TIMER_BITS * (level + 1))))
+        { break; }
+    }
+
+    /* -- beyond the top level: park in the farthest top level slot -- */
+    if (level == SR_TIMER_LEVELS - 1 &&
+        delta >= ((uint64_t)1 << (SR_TIMER_BITS * SR_TIMER_LEVELS)))
+    {
+        expires = wheel->now +
+            ((uint64_t)1 << (SR_TIMER_BITS * SR_TIMER_LEVELS)) - 1;
+    }
+
+    slot = &(wheel->slots[level][(expires >> (SR_TIMER_BITS * level)) &
+            (SR_TIMER_SLOTS - 1)]);
+
+    timer->next = *slot;
+    if (*slot)
+    { (*slot)->pprev = &(timer->next); }
+    *slot = timer;
+    timer->pprev = slot;
+} /* -- sr_timer_link -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_add(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_timer_add(struct sr_timer_wheel* wheel, struct sr_timer* timer,
+                  uint64_t expires)
+{
+    sr_timer_del(timer);
+    timer->expires = expires;
+    sr_timer_link(wheel, timer, 0);
+} /* -- sr_timer_add -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_del(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_timer_del(struct sr_timer* timer)
+{
+    if (!timer->pprev)
+    { return; }
+
+    *(timer->pprev) = timer->next;
+    if (timer->next)
+    { timer->next->pprev = timer->pprev; }
+    timer->next = 0;
+    timer->pprev = 0;
+} /* -- sr_timer_del -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_cascade(..)
+ * Scope:  Local
+ *
+ * Redistribute the timers of one upper level slot into lower levels.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_timer_cascade(struct sr_timer_wheel* wheel, int level,
+                             unsigned int idx)
+{
+    struct sr_timer* timer = wheel->slots[level][idx];
+    struct sr_timer* next;
+
+    wheel->slots[level][idx] = 0;
+    for (; timer; timer = next)
+    {
+        next = timer->next;
+        sr_timer_link(wheel, timer, 1);
+    }
+} /* -- sr_timer_cascade -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_advance(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_timer* sr_timer_advance(struct sr_timer_wheel* wheel, uint64_t now)
+{
+    struct sr_timer* fired = 0;
+    struct sr_timer* timer;
+    struct sr_timer* next;
+    unsigned int idx;
+    int level;
+
+    while (wheel->now < now)
+    {
+        wheel->now++;
+
+        /* -- when a lower level wraps, pull the next slot above down -- */
+        for (level = 1; level < SR_TIMER_LEVELS; level++)
+        {
+            if ((wheel->now >> (SR_TIMER_BITS * (level - 1))) &
+                    (SR_TIMER_SLOTS - 1))
+            { break; }
+            sr_timer_cascade(wheel, level,
+                    (wheel->now >> (SR_TIMER_BITS * level)) &
+                    (SR_TIMER_SLOTS - 1));
+        }
+
+        idx = wheel->now & (SR_TIMER_SLOTS - 1);
+        timer = wheel->slots[0][idx];
+        wheel->slots[0][idx] = 0;
+
+        for (; timer; timer = next)
+        {
+            next = timer->next;
+            timer->pprev = 0;
+            timer->next = fired;
+            fired = timer;
+        }
+    }
+
+    return fired;
+} /* -- sr_timer_advance -- */
@@ -0,0 +1,65 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_timer.h
+ * Description:
+ *
+ * Hierarchical timer wheel. Time advances in ticks of SR_TIMER_TICK_MS.
+ * Timers due within 256 ticks sit in a per-tick slot of the first level;
+ * later ones sit in coarser slots of the upper levels and are cascaded down
+ * as the wheel turns. Adding or removing a timer is O(1) and advancing the
+ * wheel costs time proportional to the number of timers that fire (plus
+ * an amortised share of cascading), not to the number armed.
+ *
+ * Timers are embedded in the structures they time out. The wheel does no
+ * locking of its own; callers serialize access to it.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_TIMER_H
+#define sr_TIMER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SR_TIMER_TICK_MS   100
+#define SR_TIMER_BITS      8
+#define SR_TIMER_SLOTS     (1 << SR_TIMER_BITS)
+#define SR_TIMER_LEVELS    3   /* 2^24 ticks, ~19 days at 100ms */
+
+/* Converts a duration in milliseconds to ticks, rounding up */
+#define SR_TIMER_MS(ms)    (((ms) + SR_TIMER_TICK_MS - 1) / SR_TIMER_TICK_MS)
+
+/* Recovers the structure a timer is embedded in */
+#define sr_timer_entry(ptr, type, member) \
+    ((type*)((char*)(ptr) - offsetof(type, member)))
+
+struct sr_timer
+{
+    uint64_t expires;            /* absolute tick */
+    struct sr_timer* next;
+    struct sr_timer** pprev;     /* 0 when not armed */
+};
+
+struct sr_timer_wheel
+{
+    uint64_t now;                /* last tick processed */
+    struct sr_timer* slots[SR_TIMER_LEVELS][SR_TIMER_SLOTS];
+};
+
+/* Current tick of the monotonic clock */
+uint64_t sr_timer_now(void);
+
+void sr_timer_wheel_init(struct sr_timer_wheel* wheel, uint64_t now);
+void sr_timer_init(struct sr_timer* timer);
+
+/* Arms timer to fire at tick expires (re-arming it if already pending).
+   Ticks at or before the wheel's current tick fire on the next advance. */
+void sr_timer_add(struct sr_timer_wheel* wheel, struct sr_timer* timer,
+                  uint64_t expires);
+void sr_timer_del(struct sr_timer* timer);
+int  sr_timer_pending(const struct sr_timer* timer);
+
+/* Advances the wheel to tick now and returns the timers that fired as a
+   list linked through next. Fired timers are no longer pending. */
+struct sr_timer* sr_timer_advance(struct sr_timer_wheel* wheel, uint64_t now);
+
+#endif  /* --  sr_TIMER_H -- */
@@ -29,9 +29,13 @@
 #define SR_UTILS_H
 
 uint16_t cksum(const void *_data, int len);
+uint16_t cksum_update16(uint16_t sum, uint16_t old, uint16_t new);
+uint16_t cksum_update32(uint16_t sum, uint32_t old, uint32_t new);
+const char *cksum_kernel(unsigned int i, uint16_t (**fn)(const void *, int));
 
 uint16_t ethertype(uint8_t *buf);
 uint8_t ip_protocol(uint8_t *buf);
+uint32_t flow_hash(const uint8_t *buf, unsigned int len);
 
 void print_addr_eth(uint8_t *addr);
 void print_addr_ip(struct in_addr address);
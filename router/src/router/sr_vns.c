@@ -0,0 +1,1239 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_vns.c
+ *
+ * Description:
+ *
+ * Stand-in for the VNS server, for running and load testing the router on
+ * one machine with no Mininet or POX. Listens on loopback, takes the router
+ * through the handshake sr_vns_comm.c expects (auth request and status,
+ * open, hardware information and, for -T, the routing table) and then
+ * plays every host of the topology at once:
+ *
+ *  - UDP datagrams are sent into the router addressed to random
+ *    destinations across the routing table, each entering on an interface
+ *    other than the one its destination is routed out of, where there is
+ *    one. Each carries a sequence number; when it comes back out of the
+ *    router its latency is taken.
+ *  - ARP requests from the router are answered for any address, with a
+ *    MAC made from the address.
+ *
+ * The routing table and IP_CONFIG are the router's own: "sw0-eth1 ip [mac]"
+ * lines of IP_CONFIG are router interfaces, other lines are ignored.
+ *
+ * Before measuring, one datagram is sent towards every distinct gateway,
+ * with no deadline, so that the router's ARP cache is warm. Then -n
+ * datagrams are sent, at most -w outstanding and, with -R, at most so
+ * many a second. At the end the forwarding rate, latency percentiles and
+ * counts are printed; the exit status is 0 if no more than -l percent of
+ * the datagrams were lost or came back damaged.
+ *
+ * A router command line after the options is started once the server is
+ * listening and closed down at the end, e.g.
+ *
+ *    sr_vns -p 8890 -n 100000 -- ./sr -p 8890 -s 127.0.0.1
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sha1.h"
+#include "vnscommand.h"
+
+#define SR_VNS_PORT         8888
+#define SR_VNS_MAX_IFACES   32
+#define SR_VNS_MAX_MSG      (64*1024)     /* largest command accepted */
+#define SR_VNS_RXBUF_SIZE   (1024*1024)
+#define SR_VNS_TXBUF_SIZE   (1024*1024)
+#define SR_VNS_BATCH        64            /* datagrams queued at a time */
+#define SR_VNS_WARMUP_MAX   4096          /* gateways warmed up */
+#define SR_VNS_STALL_NS     1000000000ull /* no progress: the rest is lost */
+#define SR_VNS_ACCEPT_MS    10000
+#define SR_VNS_SALT_LEN     16
+#define SR_VNS_AUTH_KEY_LEN 64
+#define SR_VNS_SHA1_LEN     20
+
+#define SR_VNS_UDP_PROTO    17
+#define SR_VNS_UDP_SPORT    0x5256        /* "RV" */
+#define SR_VNS_UDP_DPORT    9             /* discard */
+#define SR_VNS_MAGIC        0x53525653    /* "SRVS" */
+
+struct sr_vns_udp_hdr
+{
+    uint16_t sport;
+    uint16_t dport;
+    uint16_t len;
+    uint16_t sum;
+} __attribute__ ((packed)) ;
+
+/* -- what follows the UDP header of every datagram sent -- */
+struct sr_vns_payload
+{
+    uint32_t magic;
+    uint32_t seq;
+} __attribute__ ((packed)) ;
+
+#define SR_VNS_MIN_FRAME (sizeof(struct sr_ethernet_hdr) + \
+                          sizeof(struct sr_ip_hdr) + \
+                          sizeof(struct sr_vns_udp_hdr) + \
+                          sizeof(struct sr_vns_payload))
+
+struct sr_vns_iface
+{
+    char name[16];
+    uint32_t ip;                        /* nbo */
+    unsigned char mac[ETHER_ADDR_LEN];
+};
+
+struct sr_vns_route
+{
+    uint32_t dest, mask;                /* host byte order */
+    uint32_t gw;                        /* nbo */
+    unsigned int iface;
+};
+
+struct sr_vns
+{
+    int fd;
+    struct sr_vns_iface ifaces[SR_VNS_MAX_IFACES];
+    unsigned int n_ifaces;
+    struct sr_vns_route* routes;
+    unsigned int n_routes;
+    uint64_t rand_state;
+
+    uint8_t* rx;
+    unsigned int rx_start, rx_end;
+    uint8_t* tx;
+    unsigned int tx_start, tx_end;
+
+    unsigned int frame_len;
+
+    /* -- the phase running, see sr_vns_phase -- */
+    uint32_t seq_base;                  /* first sequence number */
+    unsigned long count;                /* datagrams to send */
+    const unsigned int* route_list;     /* routes to send to in turn, or 0
+                                           for random ones */
+    uint64_t* sent_ns;                  /* by seq - seq_base, 0 once back */
+    uint32_t* latency_ns;               /* of each one back */
+    unsigned long sent, received;
+
+    unsigned long arp_replies;
+    unsigned long damaged;
+    unsigned long duplicates;
+    unsigned long other;
+};
+
+static uint64_t sr_vns_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* -- xorshift64*, seeded by -S, so runs can be repeated -- */
+static uint32_t sr_vns_rand(struct sr_vns* vns)
+{
+    vns->rand_state ^= vns->rand_state >> 12;
+    vns->rand_state ^= vns->rand_state << 25;
+    vns->rand_state ^= vns->rand_state >> 27;
+    return (uint32_t)((vns->rand_state * 0x2545f4914f6cdd1dull) >> 32);
+}
+
+/* -- the MAC every simulated host with address ip (nbo) answers to -- */
+static void sr_vns_host_mac(uint32_t ip, unsigned char* mac)
+{
+    mac[0] = 0x02;
+    mac[1] = 0x00;
+    memcpy(mac + 2, &ip, 4);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_vns_read_config(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_vns_read_config(struct sr_vns* vns, const char* filename)
+{
+    unsigned int b[ETHER_ADDR_LEN];
+    char line[256], name[64], ip[64], mac[64];
+    struct sr_vns_iface* iface;
+    struct in_addr in;
+    const char* dash;
+    FILE* fp;
+    int n, i;
+
+    if ((fp = fopen(filename, "r")) == 0)
+    {
+        perror(filename);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        if ((n = sscanf(line, "%63s %63s %63s", name, ip, mac)) < 2 ||
+            (dash = strchr(name, '-')) == 0)
+        { continue; }
+        if (vns->n_ifaces == SR_VNS_MAX_IFACES ||
+            strlen(dash + 1) >= sizeof(iface->name) ||
+            inet_aton(ip, &in) == 0)
+        {
+            fprintf(stderr, "Error: bad interface %s in %s\n", name, filename);
+            fclose(fp);
+            return -1;
+        }
+
+        iface = &vns->ifaces[vns->n_ifaces];
+        strcpy(iface->name, dash + 1);
+        iface->ip = in.s_addr;
+        if (n == 3)
+        {
+            if (sscanf(mac, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2],
+                       &b[3], &b[4], &b[5]) != ETHER_ADDR_LEN)
+            {
+                fprintf(stderr, "Error: bad MAC %s in %s\n", mac, filename);
+                fclose(fp);
+                return -1;
+            }
+            for (i = 0; i < ETHER_ADDR_LEN; i++)
+            { iface->mac[i] = b[i]; }
+        }
+        else
+        {
+            memset(iface->mac, 0, ETHER_ADDR_LEN);
+            iface->mac[5] = vns->n_ifaces + 1;
+        }
+        vns->n_ifaces++;
+    }
+
+    fclose(fp);
+    if (vns->n_ifaces == 0)
+    {
+        fprintf(stderr, "Error: no router interfaces in %s\n", filename);
+        return -1;
+    }
+    return 0;
+} /* -- sr_vns_read_config -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_vns_read_rtable(..)
+ * Scope:  Local
+ *
+ * Same format as sr_load_rt reads. Routes out of interfaces that are
+ * not in IP_CONFIG are an error.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_vns_read_rtable(struct sr_vns* vns, const char* filename)
+{
+    char line[256], dest[64], gw[64], mask[64], name[64];
+    struct in_addr dest_addr, gw_addr, mask_addr;
+    struct sr_vns_route* route;
+    unsigned int cap = 0, i;
+    FILE* fp;
+
+    if ((fp = fopen(filename, "r")) == 0)
+    {
+        perror(filename);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (sscanf(line, "%63s %63s %63s %63s", dest, gw, mask, name) != 4)
+        { continue; }
+        if (inet_aton(dest, &dest_addr) == 0 ||
+            inet_aton(gw, &gw_addr) == 0 ||
+            inet_aton(mask, &mask_addr) == 0)
+        {
+            fprintf(stderr, "Error: bad route \"%s\" in %s\n", line, filename);
+            fclose(fp);
+            return -1;
+        }
+        for (i = 0; i < vns->n_ifaces; i++)
+        {
+            if (strcmp(vns->ifaces[i].name, name) == 0)
+            { break; }
+        }
+        if (i == vns->n_ifaces)
+        {
+            fprintf(stderr, "Error: route out of %s, not a router interface\n",
+                    name);
+            fclose(fp);
+            return -1;
+        }
+
+        if (vns->n_routes == cap)
+        {
+            cap = cap ? cap * 2 : 256;
+            route = realloc(vns->routes, cap * sizeof(struct sr_vns_route));
+            if (!route)
+            {
+                perror("realloc");
+                fclose(fp);
+                return -1;
+            }
+            vns->routes = route;
+        }
+        route = &vns->routes[vns->n_routes++];
+        route->mask = ntohl(mask_addr.s_addr);
+        route->dest = ntohl(dest_addr.s_addr) & route->mask;
+        route->gw = gw_addr.s_addr;
+        route->iface = i;
+    }
+
+    fclose(fp);
+    if (vns->n_routes == 0)
+    {
+        fprintf(stderr, "Error: no routes in %s\n", filename);
+        return -1;
+    }
+    return 0;
+} /* -- sr_vns_read_rtable -- */
+
+/*---------------------------------------------------------------------
+ * Handshake. Blocking reads and writes of whole commands.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_vns_write_all(int fd, const void* buf, unsigned int len)
+{
+    const uint8_t* p = (const uint8_t*)buf;
+    ssize_t n;
+
+    while (len > 0)
+    {
+        if ((n = send(fd, p, len, MSG_NOSIGNAL)) < 0)
+        {
+            if (errno == EINTR)
+            { continue; }
+            perror("send");
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int sr_vns_read_all(int fd, void* buf, unsigned int len)
+{
+    uint8_t* p = (uint8_t*)buf;
+    ssize_t n;
+
+    while (len > 0)
+    {
+        if ((n = recv(fd, p, len, 0)) <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+            { continue; }
+            if (n < 0)
+            { perror("recv"); }
+            else
+            { fprintf(stderr, "Error: router closed the connection\n"); }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* -- reads one command into buf, returns its type or -1 -- */
+static int sr_vns_read_command(int fd, uint8_t* buf, unsigned int size)
+{
+    c_base* base = (c_base*)buf;
+    uint32_t len;
+
+    if (sr_vns_read_all(fd, buf, sizeof(c_base)) != 0)
+    { return -1; }
+    len = ntohl(base->mLen);
+    if (len < sizeof(c_base) || len > size)
+    {
+        fprintf(stderr, "Error: bad command length %u from router\n", len);
+        return -1;
+    }
+    if (sr_vns_read_all(fd, buf + sizeof(c_base), len - sizeof(c_base)) != 0)
+    { return -1; }
+    return ntohl(base->mType);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_vns_auth(..)
+ * Scope:  Local
+ *
+ * Check the reply to a salt against the key the router reads from its
+ * auth_key, if we have the key file too, as the real server would.
+ * Returns 1 if the router authenticated, 0 if not, -1 on error.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_vns_auth(struct sr_vns* vns, const char* key_file, uint8_t* buf)
+{
+    uint8_t salt[SR_VNS_SALT_LEN];
+    char key[SR_VNS_AUTH_KEY_LEN + 1];
+    char user[IDSIZE + 1];
+    c_auth_request* req = (c_auth_request*)buf;
+    c_auth_reply* reply = (c_auth_reply*)buf;
+    c_auth_status* status = (c_auth_status*)buf;
+    uint32_t digest[SR_VNS_SHA1_LEN / 4];
+    unsigned int user_len, len, i;
+    SHA1Context sha1;
+    const char* msg;
+    int ok = 1;
+    FILE* fp;
+
+    for (i = 0; i < SR_VNS_SALT_LEN; i++)
+    { salt[i] = sr_vns_rand(vns); }
+
+    req->mLen = htonl(sizeof(c_auth_request) + SR_VNS_SALT_LEN);
+    req->mType = htonl(VNS_AUTH_REQUEST);
+    memcpy(req->salt, salt, SR_VNS_SALT_LEN);
+    if (sr_vns_write_all(vns->fd, buf, ntohl(req->mLen)) != 0)
+    { return -1; }
+
+    if (sr_vns_read_command(vns->fd, buf, SR_VNS_MAX_MSG) != VNS_AUTH_REPLY)
+    {
+        fprintf(stderr, "Error: expected an authentication reply\n");
+        return -1;
+    }
+    len = ntohl(reply->mLen);
+    user_len = ntohl(reply->usernameLen);
+    if (len != sizeof(c_auth_reply) + user_len + SR_VNS_SHA1_LEN ||
+        user_len > IDSIZE)
+    {
+        fprintf(stderr, "Error: malformed authentication reply\n");
+        return -1;
+    }
+    memcpy(user, reply->username, user_len);
+    user[user_len] = 0;
+
+    if ((fp = fopen(key_file, "r")) != 0)
+    {
+        memset(key, 0, sizeof(key));
+        if (fgets(key, sizeof(key), fp) != key)
+        { key[0] = 0; }
+        fclose(fp);
+
+        SHA1Reset(&sha1);
+        SHA1Input(&sha1, salt, SR_VNS_SALT_LEN);
+        SHA1Input(&sha1, (unsigned char*)key, SR_VNS_AUTH_KEY_LEN);
+        SHA1Result(&sha1);
+        for (i = 0; i < SR_VNS_SHA1_LEN / 4; i++)
+        { digest[i] = htonl(sha1.Message_Digest[i]); }
+        ok = memcmp(reply->username + user_len, digest,
+                    SR_VNS_SHA1_LEN) == 0;
+    }
+
+    msg = ok ? "authenticated" : "wrong key";
+    len = sizeof(c_auth_status) + strlen(msg) + 1;
+    status->mLen = htonl(len);
+    status->mType = htonl(VNS_AUTH_STATUS);
+    status->auth_ok = ok;
+    strcpy(status->msg, msg);
+    if (sr_vns_write_all(vns->fd, buf, len) != 0)
+    { return -1; }
+
+    printf("router user %s %s%s\n", user, msg,
+           fp ? "" : " (no key file, not checked)");
+    return ok;
+} /* -- sr_vns_auth -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_vns_handshake(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_vns_handshake(struct sr_vns* vns, const char* key_file,
+                            const char* rtable)
+{
+    uint8_t* buf = vns->rx;
+    c_open* open_cmd = (c_open*)buf;
+    c_open_template* template = (c_open_template*)buf;
+    c_rtable* rt = (c_rtable*)buf;
+    c_hwinfo* hw = (c_hwinfo*)buf;
+    char host[IDSIZE + 1];
+    unsigned int i, n;
+    size_t len;
+    FILE* fp;
+    int type;
+
+    if (sr_vns_auth(vns, key_file, buf) != 1)
+    { return -1; }
+
+    memset(host, 0, sizeof(host));
+    type = sr_vns_read_command(vns->fd, buf, SR_VNS_MAX_MSG);
+    if (type == VNSOPEN)
+    {
+        memcpy(host, open_cmd->mVirtualHostID, IDSIZE);
+        printf("router opened host %s of topology %u\n", host,
+               ntohs(open_cmd->topoID));
+    }
+    else if (type == VNS_OPEN_TEMPLATE)
+    {
+        memcpy(host, template->mVirtualHostID, IDSIZE);
+        printf("router opened host %s of template %.30s, sending %s\n",
+               host, template->templateName, rtable);
+
+        /* -- the router keeps the VNS limit on command size -- */
+        memset(rt, 0, sizeof(c_rtable));
+        memcpy(rt->mVirtualHostID, host, IDSIZE);
+        if ((fp = fopen(rtable, "r")) == 0)
+        {
+            perror(rtable);
+            return -1;
+        }
+        len = fread(rt->rtable, 1, 10000 - sizeof(c_rtable), fp);
+        if (!feof(fp))
+        {
+            fprintf(stderr, "Error: %s too large to send\n", rtable);
+            fclose(fp);
+            return -1;
+        }
+        fclose(fp);
+        rt->mLen = htonl(sizeof(c_rtable) + len);
+        rt->mType = htonl(VNS_RTABLE);
+        if (sr_vns_write_all(vns->fd, buf, ntohl(rt->mLen)) != 0)
+        { return -1; }
+    }
+    else
+    {
+        fprintf(stderr, "Error: expected an open command\n");
+        return -1;
+    }
+
+    memset(hw, 0, sizeof(c_hwinfo));
+    for (i = 0, n = 0; i < vns->n_ifaces; i++)
+    {
+        hw->mHWInfo[n].mKey = htonl(HWINTERFACE);
+        strcpy(hw->mHWInfo[n++].value, vns->ifaces[i].name);
+        hw->mHWInfo[n].mKey = htonl(HWETHER);
+        memcpy(hw->mHWInfo[n++].value, vns->ifaces[i].mac, ETHER_ADDR_LEN);
+        hw->mHWInfo[n].mKey = htonl(HWETHIP);
+        memcpy(hw->mHWInfo[n++].value, &vns->ifaces[i].ip, 4);
+    }
+    hw->mLen = htonl(2 * sizeof(uint32_t) + n * sizeof(c_hw_entry));
+    hw->mType = htonl(VNSHWINFO);
+    return sr_vns_write_all(vns->fd, buf, ntohl(hw->mLen));
+} /* -- sr_vns_handshake -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_vns_queue_frame(..)
+ * Scope:  Local
+ *
+ * Append a VNSPACKET command to the transmit buffer and return where its
+ * frame goes, or 0 if there is no room.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint8_t* sr_vns_queue_frame(struct sr_vns* vns, unsigned int iface,
+                                   unsigned int len)
+{
+    c_packet_header* hdr;
+
+    if (vns->tx_end + sizeof(c_packet_header) + len > SR_VNS_TXBUF_SIZE)
+    {
+        if (vns->tx_start == 0)
+        { return 0; }
+        memmove(vns->tx, vns->tx + vns->tx_start,
+                vns->tx_end - vns->tx_start);
+        vns->tx_end -= vns->tx_start;
+        vns->tx_start = 0;
+        if (vns->tx_end + sizeof(c_packet_header) + len > SR_VNS_TXBUF_SIZE)
+        { return 0; }
+    }
+
+    hdr = (c_packet_header*)(vns->tx + vns->tx_end);
+    hdr->mLen = htonl(sizeof(c_packet_header) + len);
+    hdr->mType = htonl(VNSPACKET);
+    memset(hdr->mInterfaceName, 0, sizeof(hdr->mInterfaceName));
+    strcpy(hdr->mInterfaceName, vns->ifaces[iface].name);
+    vns->tx_end += sizeof(c_packet_header) + len;
+    return (uint8_t*)(hdr + 1);
+} /* -- sr_vns_queue_frame -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_vns_queue_datagram(..)
+ * Scope:  Local
+ *
+ * Queue datagram seq towards route dst. It enters from a host on some
+ * other route's interface, preferably not dst's own.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_vns_queue_datagram(struct sr_vns* vns, unsigned int dst,
+                                 uint32_t seq)
+{
+    struct sr_vns_route* to = &vns->routes[dst];
+    struct sr_vns_route* from;
+    struct sr_ethernet_hdr* eth;
+    struct sr_ip_hdr* ip;
+    struct sr_vns_udp_hdr* udp;
+    struct sr_vns_payload* payload;
+    uint32_t dst_ip, src_ip;
+    uint8_t* frame;
+    unsigned int i;
+
+    for (i = 0; ; i++)
+    {
+        from = &vns->routes[sr_vns_rand(vns) % vns->n_routes];
+        if (from->iface != to->iface || i == 8)
+        { break; }
+    }
+
+    /* -- any address the route covers that is not the router's -- */
+    for (i = 0; ; i++)
+    {
+        dst_ip = htonl(to->dest | (sr_vns_rand(vns) & ~to->mask));
+        if (i == 8)
+        { dst_ip = to->gw; }
+        if (i == 8 || dst_ip != vns->ifaces[to->iface].ip)
+        { break; }
+    }
+    src_ip = from->gw ? from->gw : htonl(from->dest | 1);
+
+    if ((frame = sr_vns_queue_frame(vns, from->iface, vns->frame_len)) == 0)
+    { return -1; }
+    memset(frame, 0, vns->frame_len);
+
+    eth = (struct sr_ethernet_hdr*)frame;
+    memcpy(eth->ether_dhost, vns->ifaces[from->iface].mac, ETHER_ADDR_LEN);
+    sr_vns_host_mac(src_ip, eth->ether_shost);
+    eth->ether_type = htons(ethertype_ip);
+
+    ip = (struct sr_ip_hdr*)(eth + 1);
+    ip->ip_v = 4;
+    ip->ip_hl = sizeof(struct sr_ip_hdr) / 4;
+    ip->ip_len = htons(vns->frame_len - sizeof(struct sr_ethernet_hdr));
+    ip->ip_id = htons(seq);
+    ip->ip_ttl = 64;
+    ip->ip_p = SR_VNS_UDP_PROTO;
+    ip->ip_src = src_ip;
+    ip->ip_dst = dst_ip;
+    ip->ip_sum = cksum(ip, sizeof(struct sr_ip_hdr));
+
+    udp = (struct sr_vns_udp_hdr*)(ip + 1);
+    udp->sport = htons(SR_VNS_UDP_SPORT);
+    udp->dport = htons(SR_VNS_UDP_DPORT);
+    udp->len = htons(vns->frame_len - sizeof(struct sr_ethernet_hdr) -
+                     sizeof(struct sr_ip_hdr));
+
+    payload = (struct sr_vns_payload*)(udp + 1);
+    payload->magic = htonl(SR_VNS_MAGIC);
+    payload->seq = htonl(seq);
+    return 0;
+} /* -- sr_vns_queue_datagram -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_vns_handle_frame(..)
+ * Scope:  Local
+ *
+ * A frame the router sent out of interface iface.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_vns_handle_frame(struct sr_vns* vns, unsigned int iface,
+                                uint8_t* frame, unsigned int len,
+                                uint64_t now)
+{
+    struct sr_ethernet_hdr* eth = (struct sr_ethernet_hdr*)frame;
+    struct sr_arp_hdr* arp;
+    struct sr_ip_hdr* ip;
+    struct sr_vns_udp_hdr* udp;
+    struct sr_vns_payload* payload;
+    unsigned char mac[ETHER_ADDR_LEN];
+    uint8_t* reply;
+    uint16_t sum;
+    uint32_t seq;
+
+    if (len >= sizeof(*eth) + sizeof(*arp) &&
+        ntohs(eth->ether_type) == ethertype_arp)
+    {
+        arp = (struct sr_arp_hdr*)(eth + 1);
+        if (ntohs(arp->ar_op) != arp_op_request ||
+            (reply = sr_vns_queue_frame(vns, iface, sizeof(*eth) +
+                                        sizeof(*arp))) == 0)
+        {
+            vns->other++;
+            return;
+        }
+        sr_vns_host_mac(arp->ar_tip, mac);
+        memcpy(reply, frame, sizeof(*eth) + sizeof(*arp));
+        eth = (struct sr_ethernet_hdr*)reply;
+        arp = (struct sr_arp_hdr*)(eth + 1);
+        memcpy(eth->ether_dhost, arp->ar_sha, ETHER_ADDR_LEN);
+        memcpy(eth->ether_shost, mac, ETHER_ADDR_LEN);
+        arp->ar_op = htons(arp_op_reply);
+        memcpy(arp->ar_tha, arp->ar_sha, ETHER_ADDR_LEN);
+        memcpy(arp->ar_sha, mac, ETHER_ADDR_LEN);
+        seq = arp->ar_tip;
+        arp->ar_tip = arp->ar_sip;
+        arp->ar_sip = seq;
+        vns->arp_replies++;
+        return;
+    }
+
+    ip = (struct sr_ip_hdr*)(eth + 1);
+    udp = (struct sr_vns_udp_hdr*)(ip + 1);
+    payload = (struct sr_vns_payload*)(udp + 1);
+    if (len < SR_VNS_MIN_FRAME ||
+        ntohs(eth->ether_type) != ethertype_ip ||
+        ip->ip_p != SR_VNS_UDP_PROTO ||
+        udp->sport != htons(SR_VNS_UDP_SPORT) ||
+        payload->magic != htonl(SR_VNS_MAGIC))
+    {
+        vns->other++;
+        return;
+    }
+
+    seq = ntohl(payload->seq) - vns->seq_base;
+    if (seq >= vns->count || vns->sent_ns[seq] == 0)
+    {
+        vns->duplicates++;
+        return;
+    }
+
+    /* -- forwarded: one hop less, checksum right, from the router -- */
+    sum = ip->ip_sum;
+    ip->ip_sum = 0;
+    if (ip->ip_ttl != 63 || cksum(ip, sizeof(*ip)) != sum ||
+        len != vns->frame_len ||
+        memcmp(eth->ether_shost, vns->ifaces[iface].mac, ETHER_ADDR_LEN))
+    { vns->damaged++; }
+
+    if (vns->latency_ns)
+    { vns->latency_ns[vns->received] = now - vns->sent_ns[seq]; }
+    vns->sent_ns[seq] = 0;
+    vns->received++;
+} /* -- sr_vns_handle_frame -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_vns_handle_rx(..)
+ * Scope:  Local
+ *
+ * Dispatch the complete commands in the receive buffer. Returns -1 if
+ * the router closed the session.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_vns_handle_rx(struct sr_vns* vns, uint64_t now)
+{
+    c_packet_header* hdr;
+    unsigned int len, i;
+
+    while (vns->rx_end - vns->rx_start >= sizeof(c_base))
+    {
+        hdr = (c_packet_header*)(vns->rx + vns->rx_start);
+        len = ntohl(hdr->mLen);
+        if (len < sizeof(c_base) || len > SR_VNS_MAX_MSG)
+        {
+            fprintf(stderr, "Error: bad command length %u from router\n",
+                    len);
+            return -1;
+        }
+        if (vns->rx_end - vns->rx_start < len)
+        { break; }
+        vns->rx_start += len;
+
+        if (ntohl(hdr->mType) == VNSCLOSE)
+        {
+            fprintf(stderr, "router closed the session\n");
+            return -1;
+        }
+        if (ntohl(hdr->mType) != VNSPACKET || len < sizeof(*hdr))
+        {
+            vns->other++;
+            continue;
+        }
+        for (i = 0; i < vns->n_ifaces; i++)
+        {
+            if (strncmp(hdr->mInterfaceName, vns->ifaces[i].name,
+                        sizeof(hdr->mInterfaceName)) == 0)
+            { break; }
+        }
+        if (i == vns->n_ifaces)
+        {
+            vns->other++;
+            continue;
+        }
+        sr_vns_handle_frame(vns, i, (uint8_t*)(hdr + 1),
+                            len - sizeof(*hdr), now);
+    }
+
+    if (vns->rx_start == vns->rx_end)
+    { vns->rx_start = vns->rx_end = 0; }
+    else if (vns->rx_start > SR_VNS_RXBUF_SIZE / 2)
+    {
+        memmove(vns->rx, vns->rx + vns->rx_start,
+                vns->rx_end - vns->rx_start);
+        vns->rx_end -= vns->rx_start;
+        vns->rx_start = 0;
+    }
+    return 0;
+} /* -- sr_vns_handle_rx -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_vns_phase(..)
+ * Scope:  Local
+ *
+ * Send count datagrams, to the routes in route_list in turn or, with no
+ * list, to random ones, with no more than window outstanding and, if
+ * rate is not 0, no more than rate a second. Returns once all are back
+ * or nothing has come back for a while. Returns the time taken in ns,
+ * or 0 if the session broke.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint64_t sr_vns_phase(struct sr_vns* vns, unsigned long count,
+                             const unsigned int* route_list,
+                             unsigned long window, double rate)
+{
+    struct pollfd pfd;
+    uint64_t start, now, last_progress, due;
+    unsigned long queued, i, before;
+    unsigned int dst;
+    int timeout;
+    ssize_t n;
+
+    vns->seq_base += vns->count;
+    vns->count = count;
+    vns->route_list = route_list;
+    vns->sent = vns->received = 0;
+    memset(vns->sent_ns, 0, count * sizeof(uint64_t));
+
+    start = last_progress = sr_vns_now();
+    while (vns->received < count)
+    {
+        now = sr_vns_now();
+
+        /* -- top up once the last batch is on its way -- */
+        if (vns->tx_start == vns->tx_end && vns->sent < count)
+        {
+            queued = SR_VNS_BATCH;
+            if (vns->sent + queued > count)
+            { queued = count - vns->sent; }
+            if (vns->sent + queued > vns->received + window)
+            { queued = vns->received + window - vns->sent; }
+            if (rate > 0)
+            {
+                due = (uint64_t)((now - start) * rate / 1e9) + 1;
+                if (vns->sent + queued > due)
+                { queued = due > vns->sent ? due - vns->sent : 0; }
+            }
+            for (i = 0; i < queued; i++)
+            {
+                dst = route_list ? route_list[vns->sent]
+                                 : sr_vns_rand(vns) % vns->n_routes;
+                if (sr_vns_queue_datagram(vns, dst,
+                                          vns->seq_base + vns->sent) != 0)
+                { break; }
+                vns->sent_ns[vns->sent++] = now;
+            }
+        }
+
+        if (vns->tx_start != vns->tx_end)
+        {
+            n = send(vns->fd, vns->tx + vns->tx_start,
+                     vns->tx_end - vns->tx_start, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n < 0 && errno != EAGAIN && errno != EINTR)
+            {
+                perror("send");
+                return 0;
+            }
+            if (n > 0)
+            { vns->tx_start += n; }
+            if (vns->tx_start == vns->tx_end)
+            { vns->tx_start = vns->tx_end = 0; }
+        }
+
+        /* -- wait for the router, the socket or the rate -- */
+        timeout = 0;
+        if (vns->tx_start == vns->tx_end &&
+            (vns->sent == count || vns->sent >= vns->received + window))
+        { timeout = 100; }
+        else if (vns->tx_start == vns->tx_end && rate > 0)
+        { timeout = 1; }
+        pfd.fd = vns->fd;
+        pfd.events = POLLIN | (vns->tx_start != vns->tx_end ? POLLOUT : 0);
+        if (poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+        {
+            perror("poll");
+            return 0;
+        }
+
+        before = vns->received;
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            n = recv(vns->fd, vns->rx + vns->rx_end,
+                     SR_VNS_RXBUF_SIZE - vns->rx_end, MSG_DONTWAIT);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+            {
+                fprintf(stderr, "Error: lost the router\n");
+                return 0;
+            }
+            if (n > 0)
+            {
+                vns->rx_end += n;
+                if (sr_vns_handle_rx(vns, sr_vns_now()) != 0)
+                { return 0; }
+            }
+        }
+
+        now = sr_vns_now();
+        if (vns->received != before || vns->tx_start != vns->tx_end ||
+            (vns->sent < count && vns->sent < vns->received + window))
+        { last_progress = now; }
+        else if (now - last_progress > SR_VNS_STALL_NS)
+        { break; }
+    }
+
+    return sr_vns_now() - start;
+} /* -- sr_vns_phase -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_vns_warmup_routes(..)
+ * Scope:  Local
+ *
+ * One route per distinct gateway, so that the router resolves them all.
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned int sr_vns_warmup_routes(struct sr_vns* vns,
+                                         unsigned int* list)
+{
+    unsigned int i, j, n = 0;
+
+    for (i = 0; i < vns->n_routes && n < SR_VNS_WARMUP_MAX; i++)
+    {
+        for (j = 0; j < n; j++)
+        {
+            if (vns->routes[list[j]].gw == vns->routes[i].gw)
+            { break; }
+        }
+        if (j == n)
+        { list[n++] = i; }
+    }
+    return n;
+} /* -- sr_vns_warmup_routes -- */
+
+static int sr_vns_cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_vns_listen(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_vns_listen(unsigned short port)
+{
+    struct sockaddr_in addr;
+    int fd, on = 1;
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(fd, 1) < 0)
+    {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+} /* -- sr_vns_listen -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_vns_accept(..)
+ * Scope:  Local
+ *
+ * Wait for the router to connect, giving up if it was started by us
+ * and has exited. A router reaped here is forgotten (*child = 0), so
+ * sr_vns_close does not wait for it or signal its pid again.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_vns_accept(int lfd, pid_t* child)
+{
+    struct pollfd pfd;
+    int fd, waited, on = 1;
+
+    for (waited = 0; waited < SR_VNS_ACCEPT_MS; waited += 100)
+    {
+        pfd.fd = lfd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 100) > 0)
+        {
+            if ((fd = accept(lfd, 0, 0)) < 0)
+            {
+                perror("accept");
+                return -1;
+            }
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            return fd;
+        }
+        if (*child > 0 && waitpid(*child, 0, WNOHANG) == *child)
+        {
+            *child = 0;
+            fprintf(stderr, "Error: router exited before connecting\n");
+            return -1;
+        }
+    }
+    fprintf(stderr, "Error: no router connected\n");
+    return -1;
+} /* -- sr_vns_accept -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_vns_close(..)
+ * Scope:  Local
+ *
+ * Close the session and wait for a router we started. Returns -1 if it
+ * did not exit cleanly.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_vns_close(struct sr_vns* vns, pid_t child)
+{
+    c_close msg;
+    pid_t pid;
+    int status, waited;
+
+    if (vns->fd >= 0)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.mLen = htonl(sizeof(msg));
+        msg.mType = htonl(VNSCLOSE);
+        strcpy(msg.mErrorMessage, "load test finished");
+        send(vns->fd, &msg, sizeof(msg), MSG_NOSIGNAL);
+        shutdown(vns->fd, SHUT_WR);
+    }
+    if (child <= 0)
+    { return 0; }
+
+    for (waited = 0; (pid = waitpid(child, &status, WNOHANG)) != child;
+         waited++)
+    {
+        if (pid < 0)
+        {
+            perror("waitpid");
+            return -1;
+        }
+        if (waited == 20)
+        { kill(child, SIGTERM); }
+        if (waited == 40)
+        { kill(child, SIGKILL); }
+        usleep(100000);
+    }
+    if (WIFSIGNALED(status) && WTERMSIG(status) != SIGTERM)
+    {
+        fprintf(stderr, "Error: router killed by signal %d\n",
+                WTERMSIG(status));
+        return -1;
+    }
+    return 0;
+} /* -- sr_vns_close -- */
+
+static void usage(char* argv0)
+{
+    printf("Format: %s [-p port] [-r routing table] [-c IP_CONFIG] [-k auth_key]\n"
+           "           [-n datagrams] [-w window] [-R rate] [-z frame size]\n"
+           "           [-l loss %%] [-S seed] [-- router command]\n", argv0);
+} /* -- usage -- */
+
+int main(int argc, char** argv)
+{
+    unsigned short port = SR_VNS_PORT;
+    char* rtable = "rtable";
+    char* config = "IP_CONFIG";
+    char* key_file = "auth_key";
+    unsigned long count = 100000, window = 256, lost, bad;
+    unsigned int warmup_n, *warmup_list;
+    double rate = 0, max_loss = 0;
+    uint64_t elapsed;
+    uint32_t* latency_ns;
+    struct sr_vns vns;
+    pid_t child = 0;
+    int lfd, c, ret = 0;
+
+    memset(&vns, 0, sizeof(vns));
+    vns.fd = -1;
+    vns.rand_state = 1;
+    vns.frame_len = 98;
+
+    while ((c = getopt(argc, argv, "hp:r:c:k:n:w:R:z:l:S:")) != EOF)
+    {
+        switch (c)
+        {
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'r':
+                rtable = optarg;
+                break;
+            case 'c':
+                config = optarg;
+                break;
+            case 'k':
+                key_file = optarg;
+                break;
+            case 'n':
+                count = strtoul(optarg, 0, 0);
+                break;
+            case 'w':
+                window = strtoul(optarg, 0, 0);
+                break;
+            case 'R':
+                rate = atof(optarg);
+                break;
+            case 'z':
+                vns.frame_len = atoi(optarg);
+                break;
+            case 'l':
+                max_loss = atof(optarg);
+                break;
+            case 'S':
+                vns.rand_state = strtoull(optarg, 0, 0) | 1;
+                break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 2;
+        }
+    }
+    if (count == 0 || window == 0 ||
+        vns.frame_len < SR_VNS_MIN_FRAME || vns.frame_len > 1514)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (sr_vns_read_config(&vns, config) != 0 ||
+        sr_vns_read_rtable(&vns, rtable) != 0)
+    { return 2; }
+
+    vns.rx = malloc(SR_VNS_RXBUF_SIZE);
+    vns.tx = malloc(SR_VNS_TXBUF_SIZE);
+    vns.sent_ns = malloc((count > SR_VNS_WARMUP_MAX ? count
+                                                    : SR_VNS_WARMUP_MAX) *
+                         sizeof(uint64_t));
+    vns.latency_ns = malloc(count * sizeof(uint32_t));
+    warmup_list = malloc(SR_VNS_WARMUP_MAX * sizeof(unsigned int));
+    if (!vns.rx || !vns.tx || !vns.sent_ns || !vns.latency_ns ||
+        !warmup_list)
+    {
+        perror("malloc");
+        return 2;
+    }
+
+    if ((lfd = sr_vns_listen(port)) < 0)
+    { return 2; }
+    printf("listening on 127.0.0.1:%u\n", port);
+    fflush(stdout);
+
+    if (optind < argc)
+    {
+        if ((child = fork()) < 0)
+        {
+            perror("fork");
+            return 2;
+        }
+        if (child == 0)
+        {
+            close(lfd);
+            execvp(argv[optind], argv + optind);
+            perror(argv[optind]);
+            _exit(127);
+        }
+    }
+
+    if ((vns.fd = sr_vns_accept(lfd, &child)) < 0 ||
+        sr_vns_handshake(&vns, key_file, rtable) != 0)
+    {
+        sr_vns_close(&vns, child);
+        return 2;
+    }
+    close(lfd);
+
+    /* -- every gateway once, so the router's ARP cache is warm -- */
+    warmup_n = sr_vns_warmup_routes(&vns, warmup_list);
+    latency_ns = vns.latency_ns;
+    vns.latency_ns = 0;
+    if (sr_vns_phase(&vns, warmup_n, warmup_list, warmup_n, 0) == 0)
+    {
+        sr_vns_close(&vns, child);
+        return 2;
+    }
+    printf("warm-up: %lu/%u gateways reached, %lu damaged, "
+           "%lu ARP requests answered\n",
+           vns.received, warmup_n, vns.damaged, vns.arp_replies);
+    vns.damaged = 0;
+    vns.latency_ns = latency_ns;
+
+    if ((elapsed = sr_vns_phase(&vns, count, 0, window, rate)) == 0)
+    {
+        sr_vns_close(&vns, child);
+        return 2;
+    }
+    lost = count - vns.received;
+    bad = lost + vns.damaged;
+
+    printf("%lu datagrams of %u bytes to %u routes, window %lu: "
+           "%lu back, %lu lost, %lu damaged, %lu duplicated\n",
+           count, vns.frame_len, vns.n_routes, window,
+           vns.received, lost, vns.damaged, vns.duplicates);
+    printf("%.3f s, %.0f datagrams/s forwarded\n",
+           elapsed / 1e9, vns.received / (elapsed / 1e9));
+    if (vns.received > 0)
+    {
+        qsort(vns.latency_ns, vns.received, sizeof(uint32_t), sr_vns_cmp_u32);
+        printf("latency us: min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  "
+               "p99.9 %.1f  max %.1f\n",
+               vns.latency_ns[0] / 1e3,
+               vns.latency_ns[vns.received / 2] / 1e3,
+               vns.latency_ns[vns.received * 9 / 10] / 1e3,
+               vns.latency_ns[vns.received * 99 / 100] / 1e3,
+               vns.latency_ns[vns.received * 999 / 1000] / 1e3,
+               vns.latency_ns[vns.received - 1] / 1e3);
+    }
+    printf("%lu ARP requests answered, %lu other frames from the router\n",
+           vns.arp_replies, vns.other);
+
+    if (bad * 100.0 > max_loss * count)
+    {
+        fprintf(stderr, "FAIL: %.3f%% lost or damaged, %.3f%% allowed\n",
+                bad * 100.0 / count, max_loss);
+        ret = 1;
+    }
+    if (sr_vns_close(&vns, child) != 0)
+    { ret = 1; }
+    return ret;
+} /* -- main -- */
@@ -32,6 +32,7 @@
 #include <errno.h>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
@@ -40,10 +41,18 @@
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
+#include "sr_pipeline.h"
+#include "sr_pcap.h"
+#include "sr_filter.h"
+#include "sr_afpacket.h"
+#include "sr_stats.h"
 
 #include "sha1.h"
 #include "vnscommand.h"
 
+#define SR_VNS_MAX_MSG     10000    /* largest command the server sends */
+#define SR_VNS_RXBUF_SIZE  (64*1024) /* must hold at least SR_VNS_MAX_MSG */
+
 static void sr_log_packet(struct sr_instance* , uint8_t* , int );
 static int  sr_arp_req_not_for_us(struct sr_instance* sr,
                                   uint8_t * packet /* lent */,
@@ -226,6 +235,9 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
         } /* -- switch -- */
     } /* -- for -- */
 
+    /* -- routes loaded before the interfaces were known -- */
+    sr_rt_bind_interfaces(sr);
+
     printf("Router interfaces:\n");
     sr_print_if_list(sr);
 
@@ -319,96 +331,25 @@ int sr_handle_auth_status(struct sr_instance* sr, c_auth_status* status) {
 }
 
 /*-----------------------------------------------------------------------------
- * Method: sr_read_from_server(..)
- * Scope: global
+ * Method: sr_dispatch_command(..)
+ * Scope: Local
  *
- * Houses main while loop for communicating with the virtual router server.
+ * Handle one complete VNS message of len bytes sitting in the receive
+ * buffer.  The message is handled in place, buf is not kept.
  *
  *---------------------------------------------------------------------------*/
 
-int sr_read_from_server(struct sr_instance* sr /* borrowed */)
-{
-    return sr_read_from_server_expect(sr, 0);
-}
-
-int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
+static int sr_dispatch_command(struct sr_instance* sr /* borrowed */,
+                               uint8_t* buf /* borrowed */, int len,
+                               int expected_cmd)
 {
-    int command, len;
-    unsigned char *buf = 0;
+    int command;
     c_packet_ethernet_header* sr_pkt = 0;
-    int ret = 0, bytes_read = 0;
-
-    /* REQUIRES */
-    assert(sr);
-
-    /*---------------------------------------------------------------------------
-      Read a command from the server
-      -------------------------------------------------------------------------*/
-
-    bytes_read = 0;
-
-    /* attempt to read the size of the incoming packet */
-    while( bytes_read < 4)
-    {
-        do
-        { /* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if((ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read,
-                            4 - bytes_read, 0)) == -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-
-                perror("recv(..):sr_client.c::sr_read_from_server");
-                return -1;
-            }
-            bytes_read += ret;
-        } while ( errno == EINTR); /* be mindful of signals */
-
-    }
-
-    len = ntohl(len);
-
-    if ( len > 10000 || len < 0 )
-    {
-        fprintf(stderr,"Error: command length to large %d\n",len);
-        close(sr->sockfd);
-        return -1;
-    }
-
-    if((buf = malloc(len)) == 0)
-    {
-        fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
-        return -1;
-    }
-
-    /* set first field of command since we've already read it */
-    *((int *)buf) = htonl(len);
-
-    bytes_read = 0;
+    int ret;
 
-    /* read the rest of the command */
-    while ( bytes_read < len - 4)
-    {
-        do
-        {/* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if ((ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read)) ==
-                    -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-                fprintf(stderr,"Error: failed reading command body %d\n",ret);
-                close(sr->sockfd);
-                return -1;
-            }
-            bytes_read += ret;
-        } while (errno == EINTR); /* be mindful of signals */
-    }
-
-    /* My entry for most unreadable line of code - guido */
-    /* ... you win - mc                                  */
-    command = *(((int *)buf)+1) = ntohl(*(((int *)buf)+1));
+    /* -- command field is converted in place, handlers expect it so -- */
+    command = ntohl(((c_base*)buf)->mType);
+    ((c_base*)buf)->mType = command;
 
     /* make sure the command is what we expected if we were expecting something */
     if(expected_cmd && command!=expected_cmd) {
@@ -426,23 +367,12 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         case VNSPACKET:
             sr_pkt = (c_packet_ethernet_header *)buf;
 
-            /* -- check if it is an ARP to another router if so drop   -- */
-            if ( sr_arp_req_not_for_us(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base))) )
+            if ( len < sizeof(c_packet_ethernet_header) )
             { break; }
 
-            /* -- log packet -- */
-            sr_log_packet(sr, buf + sizeof(c_packet_header),
-                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
-
-            /* -- pass to router, student's code should take over here -- */
-            sr_handlepacket(sr,
+            sr_receive_packet(sr,
                     (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
+                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header),
                     (char*)(buf + sizeof(c_base)));
 
             break;
@@ -453,9 +383,6 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
             fprintf(stderr,"VNS server closed session.\n");
             fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
             sr_session_closed_help();
-
-            if(buf)
-            { free(buf); }
             return 0;
             break;
 
@@ -501,9 +428,158 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
     }/* -- switch -- */
 
-    if(buf)
-    { free(buf); }
     return ret;
+} /* -- sr_dispatch_command -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_receive_packet(..)
+ * Scope: global
+ *
+ * Hand a frame received on interface to the router. Used for frames from
+ * the server and from the AF_PACKET rings alike.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_receive_packet(struct sr_instance* sr /* borrowed */,
+                       uint8_t* packet /* lent */,
+                       unsigned int len,
+                       char* interface /* lent */)
+{
+    /* -- check if it is an ARP to another router if so drop   -- */
+    if ( sr_arp_req_not_for_us(sr, packet, len, interface) )
+    {
+        sr_stats_count(SR_STATS_DROP_ARP_OTHER);
+        return;
+    }
+
+    /* -- log packet -- */
+    sr_log_packet(sr, packet, len);
+
+    /* -- pass to router, student's code should take over here -- */
+    if ( sr->pipeline )
+    {
+        sr_pipeline_dispatch(sr, packet, len, interface);
+        return;
+    }
+
+    sr_handlepacket(sr, packet, len, interface);
+} /* -- sr_receive_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_from_server(..)
+ * Scope: global
+ *
+ * Houses main while loop for communicating with the virtual router server.
+ * Each call reads whatever the socket has ready into sr->rx_buf and
+ * handles every complete message in it, so at high packet rates a single
+ * recv(..) serves a whole batch of packets.  A trailing partial message is
+ * kept for the next call.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_read_from_server(struct sr_instance* sr /* borrowed */)
+{
+    return sr_read_from_server_expect(sr, 0);
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_from_server_expect(..)
+ * Scope: global
+ *
+ * As above, but with expected_cmd set exactly one message is handled and
+ * it must be of that type (or VNSCLOSE).  Anything received behind it
+ * stays buffered.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
+{
+    uint32_t len;
+    int ret = 0, handled = 0;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if ( ! sr->rx_buf )
+    {
+        if ( (sr->rx_buf = (uint8_t*)malloc(SR_VNS_RXBUF_SIZE)) == 0 )
+        {
+            fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
+            return -1;
+        }
+        sr->rx_start = sr->rx_end = 0;
+    }
+
+    while ( 1 )
+    {
+        /*-----------------------------------------------------------------------
+          Handle the complete commands already buffered
+          ---------------------------------------------------------------------*/
+
+        while ( sr->rx_end - sr->rx_start >= 4 )
+        {
+            memcpy(&len, sr->rx_buf + sr->rx_start, 4);
+            len = ntohl(len);
+
+            if ( len > SR_VNS_MAX_MSG || len < sizeof(c_base) )
+            {
+                fprintf(stderr,"Error: command length to large %u\n",len);
+                close(sr->sockfd);
+                return -1;
+            }
+
+            if ( sr->rx_end - sr->rx_start < len )
+            { break; }
+
+            ret = sr_dispatch_command(sr, sr->rx_buf + sr->rx_start, len,
+                    expected_cmd);
+            sr->rx_start += len;
+            sr->rx_msgs++;
+            handled++;
+
+            if ( expected_cmd || ret != 1 )
+            { return ret; }
+        }
+
+        if ( handled )
+        { return 1; }
+
+        /*-----------------------------------------------------------------------
+          Read as much as the server has ready
+          ---------------------------------------------------------------------*/
+
+        /* -- slide the partial command down to make room -- */
+        if ( sr->rx_start > 0 )
+        {
+            memmove(sr->rx_buf, sr->rx_buf + sr->rx_start,
+                    sr->rx_end - sr->rx_start);
+            sr->rx_end -= sr->rx_start;
+            sr->rx_start = 0;
+        }
+
+        do
+        { /* -- just in case SIGALRM breaks recv -- */
+            errno = 0; /* -- hacky glibc workaround -- */
+            if((ret = recv(sr->sockfd, sr->rx_buf + sr->rx_end,
+                            SR_VNS_RXBUF_SIZE - sr->rx_end, 0)) == -1)
+            {
+                if ( errno == EINTR )
+                { continue; }
+
+                perror("recv(..):sr_client.c::sr_read_from_server");
+                return -1;
+            }
+        } while ( errno == EINTR); /* be mindful of signals */
+
+        if ( ret == 0 )
+        {
+            fprintf(stderr,"Error: connection to server closed\n");
+            return -1;
+        }
+
+        sr->rx_end += ret;
+        sr->rx_reads++;
+    }
 }/* -- sr_read_from_server -- */
 
 /*-----------------------------------------------------------------------------
@@ -550,12 +626,52 @@ sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
 
 } /* -- sr_ether_addrs_match_interface -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_writev_all(..)
+ * Scope: Local
+ *
+ * writev(..) the whole iovec, resuming after signal interruptions and
+ * short writes.  The iovec is consumed in the process.
+ *
+ *----------------------------------------------------------------------------*/
+
+static int sr_writev_all(int fd, struct iovec* iov, int iovcnt)
+{
+    ssize_t ret;
+
+    while ( iovcnt > 0 )
+    {
+        if ( (ret = writev(fd, iov, iovcnt)) < 0 )
+        {
+            if ( errno == EINTR )
+            { continue; }
+            return -1;
+        }
+
+        /* -- skip what has been written -- */
+        while ( iovcnt > 0 && (size_t)ret >= iov->iov_len )
+        {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if ( iovcnt > 0 )
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return 0;
+} /* -- sr_writev_all -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_send_packet(..)
  * Scope: Global
  *
  * Send a packet (ethernet header included!) of length 'len' to the server
- * to be injected onto the wire.
+ * to be injected onto the wire.  The VNS header is gathered from the stack
+ * so the frame itself is never copied.
  *
  *---------------------------------------------------------------------------*/
 
@@ -564,7 +680,10 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
                          unsigned int len,
                          const char* iface /* borrowed */)
 {
-    c_packet_header *sr_pkt;
+    c_packet_header sr_pkt;
+    struct iovec iov[2];
+    struct sr_if* out;
+    int ret;
     unsigned int total_len =  len + (sizeof(c_packet_header));
 
     /* REQUIRES */
@@ -578,33 +697,47 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
         return -1;
     }
 
-    /* Create packet */
-    sr_pkt = (c_packet_header *)malloc(len +
-            sizeof(c_packet_header));
-    assert(sr_pkt);
-    sr_pkt->mLen  = htonl(total_len);
-    sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
-    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
-            buf,len);
+    /* Create packet header */
+    sr_pkt.mLen  = htonl(total_len);
+    sr_pkt.mType = htonl(VNSPACKET);
+    strncpy(sr_pkt.mInterfaceName,iface,16);
 
     /* -- log packet -- */
     sr_log_packet(sr,buf,len);
 
     if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
         fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
-        free ( sr_pkt );
         return -1;
     }
 
-    if( write(sr->sockfd, sr_pkt, total_len) < total_len ){
-        fprintf(stderr, "Error writing packet\n");
-        free(sr_pkt);
-        return -1;
+    out = sr_get_interface(sr, iface);
+
+    /* -- straight onto the device's tx ring, no server involved -- */
+    if ( sr->afpacket )
+    {
+        ret = sr_afpacket_send(sr->afpacket, out->index, buf, len);
     }
+    else
+    {
+        iov[0].iov_base = &sr_pkt;
+        iov[0].iov_len  = sizeof(c_packet_header);
+        iov[1].iov_base = buf;
+        iov[1].iov_len  = len;
 
-    free(sr_pkt);
+        pthread_mutex_lock(&(sr->send_lock));
+        ret = sr_writev_all(sr->sockfd, iov, 2);
+        pthread_mutex_unlock(&(sr->send_lock));
 
+        if( ret != 0 )
+        { fprintf(stderr, "Error writing packet\n"); }
+    }
+
+    if( ret != 0 ){
+        sr_stats_count(SR_STATS_DROP_TX);
+        return -1;
+    }
+
+    sr_stats_count_if(out->index, SR_STATS_TX_PACKETS, len);
     return 0;
 } /* -- sr_send_packet -- */
 
@@ -616,23 +749,18 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
 
 void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
 {
-    struct pcap_pkthdr h;
-    int size;
-
     /* REQUIRES */
     assert(sr);
 
-    if(!sr->logfile)
+    if(!sr->pcap)
     {return; }
 
-    size = min(PACKET_DUMP_SIZE, len);
-
-    gettimeofday(&h.ts, 0);
-    h.caplen = size;
-    h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
+    if(sr->capture_filter &&
+       !sr_filter_match(sr->capture_filter, buf, (unsigned int)len))
+    {return; }
 
-    sr_dump(sr->logfile, &h, buf);
-    fflush(sr->logfile);
+    /* -- copied into the capture ring, written out by its own thread -- */
+    sr_pcap_log(sr->pcap, buf, len);
 } /* -- sr_log_packet -- */
 
 /*-----------------------------------------------------------------------------